@@ -0,0 +1,46 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+#include <string>
+#include <chrono>
+
+using namespace std;
+
+// Entry points of the individual benchmark groups, run in order by bench/main.cpp.
+void runCompletionBenchmarks();
+void runTrieBenchmarks();
+void runLexerBenchmarks();
+void runLookupBenchmarks();
+void runSpawnBenchmarks();
+void runHistoryBenchmarks();
+void runParallelBenchmarks();
+void runUtilitiesBenchmarks();
+void runPipesBenchmarks();
+void runTraceBenchmarks();
+void runCacheBenchmarks();
+void runGlobBenchmarks();
+void runPlanBenchmarks();
+void runScriptBenchmarks();
+void runHeredocBenchmarks();
+void runSubstitutionBenchmarks();
+
+// Records one measurement for the machine-readable report written with --json.
+void recordResult(const string& group, const string& name, double value, const string& unit);
+
+// Creates a fresh directory under /tmp and returns its path, or "" on failure.
+string makeTempDir(const string& name);
+
+// Creates @dirs directories under @root with @executablesPerDir empty executables each, named
+// tool<dir>_<i>, and returns them joined as a PATH string.
+string makeSyntheticPath(const string& root, int dirs, int executablesPerDir);
+
+// Returns the mean wall time of @f in microseconds over @repetitions runs, after one warm-up run.
+template <typename F>
+double averageMicros(int repetitions, F&& f) {
+    f();
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < repetitions; r++) f();
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, micro>(end - start).count() / repetitions;
+}
+
+#endif // BENCH_HPP
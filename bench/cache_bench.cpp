@@ -0,0 +1,37 @@
+// What the cache builtin costs and saves: a command run directly, through the cache with an empty store
+// (run, capture, hash and store) and replayed from the store.
+#include <string>
+#include <cstdio>
+
+#include "bench.hpp"
+#include "shell.hpp"
+
+using namespace std;
+
+static const int RUNS = 50;
+
+void runCacheBenchmarks() {
+    string directory = makeTempDir("cache");
+    if (directory.empty()) return;
+    // the store is opened once per shell, so this has to come before any other use of the builtin
+    setenv("SHELL_CACHE_DIR", directory.c_str(), 1);
+    if (!openResultCache()) return;
+
+    const string command = "seq 300000";
+    fflush(stdout); // executeLine below redirects stdout
+    double direct = averageMicros(RUNS, [&]() { executeLine(command + " > /dev/null"); });
+    double miss = averageMicros(RUNS, [&]() {
+        resultCache.clear();
+        executeLine("cache " + command + " > /dev/null");
+    });
+    double hit = averageMicros(RUNS, [&]() { executeLine("cache " + command + " > /dev/null"); });
+    resultCache.clear();
+
+    printf("%-10s %10s\n", command.c_str(), "us/line");
+    printf("%-10s %10.1f\n", "direct", direct);
+    printf("%-10s %10.1f\n", "miss", miss);
+    printf("%-10s %10.1f\n", "hit", hit);
+    recordResult("cache", "direct", direct, "us");
+    recordResult("cache", "miss", miss, "us");
+    recordResult("cache", "hit", hit, "us");
+}
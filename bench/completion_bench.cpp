@@ -0,0 +1,96 @@
+// Measures Tab completion latency against a synthetic PATH with a growing number of directories.
+// Compares rebuilding the executable list on every keypress (what collectInput used to do) with the
+// long-lived ExecutableIndex, the same lookup through the background CompletionWorker (a warm round trip to
+// its thread), and times findLongestPrefix over the candidates. Then filename completion in one large directory
+// (SHELL_BENCH_LISTING_FILES, 500000 by default): the first listing, and Tabs answered from the cached one.
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bench.hpp"
+#include "shell.hpp"
+
+using namespace std;
+
+static const int EXECUTABLES_PER_DIR = 100;
+static const int REPETITIONS = 50;
+
+void runCompletionBenchmarks() {
+    string root = makeTempDir("completion_bench");
+    if (root.empty()) return;
+
+    printf("%8s %12s %18s %18s %18s %18s\n", "dirs", "executables", "rebuild/tab (us)", "index/tab (us)",
+           "worker/tab (us)", "longest pfx (us)");
+    for (int dirs = 1; dirs <= 64; dirs *= 2) {
+        string path = makeSyntheticPath(root + "/" + to_string(dirs), dirs, EXECUTABLES_PER_DIR);
+
+        double rebuild = averageMicros(REPETITIONS, [&]() {
+            ExecutableIndex fresh;
+            fresh.complete(path, "tool0_");
+        });
+
+        ExecutableIndex index;
+        double indexed = averageMicros(REPETITIONS, [&]() {
+            index.complete(path, "tool0_");
+        });
+
+        CompletionWorker worker;
+        vector<string> answer;
+        // a different line every time, so that no answer is reused
+        int line = 0;
+        double viaWorker = averageMicros(REPETITIONS, [&]() {
+            worker.request({"tool0_" + to_string(line++ % 10), path, "/"}, chrono::milliseconds(60000), answer);
+        });
+
+        vector<string> candidates = index.complete(path, "tool");
+        double longestPrefix = averageMicros(REPETITIONS, [&]() {
+            findLongestPrefix(candidates);
+        });
+
+        printf("%8d %12d %18.1f %18.1f %18.1f %18.1f\n", dirs, dirs * EXECUTABLES_PER_DIR, rebuild, indexed, viaWorker,
+               longestPrefix);
+        string suffix = "/dirs=" + to_string(dirs);
+        recordResult("completion", "rebuild_per_tab" + suffix, rebuild, "us");
+        recordResult("completion", "index_per_tab" + suffix, indexed, "us");
+        recordResult("completion", "worker_per_tab" + suffix, viaWorker, "us");
+        recordResult("completion", "find_longest_prefix" + suffix, longestPrefix, "us");
+    }
+
+    size_t files = getenv("SHELL_BENCH_LISTING_FILES") ? atol(getenv("SHELL_BENCH_LISTING_FILES")) : 500000;
+    string spool = root + "/spool";
+    filesystem::create_directory(spool);
+    int dir = open(spool.c_str(), O_RDONLY | O_DIRECTORY);
+    for (size_t i = 0; i < files; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "msg%07zu", i);
+        int fd = openat(dir, name, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd >= 0) close(fd);
+    }
+    close(dir);
+
+    DirectoryCache directories;
+    auto start = chrono::steady_clock::now();
+    directories.listing(spool);
+    double firstListing = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    double cachedTab = averageMicros(REPETITIONS, [&]() {
+        auto listing = directories.listing(spool);
+        listing->withPrefix("msg01234");
+    });
+    CompletionWorker worker;
+    vector<string> answer;
+    int line = 0;
+    double workerTab = averageMicros(REPETITIONS, [&]() {
+        worker.request({"cat msg0123" + to_string(line++ % 10), PATH, spool}, chrono::milliseconds(60000), answer);
+    });
+    printf("\n%zu files in one directory: first listing %.1f ms, cached Tab %.1f us, Tab through the worker %.1f us\n",
+           files, firstListing, cachedTab, workerTab);
+    recordResult("completion", "first_listing/files=" + to_string(files), firstListing * 1000, "us");
+    recordResult("completion", "cached_listing_tab/files=" + to_string(files), cachedTab, "us");
+    recordResult("completion", "worker_filename_tab/files=" + to_string(files), workerTab, "us");
+
+    filesystem::remove_all(root);
+}
@@ -0,0 +1,121 @@
+// Measures glob expansion over a tree of SHELL_BENCH_GLOB_FILES files (1000000 by default), spread over two
+// levels of directories, half of them *.log. Times patterns inside one directory, a ** walk with one thread
+// and with one per core, and `find` doing the same walk for comparison. Then the compiled matcher against
+// fnmatch(3) per name, including a pattern that makes a backtracking matcher go quadratic.
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <filesystem>
+#include <fnmatch.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bench.hpp"
+#include "shell.hpp"
+
+using namespace std;
+
+static const int FANOUT = 100;   // directories per level
+
+static double millisSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// number of matches of @pattern (relative to the working directory) and the time the walk took
+static size_t timeGlob(const string& pattern, unsigned threads, double& millis) {
+    size_t matches = 0;
+    auto start = chrono::steady_clock::now();
+    Glob(pattern).expand([&](const string&) {
+        matches++;
+        return true;
+    }, threads);
+    millis = millisSince(start);
+    return matches;
+}
+
+void runGlobBenchmarks() {
+    string root = makeTempDir("glob_bench");
+    if (root.empty()) return;
+    size_t files = getenv("SHELL_BENCH_GLOB_FILES") ? atol(getenv("SHELL_BENCH_GLOB_FILES")) : 1000000;
+    size_t perDirectory = max<size_t>(1, files / (FANOUT * FANOUT));
+
+    auto start = chrono::steady_clock::now();
+    for (int top = 0; top < FANOUT; top++) {
+        for (int sub = 0; sub < FANOUT; sub++) {
+            string directory = root + "/d" + to_string(top) + "/s" + to_string(sub);
+            filesystem::create_directories(directory);
+            int dir = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+            for (size_t i = 0; i < perDirectory; i++) {
+                char name[32];
+                snprintf(name, sizeof(name), "f%05zu.%s", i, i % 2 ? "txt" : "log");
+                int fd = openat(dir, name, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+                if (fd >= 0) close(fd);
+            }
+            close(dir);
+        }
+    }
+    printf("tree: %zu files in %d directories, created in %.0f ms\n", perDirectory * FANOUT * FANOUT,
+           FANOUT * FANOUT, millisSince(start));
+
+    string cwd = filesystem::current_path().string();
+    chdir(root.c_str());
+    unsigned cores = max(1u, thread::hardware_concurrency());
+
+    printf("%-26s %10s %10s %12s\n", "pattern", "threads", "matches", "time (ms)");
+    typedef struct {
+        const char* name;
+        string pattern;
+        unsigned threads;
+    } Case;
+    vector<Case> cases = {
+        {"one_directory", "d7/s7/*.log", 1},
+        {"class_and_any", "d7/s[0-4]?/f0000[0-9].log", 1},
+        {"per_directory", "d*/s*/f00001.txt", 1},
+        {"recursive", "**/*.log", 1},
+        {"recursive", "**/*.log", cores},
+    };
+    for (const Case& c : cases) {
+        double millis;
+        size_t matches = timeGlob(c.pattern, c.threads, millis);
+        printf("%-26s %10u %10zu %12.1f\n", c.pattern.c_str(), c.threads, matches, millis);
+        recordResult("glob", string(c.name) + "/threads=" + to_string(c.threads), millis, "ms");
+    }
+
+    start = chrono::steady_clock::now();
+    int status = system("find . -name '*.log' > /dev/null");
+    double findMillis = millisSince(start);
+    if (status == 0) {
+        printf("%-26s %10s %10s %12.1f\n", "find -name '*.log'", "1", "-", findMillis);
+        recordResult("glob", "find", findMillis, "ms");
+    }
+    chdir(cwd.c_str());
+
+    // per name: the compiled matcher against fnmatch
+    printf("%-26s %16s %16s\n", "pattern", "GlobMatcher (ns)", "fnmatch (ns)");
+    const int NAMES = 100000;
+    vector<string> names;
+    for (int i = 0; i < NAMES; i++) names.push_back("f" + to_string(i * 7919 % 100000) + (i % 2 ? ".txt" : ".log"));
+    vector<pair<string, vector<string>>> matcherCases = {
+        {"*.log", names},
+        {"f[0-4]*[02468].?og", names},
+        // each star can take any share of the a's, so backtracking tries them all before failing
+        {"a*a*a*a*a*[bc]", vector<string>(NAMES / 100, string(200, 'a'))},
+    };
+    for (auto& [pattern, subjects] : matcherCases) {
+        GlobMatcher matcher(pattern);
+        size_t hits = 0;
+        double compiled = averageMicros(3, [&]() {
+            for (const string& subject : subjects) hits += matcher.matches(subject);
+        }) * 1000 / subjects.size();
+        double libc = averageMicros(3, [&]() {
+            for (const string& subject : subjects) hits += fnmatch(pattern.c_str(), subject.c_str(), FNM_PERIOD) == 0;
+        }) * 1000 / subjects.size();
+        printf("%-26s %16.1f %16.1f\n", pattern.c_str(), compiled, libc);
+        recordResult("glob", "matcher/" + pattern, compiled, "ns");
+        recordResult("glob", "fnmatch/" + pattern, libc, "ns");
+    }
+
+    filesystem::remove_all(root);
+}
@@ -0,0 +1,85 @@
+// Result collection and the helpers shared by the benchmark groups.
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <filesystem>
+
+#include "bench.hpp"
+
+using namespace std;
+
+typedef struct {
+    string group;
+    string name;
+    double value;
+    string unit;
+} BenchResult;
+
+vector<BenchResult> benchResults;
+
+void recordResult(const string& group, const string& name, double value, const string& unit) {
+    benchResults.push_back({group, name, value, unit});
+}
+
+static string jsonEscape(const string& s) {
+    string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char) c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+// Writes all recorded results as one JSON document; returns false if the file cannot be written.
+bool writeJsonReport(const string& fileName) {
+    FILE* out = fopen(fileName.c_str(), "w");
+    if (out == nullptr) return false;
+
+    fprintf(out, "{\n  \"benchmark\": \"shell_bench\",\n  \"timestamp\": %lld,\n", (long long) time(nullptr));
+    fprintf(out, "  \"compiler\": \"%s\",\n  \"cpus\": %ld,\n", jsonEscape(__VERSION__).c_str(), sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(out, "  \"results\": [\n");
+    for (size_t i = 0; i < benchResults.size(); i++) {
+        const BenchResult& r = benchResults[i];
+        fprintf(out, "    {\"group\": \"%s\", \"name\": \"%s\", \"value\": %.6g, \"unit\": \"%s\"}%s\n",
+                jsonEscape(r.group).c_str(), jsonEscape(r.name).c_str(), r.value, jsonEscape(r.unit).c_str(),
+                i + 1 < benchResults.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    return fclose(out) == 0;
+}
+
+string makeTempDir(const string& name) {
+    string pattern = "/tmp/" + name + ".XXXXXX";
+    if (mkdtemp(pattern.data()) == nullptr) {
+        perror("mkdtemp failed");
+        return "";
+    }
+    return pattern;
+}
+
+string makeSyntheticPath(const string& root, int dirs, int executablesPerDir) {
+    string path;
+    for (int d = 0; d < dirs; d++) {
+        string dir = root + "/dir" + to_string(d);
+        filesystem::create_directories(dir);
+        for (int i = 0; i < executablesPerDir; i++) {
+            string file = dir + "/tool" + to_string(d) + "_" + to_string(i);
+            int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0755);
+            if (fd >= 0) close(fd);
+        }
+        if (!path.empty()) path += ":";
+        path += dir;
+    }
+    return path;
+}
@@ -0,0 +1,48 @@
+// Feeding text to a program's stdin: a here-document (written once into a sealed memfd), the same text piped
+// in by `cat file |` as before here-documents, and `< file`, for texts from 4 KiB to 64 MiB. Times whole
+// lines, the lexing of the here-document included.
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <fstream>
+#include <filesystem>
+
+#include "bench.hpp"
+#include "shell.hpp"
+
+using namespace std;
+
+void runHeredocBenchmarks() {
+    string root = makeTempDir("heredoc_bench");
+    if (root.empty()) return;
+    // the readers are the coreutils programs, not the shell's own cat/wc
+    bool original = fastUtilities;
+    fastUtilities = false;
+
+    printf("%-10s %16s %16s %16s\n", "text", "<<EOF (us)", "cat | (us)", "< file (us)");
+    for (size_t kilobytes : {4, 1024, 64 * 1024}) {
+        string line(99, 'x');
+        line += '\n';
+        string text;
+        for (size_t i = 0; i < (kilobytes << 10) / line.size(); i++) text += line;
+        string file = root + "/text";
+        ofstream(file) << text;
+
+        string hereDocument = "wc -c <<'EOF' > /dev/null\n" + text + "EOF";
+        string piped = "cat " + file + " | wc -c > /dev/null";
+        string redirected = "wc -c < " + file + " > /dev/null";
+        int runs = kilobytes < 1024 ? 200 : kilobytes < 65536 ? 50 : 5;
+        fflush(stdout); // the lines redirect stdout
+        double memfd = averageMicros(runs, [&]() { executeLine(hereDocument); });
+        double pipe = averageMicros(runs, [&]() { executeLine(piped); });
+        double input = averageMicros(runs, [&]() { executeLine(redirected); });
+        string name = to_string(kilobytes) + "K";
+        printf("%-10s %16.1f %16.1f %16.1f\n", name.c_str(), memfd, pipe, input);
+        recordResult("heredoc", "heredoc/" + name, memfd, "us");
+        recordResult("heredoc", "cat_pipe/" + name, pipe, "us");
+        recordResult("heredoc", "file/" + name, input, "us");
+    }
+
+    fastUtilities = original;
+    filesystem::remove_all(root);
+}
@@ -0,0 +1,66 @@
+// HistoryStore startup against history files of growing length (only the tail that fits the ring is
+// loaded), and search latency through the trigram index compared with scanning every entry.
+#include <string>
+#include <cstdio>
+#include <fstream>
+#include <filesystem>
+
+#include "bench.hpp"
+#include "shell.hpp"
+
+using namespace std;
+
+static const size_t RING_SIZE = 10000;
+static const int REPETITIONS = 20;
+
+static string syntheticCommand(size_t i) {
+    // a few recurring programs with varying arguments, like a real history
+    static const char* programs[] = {"git status", "ls -la", "make -j8", "cd src/module", "grep -rn pattern"};
+    return string(programs[i % 5]) + " file" + to_string(i % 977) + ".txt";
+}
+
+// substring scan over every held entry, what `history | grep` would do
+static size_t scanAll(const HistoryStore& store, const string& pattern) {
+    size_t found = 0;
+    for (uint64_t sequence = store.oldest(); sequence <= store.newest(); sequence++) {
+        if (store.contains(sequence) && store.at(sequence).find(pattern) != string::npos) found++;
+    }
+    return found;
+}
+
+void runHistoryBenchmarks() {
+    string root = makeTempDir("history_bench");
+    if (root.empty()) return;
+
+    printf("%10s %16s\n", "file lines", "startup (us)");
+    for (size_t lines = 10000; lines <= 1000000; lines *= 10) {
+        string file = root + "/history_" + to_string(lines);
+        {
+            ofstream out(file);
+            for (size_t i = 0; i < lines; i++) out << syntheticCommand(i) << '\n';
+        }
+        double startup = averageMicros(REPETITIONS, [&]() {
+            HistoryStore store(RING_SIZE);
+            store.open(file);
+        });
+        printf("%10zu %16.1f\n", lines, startup);
+        recordResult("history", "startup/lines=" + to_string(lines), startup, "us");
+    }
+
+    HistoryStore store(100000);
+    for (size_t i = 0; i < 100000; i++) store.add(syntheticCommand(i));
+
+    printf("\n%24s %14s %14s\n", "pattern", "indexed (us)", "scan (us)");
+    for (const string pattern : {"file976.txt", "make -j8 file12", "src/module", "no such thing"}) {
+        volatile size_t sink = 0;
+        double indexed = averageMicros(REPETITIONS, [&]() { sink = sink + store.searchAll(pattern).size(); });
+        double scan = averageMicros(REPETITIONS, [&]() { sink = sink + scanAll(store, pattern); });
+        double newest = averageMicros(REPETITIONS, [&]() { sink = sink + store.searchBackward(pattern, UINT64_MAX); });
+        printf("%24s %14.1f %14.1f   (newest match %.2f us)\n", pattern.c_str(), indexed, scan, newest);
+        recordResult("history", "search_all/" + pattern, indexed, "us");
+        recordResult("history", "scan_all/" + pattern, scan, "us");
+        recordResult("history", "search_newest/" + pattern, newest, "us");
+    }
+
+    filesystem::remove_all(root);
+}
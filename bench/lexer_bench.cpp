@@ -0,0 +1,58 @@
+// Lexer and parseInput throughput in MB/s on short interactive-style lines and on generated lines of
+// several hundred KB, with plain, quoted and escaped arguments.
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+
+#include "bench.hpp"
+#include "shell.hpp"
+
+using namespace std;
+
+// Builds a line of roughly @bytes bytes by repeating the given argument pattern.
+static string makeLine(const string& argument, size_t bytes) {
+    string line = "generated-tool";
+    for (size_t i = 0; line.size() < bytes; i++) {
+        line += " ";
+        line += argument;
+        line += to_string(i);
+    }
+    return line;
+}
+
+static void measure(const string& name, const string& line, int repetitions) {
+    Lexer lexer;
+    size_t tokens = 0;
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < repetitions; r++) {
+        if (!lexer.tokenize(line)) {
+            printf("%-24s failed: %s\n", name.c_str(), lexer.error().c_str());
+            return;
+        }
+        tokens += lexer.tokens().size();
+    }
+    auto lexed = chrono::steady_clock::now();
+    for (int r = 0; r < repetitions; r++) {
+        parseInput(line);
+    }
+    auto parsed = chrono::steady_clock::now();
+
+    double megabytes = (double) line.size() * repetitions / (1024 * 1024);
+    double lexRate = megabytes / chrono::duration<double>(lexed - start).count();
+    double parseRate = megabytes / chrono::duration<double>(parsed - lexed).count();
+    printf("%-24s %10zu %10zu %12.1f %12.1f\n", name.c_str(), line.size(), tokens / repetitions, lexRate, parseRate);
+    recordResult("lexer", "tokenize/" + name, lexRate, "MB/s");
+    recordResult("lexer", "parseInput/" + name, parseRate, "MB/s");
+}
+
+void runLexerBenchmarks() {
+    printf("%-24s %10s %10s %12s %12s\n", "line", "bytes", "tokens", "lex MB/s", "parse MB/s");
+    measure("short_line", "echo 'hello world' \"foo bar\" baz > /tmp/out.txt", 200000);
+    measure("large_plain", makeLine("--input=/data/shards/part-", 512 * 1024), 50);
+    measure("large_long_words", makeLine(string(200, 'x'), 512 * 1024), 50);
+    measure("large_single_quoted", makeLine("'quoted argument with spaces '", 512 * 1024), 50);
+    measure("large_double_quoted", makeLine("\"say \\\"hi\\\" to $USER \"", 512 * 1024), 50);
+    measure("large_escaped", makeLine("path\\ with\\ spaces/file", 512 * 1024), 50);
+}
@@ -0,0 +1,53 @@
+// programLocationInPATH hits and misses against a synthetic PATH with a growing number of directories,
+// both cold (empty command hash table) and warm.
+#include <string>
+#include <cstdio>
+#include <filesystem>
+
+#include "bench.hpp"
+#include "shell.hpp"
+
+using namespace std;
+
+static const int EXECUTABLES_PER_DIR = 50;
+static const int REPETITIONS = 2000;
+
+void runLookupBenchmarks() {
+    string root = makeTempDir("lookup_bench");
+    if (root.empty()) return;
+    string originalPath = PATH;
+
+    printf("%8s %14s %14s %14s %14s\n", "dirs", "cold hit (us)", "warm hit (us)", "cold miss (us)", "warm miss (us)");
+    for (int dirs = 1; dirs <= 64; dirs *= 4) {
+        PATH = makeSyntheticPath(root + "/" + to_string(dirs), dirs, EXECUTABLES_PER_DIR);
+        // the hit lives in the last directory, so that both hits and misses walk all of PATH when cold
+        string hit = "tool" + to_string(dirs - 1) + "_0";
+        string miss = "no-such-tool";
+
+        double coldHit = averageMicros(REPETITIONS, [&]() {
+            commandHashTable.clear();
+            programLocationInPATH(hit);
+        });
+        double warmHit = averageMicros(REPETITIONS, [&]() {
+            programLocationInPATH(hit);
+        });
+        double coldMiss = averageMicros(REPETITIONS, [&]() {
+            commandHashTable.clear();
+            programLocationInPATH(miss);
+        });
+        double warmMiss = averageMicros(REPETITIONS, [&]() {
+            programLocationInPATH(miss);
+        });
+
+        printf("%8d %14.2f %14.2f %14.2f %14.2f\n", dirs, coldHit, warmHit, coldMiss, warmMiss);
+        string suffix = "/dirs=" + to_string(dirs);
+        recordResult("lookup", "cold_hit" + suffix, coldHit, "us");
+        recordResult("lookup", "warm_hit" + suffix, warmHit, "us");
+        recordResult("lookup", "cold_miss" + suffix, coldMiss, "us");
+        recordResult("lookup", "warm_miss" + suffix, warmMiss, "us");
+    }
+
+    PATH = originalPath;
+    commandHashTable.clear();
+    filesystem::remove_all(root);
+}
@@ -0,0 +1,64 @@
+// shell_bench [--json FILE] [--filter GROUP]
+// Runs the microbenchmarks, prints a table per group and optionally writes all results as JSON.
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+
+using namespace std;
+
+bool writeJsonReport(const string& fileName);
+
+typedef struct {
+    const char* name;
+    void (*run)();
+} BenchGroup;
+
+int main(int argc, char** argv) {
+    const vector<BenchGroup> groups = {
+        {"completion", runCompletionBenchmarks},
+        {"trie", runTrieBenchmarks},
+        {"lexer", runLexerBenchmarks},
+        {"lookup", runLookupBenchmarks},
+        {"spawn", runSpawnBenchmarks},
+        {"history", runHistoryBenchmarks},
+        {"parallel", runParallelBenchmarks},
+        {"utilities", runUtilitiesBenchmarks},
+        {"pipes", runPipesBenchmarks},
+        {"trace", runTraceBenchmarks},
+        {"cache", runCacheBenchmarks},
+        {"glob", runGlobBenchmarks},
+        {"plan", runPlanBenchmarks},
+        {"script", runScriptBenchmarks},
+        {"heredoc", runHeredocBenchmarks},
+        {"substitution", runSubstitutionBenchmarks},
+    };
+
+    string jsonFile;
+    string filter;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            jsonFile = argv[++i];
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--json FILE] [--filter GROUP]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    for (const BenchGroup& group : groups) {
+        if (!filter.empty() && filter != group.name) continue;
+        printf("== %s\n", group.name);
+        group.run();
+        printf("\n");
+    }
+
+    if (!jsonFile.empty() && !writeJsonReport(jsonFile)) {
+        perror("writing the JSON report failed");
+        return 1;
+    }
+    return 0;
+}
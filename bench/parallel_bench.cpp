@@ -0,0 +1,40 @@
+// Throughput of the parallel builtin for many short jobs at growing concurrency, against running the same
+// commands one REPL line at a time.
+#include <string>
+#include <vector>
+#include <cstdio>
+
+#include "bench.hpp"
+#include "shell.hpp"
+
+using namespace std;
+
+static const size_t JOBS = 500;
+
+void runParallelBenchmarks() {
+    if (programLocationInPATH("true").empty()) {
+        printf("true not found in PATH, skipping\n");
+        return;
+    }
+
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < JOBS; i++) executeLine("true " + to_string(i));
+    double sequentialSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("%-20s %12.1f jobs/s\n", "line by line", JOBS / sequentialSeconds);
+    recordResult("parallel", "line_by_line", JOBS / sequentialSeconds, "jobs/s");
+
+    vector<int> concurrencies = {1, 2, 4};
+    if (availableCpus() > 4) concurrencies.push_back(availableCpus());
+    for (int maxJobs : concurrencies) {
+        ParallelOptions options = {maxJobs, false, false, false};
+        size_t next = 0;
+        ParallelSummary summary = runParallel("true", options, [&](string& line) {
+            if (next == JOBS) return false;
+            line = to_string(next++);
+            return true;
+        });
+        double throughput = summary.started / summary.seconds;
+        printf("%-20s %12.1f jobs/s\n", ("parallel -j " + to_string(maxJobs)).c_str(), throughput);
+        recordResult("parallel", "jobs=" + to_string(maxJobs), throughput, "jobs/s");
+    }
+}
@@ -0,0 +1,51 @@
+// Throughput and context switches of a three-stage coreutils pipeline over the channel settings:
+// the default 64 KiB pipe, fixed capacities, auto growth, socketpairs, and the metered relay behind
+// PIPE_STATS=1. SHELL_BENCH_PIPE_MB sets the volume, 1024 MiB by default.
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/resource.h>
+
+#include "bench.hpp"
+#include "shell.hpp"
+
+using namespace std;
+
+static long childContextSwitches() {
+    struct rusage usage;
+    getrusage(RUSAGE_CHILDREN, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+void runPipesBenchmarks() {
+    size_t megabytes = getenv("SHELL_BENCH_PIPE_MB") ? atol(getenv("SHELL_BENCH_PIPE_MB")) : 1024;
+    string pipeline = "head -c " + to_string(megabytes << 20) + " /dev/zero | tr a b | wc -c > /dev/null";
+
+    const vector<pair<string, string>> cases = {
+        {"default", ""},
+        {"256K", "PIPE_SIZE=256K "},
+        {"1M", "PIPE_SIZE=1M "},
+        {"auto", "PIPE_SIZE=auto "},
+        {"socketpair", "PIPE_TRANSPORT=socketpair "},
+        {"socketpair 1M", "PIPE_TRANSPORT=socketpair PIPE_SIZE=1M "},
+        {"metered", "PIPE_STATS=1 "},
+    };
+
+    // the stages are the coreutils programs, not the shell's own cat/head/wc
+    bool original = fastUtilities;
+    fastUtilities = false;
+    printf("%zu MiB through head | tr | wc\n%-16s %10s %18s\n", megabytes, "channels", "MB/s", "context switches");
+    for (auto& [name, prefix] : cases) {
+        fflush(stdout);
+        long switchesBefore = childContextSwitches();
+        auto start = chrono::steady_clock::now();
+        executeLine(prefix + pipeline);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        long switches = childContextSwitches() - switchesBefore;
+        printf("%-16s %10.0f %18ld\n", name.c_str(), megabytes / seconds, switches);
+        recordResult("pipes", "throughput/" + name, megabytes / seconds, "MB/s");
+        recordResult("pipes", "context_switches/" + name, switches, "count");
+    }
+    fastUtilities = original;
+}
@@ -0,0 +1,53 @@
+// What the command-plan cache saves: planLine for lines of growing length with the cache and with it turned
+// off (every line lexed, parsed and resolved again), and a whole line that spawns `true` both ways.
+#include <string>
+#include <vector>
+#include <cstdio>
+
+#include "bench.hpp"
+#include "shell.hpp"
+
+using namespace std;
+
+static const int PLANS = 20000;
+static const int RUNS = 200;
+
+void runPlanBenchmarks() {
+    string longArguments, quotedArguments;
+    for (int i = 0; i < 200; i++) {
+        longArguments += " --option=value" + to_string(i);
+        quotedArguments += " \"quoted argument " + to_string(i) + "\"";
+    }
+    typedef struct {
+        const char* name;
+        string line;
+    } Case;
+    vector<Case> cases = {
+        {"short", "true > /dev/null"},
+        {"long", "true" + longArguments + " 2>> /dev/null"},
+        {"quoted", "true" + quotedArguments},
+        {"builtin", "hash true"},
+        {"pipeline", "true a b | true c d | true e f"},
+    };
+
+    printf("%-10s %8s %16s %16s\n", "line", "bytes", "uncached (us)", "cached (us)");
+    for (const Case& c : cases) {
+        commandPlans.setCapacity(0);
+        double uncached = averageMicros(PLANS, [&]() { planLine(c.line); });
+        commandPlans.setCapacity(512);
+        double cached = averageMicros(PLANS, [&]() { planLine(c.line); });
+        printf("%-10s %8zu %16.2f %16.2f\n", c.name, c.line.size(), uncached, cached);
+        recordResult("plan", "uncached/" + string(c.name), uncached, "us");
+        recordResult("plan", "cached/" + string(c.name), cached, "us");
+    }
+
+    fflush(stdout); // executeLine below redirects stdout
+    string line = "true" + longArguments + " > /dev/null";
+    commandPlans.setCapacity(0);
+    double uncached = averageMicros(RUNS, [&]() { executeLine(line); });
+    commandPlans.setCapacity(512);
+    double cached = averageMicros(RUNS, [&]() { executeLine(line); });
+    printf("%-10s %8zu %16.1f %16.1f\n", "spawn", line.size(), uncached, cached);
+    recordResult("plan", "uncached/spawn_line", uncached, "us");
+    recordResult("plan", "cached/spawn_line", cached, "us");
+}
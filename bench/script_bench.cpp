@@ -0,0 +1,50 @@
+// Times the script interpreter on 100000 loop iterations, five nested `for` loops over ten digits running
+// test and echo (half of them) with the output going to /dev/null, the same with a function call in each
+// iteration, and bash running the first script for comparison.
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+
+#include "bench.hpp"
+#include "shell.hpp"
+
+using namespace std;
+
+static double millisSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// five nested loops around @body, 10^5 iterations of it
+static string nestedLoops(const string& body) {
+    string script, closing;
+    for (char variable : string("abcde")) {
+        script += string("for ") + variable + " in 0 1 2 3 4 5 6 7 8 9; do ";
+        closing += "done; ";
+    }
+    closing.resize(closing.size() - 2);
+    return script + body + "; " + closing + " > /dev/null";
+}
+
+void runScriptBenchmarks() {
+    string loop = nestedLoops("if test $e -lt 5; then echo $a$b$c$d$e; fi");
+    string calls = "emit() { if test $1 -lt 5; then echo $1; fi; }; " + nestedLoops("emit $e");
+
+    printf("%-12s %12s\n", "script", "time (ms)");
+    fflush(stdout); // the scripts redirect stdout
+    for (auto [name, script] : {pair{"loop", &loop}, pair{"functions", &calls}}) {
+        auto start = chrono::steady_clock::now();
+        executeLine(*script);
+        double millis = millisSince(start);
+        printf("%-12s %12.1f\n", name, millis);
+        recordResult("script", string(name) + "/100k", millis, "ms");
+    }
+
+    string command = "bash -c '" + loop + "'";
+    auto start = chrono::steady_clock::now();
+    if (system(command.c_str()) == 0) {
+        double millis = millisSince(start);
+        printf("%-12s %12.1f\n", "bash loop", millis);
+        recordResult("script", "bash/100k", millis, "ms");
+    }
+}
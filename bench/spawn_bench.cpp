@@ -0,0 +1,71 @@
+// Latency of running one external command and of pipelines of 2 to 16 stages, and how the latency of
+// posix_spawn, fork + exec and the fork server changes as the shell's resident size grows.
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+
+#include "bench.hpp"
+#include "shell.hpp"
+
+using namespace std;
+
+void runSpawnBenchmarks() {
+    string truePath = programLocationInPATH("true");
+    if (truePath.empty()) {
+        printf("true not found in PATH, skipping\n");
+        return;
+    }
+
+    double single = averageMicros(200, [&]() {
+        executeProgram(truePath, {}, true);
+    });
+    printf("%-28s %12.1f us\n", "run true", single);
+    recordResult("spawn", "single_command", single, "us");
+
+    // started while the benchmark is still small, as the shell does at startup
+    bool server = forkServer.start(jobs);
+    printf("\n%12s %14s %14s %14s\n", "rss (MiB)", "spawn (us)", "fork (us)", "server (us)");
+    for (size_t ballastMiB : {0, 64, 256, 1024}) {
+        // touched anonymous memory stands in for a shell with a large history and completion index
+        size_t bytes = ballastMiB << 20;
+        void* ballast = nullptr;
+        if (bytes > 0) {
+            ballast = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (ballast == MAP_FAILED) break;
+            memset(ballast, 1, bytes);
+        }
+
+        double latency[3] = {0, 0, 0};
+        for (LaunchMode mode : {LaunchMode::Spawn, LaunchMode::Fork, LaunchMode::Server}) {
+            if (mode == LaunchMode::Server && !server) continue;
+            ProcessLauncher launcher;
+            launcher.mode = mode;
+            latency[(int) mode] = averageMicros(100, [&]() {
+                waitForProcess(launchProgram(launcher, truePath, {}));
+            });
+        }
+        printf("%12zu %14.1f %14.1f %14.1f\n", ballastMiB, latency[(int) LaunchMode::Spawn], latency[(int) LaunchMode::Fork],
+               latency[(int) LaunchMode::Server]);
+        recordResult("spawn", "posix_spawn/rss_mib=" + to_string(ballastMiB), latency[(int) LaunchMode::Spawn], "us");
+        recordResult("spawn", "fork_exec/rss_mib=" + to_string(ballastMiB), latency[(int) LaunchMode::Fork], "us");
+        if (server) recordResult("spawn", "fork_server/rss_mib=" + to_string(ballastMiB), latency[(int) LaunchMode::Server], "us");
+
+        if (ballast != nullptr) munmap(ballast, bytes);
+    }
+    printf("\n");
+
+    for (int stages = 2; stages <= 16; stages *= 2) {
+        string line = "echo hello";
+        for (int s = 1; s < stages; s++) line += " | cat";
+        line += " > /dev/null";
+
+        vector<ParsedCommand> parsedCommands = parseInput(line);
+        double pipeline = averageMicros(50, [&]() {
+            executePipeline(line, parsedCommands);
+        });
+        printf("%-28s %12.1f us\n", ("pipeline of " + to_string(stages) + " stages").c_str(), pipeline);
+        recordResult("spawn", "pipeline/stages=" + to_string(stages), pipeline, "us");
+    }
+}
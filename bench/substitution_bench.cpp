@@ -0,0 +1,36 @@
+// Comparing the outputs of two commands: `cmp <(a) <(b)`, with both producers running next to cmp, against
+// writing each to a temporary file first and comparing the files, for outputs from 64 KiB to 64 MiB.
+#include <string>
+#include <cstdio>
+#include <filesystem>
+
+#include "bench.hpp"
+#include "shell.hpp"
+
+using namespace std;
+
+void runSubstitutionBenchmarks() {
+    string root = makeTempDir("substitution_bench");
+    if (root.empty()) return;
+    // the producers and cmp are the coreutils programs, not the shell's own head
+    bool original = fastUtilities;
+    fastUtilities = false;
+
+    printf("%-10s %20s %20s\n", "output", "<(a) <(b) (us)", "temp files (us)");
+    for (size_t kilobytes : {64, 4096, 64 * 1024}) {
+        string producer = "head -c " + to_string(kilobytes << 10) + " /dev/zero";
+        string substituted = "cmp <(" + producer + ") <(" + producer + ")";
+        string first = root + "/a", second = root + "/b";
+        string temporary = producer + " > " + first + "; " + producer + " > " + second + "; cmp " + first + " " + second;
+        int runs = kilobytes < 4096 ? 100 : kilobytes < 65536 ? 20 : 5;
+        double pipes = averageMicros(runs, [&]() { executeLine(substituted); });
+        double files = averageMicros(runs, [&]() { executeLine(temporary); });
+        string name = to_string(kilobytes) + "K";
+        printf("%-10s %20.1f %20.1f\n", name.c_str(), pipes, files);
+        recordResult("substitution", "process/" + name, pipes, "us");
+        recordResult("substitution", "temp_files/" + name, files, "us");
+    }
+
+    fastUtilities = original;
+    filesystem::remove_all(root);
+}
@@ -0,0 +1,56 @@
+// What the trace spans cost: a span in a tight loop with tracing off and on against the bare loop, and a
+// whole builtin line. Configure with -DSHELL_TRACING=OFF to compare against a build without spans.
+#include <string>
+#include <cstdio>
+
+#include "bench.hpp"
+#include "shell.hpp"
+
+using namespace std;
+
+static const int SPANS = 10000000;
+static const int LINES = 20000;
+
+static double nanosPerIteration(bool withSpan) {
+    volatile uint64_t sink = 0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < SPANS; i++) {
+        if (withSpan) {
+            TRACE_SPAN("bench");
+            sink = sink + 1;
+        }
+        else {
+            sink = sink + 1;
+        }
+    }
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / SPANS;
+}
+
+void runTraceBenchmarks() {
+#ifdef SHELL_TRACING
+    printf("spans compiled in\n");
+#else
+    printf("spans compiled out (SHELL_TRACING=OFF)\n");
+#endif
+    fflush(stdout); // executeLine below redirects stdout
+    bool wasTracing = Tracer::enabled();
+    Tracer::stop();
+
+    double bare = nanosPerIteration(false);
+    double off = nanosPerIteration(true);
+    double offLine = averageMicros(LINES, []() { executeLine("pwd > /dev/null"); });
+    Tracer::start();
+    double on = nanosPerIteration(true);
+    double onLine = averageMicros(LINES, []() { executeLine("pwd > /dev/null"); });
+    if (!wasTracing) Tracer::stop();
+
+    printf("%-22s %12s %14s\n", "", "ns/iteration", "pwd line (us)");
+    printf("%-22s %12.2f %14s\n", "no span", bare, "-");
+    printf("%-22s %12.2f %14.2f\n", "span, tracing off", off, offLine);
+    printf("%-22s %12.2f %14.2f\n", "span, tracing on", on, onLine);
+    recordResult("trace", "loop/no_span", bare, "ns");
+    recordResult("trace", "loop/tracing_off", off, "ns");
+    recordResult("trace", "loop/tracing_on", on, "ns");
+    recordResult("trace", "line/tracing_off", offLine, "us");
+    recordResult("trace", "line/tracing_on", onLine, "us");
+}
@@ -0,0 +1,81 @@
+// Compares the radix Trie with the original one-node-per-character trie: memory held after building,
+// build time, exact lookups and prefix enumeration at 10k and 100k keys.
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdio>
+#include <malloc.h>
+
+#include "bench.hpp"
+#include "LegacyTrie.cpp"
+#include "utils/Trie.cpp"
+
+using namespace std;
+
+// Executable-like names: a handful of shared stems with numeric and word suffixes.
+static vector<string> makeKeys(size_t count) {
+    const vector<string> stems = {"git", "python3", "x86_64-linux-gnu-", "kube", "docker-", "lib", "perl5.36-", "cargo-"};
+    mt19937 rng(42);
+    vector<string> keys;
+    keys.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        string key = stems[rng() % stems.size()];
+        size_t extra = 3 + rng() % 10;
+        for (size_t j = 0; j < extra; j++) key += (char) ('a' + rng() % 26);
+        key += to_string(i);
+        keys.push_back(key);
+    }
+    return keys;
+}
+
+static size_t heapInUse() {
+    return mallinfo2().uordblks;
+}
+
+template <typename T>
+static void measure(const char* name, const vector<string>& keys) {
+    size_t heapBefore = heapInUse();
+    auto start = chrono::steady_clock::now();
+    T* trie = new T();
+    trie->add(keys);
+    auto built = chrono::steady_clock::now();
+    size_t heapAfter = heapInUse();
+
+    size_t found = 0;
+    for (const string& key : keys) found += trie->find(key);
+    auto looked = chrono::steady_clock::now();
+
+    size_t matches = 0;
+    const vector<string> prefixes = {"git", "kube", "x86_64-linux-gnu-a", "cargo-zz", "nomatch"};
+    for (int r = 0; r < 20; r++) {
+        for (const string& prefix : prefixes) matches += trie->getAllByPrefix(prefix).size();
+    }
+    auto enumerated = chrono::steady_clock::now();
+
+    auto micros = [](auto a, auto b) { return chrono::duration<double, micro>(b - a).count(); };
+    double heapKiB = (heapAfter - heapBefore) / 1024.0;
+    double buildMs = micros(start, built) / 1000.0;
+    double findNs = micros(built, looked) * 1000.0 / keys.size();
+    double prefixUs = micros(looked, enumerated) / 100.0;
+    printf("%-8s %8zu %12.1f %12.1f %14.3f %14.1f\n", name, keys.size(), heapKiB, buildMs, findNs, prefixUs);
+
+    string prefix = string(name) + "/keys=" + to_string(keys.size());
+    recordResult("trie", prefix + "/heap", heapKiB, "KiB");
+    recordResult("trie", prefix + "/build", buildMs, "ms");
+    recordResult("trie", prefix + "/find", findNs, "ns/key");
+    recordResult("trie", prefix + "/prefix_query", prefixUs, "us");
+    if (found != keys.size() || matches == 0) printf("  (unexpected result: %zu found, %zu matches)\n", found, matches);
+
+    delete trie;
+}
+
+void runTrieBenchmarks() {
+    printf("%-8s %8s %12s %12s %14s %14s\n", "trie", "keys", "heap (KiB)", "build (ms)", "find (ns/key)", "prefix (us)");
+    for (size_t count : {10000, 100000}) {
+        vector<string> keys = makeKeys(count);
+        measure<LegacyTrie>("legacy", keys);
+        measure<Trie>("radix", keys);
+    }
+}
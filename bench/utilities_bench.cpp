@@ -0,0 +1,77 @@
+// cat/head/tee/wc run in-process (splice, sendfile, copy_file_range, vectorized newline counting) against
+// the coreutils programs, on a large file piped through 2 to 4 stages. SHELL_BENCH_FILE_MB sets the file
+// size, 2048 MiB by default.
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <filesystem>
+
+#include "bench.hpp"
+#include "shell.hpp"
+
+using namespace std;
+
+static bool writeTestFile(const string& path, size_t megabytes) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    // log-like lines of varying length
+    string block;
+    for (int i = 0; block.size() < (1 << 20); i++) {
+        block += "2024-01-01T00:00:" + to_string(i % 60) + " worker-" + to_string(i % 17) + " request " + to_string(i) +
+                 string(i % 40, 'x') + "\n";
+    }
+    block.resize(1 << 20);
+    bool ok = true;
+    for (size_t i = 0; i < megabytes && ok; i++) ok = DataMover::writeAll(fd, block.data(), block.size());
+    close(fd);
+    return ok;
+}
+
+static double secondsFor(const string& line) {
+    // the table so far must not end up in a redirection target
+    fflush(stdout);
+    auto start = chrono::steady_clock::now();
+    executeLine(line);
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+void runUtilitiesBenchmarks() {
+    size_t megabytes = getenv("SHELL_BENCH_FILE_MB") ? atol(getenv("SHELL_BENCH_FILE_MB")) : 2048;
+    string root = makeTempDir("utilities_bench");
+    if (root.empty()) return;
+    string file = root + "/big.log";
+    string copy = root + "/copy.log";
+    if (!writeTestFile(file, megabytes)) {
+        printf("could not write %zu MiB to %s, skipping\n", megabytes, file.c_str());
+        filesystem::remove_all(root);
+        return;
+    }
+
+    const vector<pair<string, string>> cases = {
+        {"cat > file", "cat " + file + " > " + copy},
+        {"wc -l", "wc -l " + file + " > /dev/null"},
+        {"cat | wc -l", "cat " + file + " | wc -l > /dev/null"},
+        {"cat | cat | wc -l", "cat " + file + " | cat | wc -l > /dev/null"},
+        {"cat | cat | cat | wc -l", "cat " + file + " | cat | cat | wc -l > /dev/null"},
+        {"cat | tee file | wc -c", "cat " + file + " | tee " + copy + " | wc -c > /dev/null"},
+        {"head -c half | wc -c", "head -c " + to_string((megabytes << 20) / 2) + " " + file + " | wc -c > /dev/null"},
+    };
+
+    printf("%zu MiB file\n%-26s %14s %14s %9s\n", megabytes, "pipeline", "builtin MB/s", "coreutils MB/s", "speedup");
+    bool original = fastUtilities;
+    for (auto& [name, line] : cases) {
+        fastUtilities = true;
+        double builtin = secondsFor(line);
+        fastUtilities = false;
+        double coreutils = secondsFor(line);
+        double builtinRate = megabytes / builtin, coreutilsRate = megabytes / coreutils;
+        printf("%-26s %14.0f %14.0f %8.2fx\n", name.c_str(), builtinRate, coreutilsRate, coreutils / builtin);
+        recordResult("utilities", "builtin/" + name, builtinRate, "MB/s");
+        recordResult("utilities", "coreutils/" + name, coreutilsRate, "MB/s");
+    }
+    fastUtilities = original;
+    filesystem::remove_all(root);
+}
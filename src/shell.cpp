@@ -0,0 +1,4080 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <sstream>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <filesystem>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unordered_set>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <charconv>
+#include <climits>
+
+#include "shell.hpp"
+
+
+using namespace std;
+
+vector<string> permissibleCommands = {"exit", "echo", "type", "pwd", "cd", "history", "hash", "jobs", "fg", "bg", "wait", "kill", "parallel", "pipeconf", "timing", "trace", "cache", "glob", "test", "[", ":", "break", "continue", "return"};
+vector<string> commandSuggestions = {"exit", "echo"};
+
+string PATH = getenv("PATH");
+
+// remembers program locations across commands, see `hash`
+CommandHashTable commandHashTable;
+
+// computes Tab completions in the background; its index of PATH is re-listed per directory only when it changes
+CompletionWorker completionWorker;
+
+// how long Tab waits for the completion worker before ringing the bell and letting the user type on
+static const chrono::milliseconds COMPLETION_WAIT(30);
+
+// the controlling terminal while a line is being edited
+TerminalSession terminal;
+
+// pipelines started by the shell, see `jobs`
+JobTable jobs;
+
+// starts programs from a small process of its own with SHELL_LAUNCHER=server
+ForkServer forkServer;
+
+// set for interactive shells on a terminal: every pipeline gets a process group, and the foreground one the terminal
+bool jobControl = false;
+pid_t shellProcessGroup = 0;
+int lastExitStatus = 0;
+volatile sig_atomic_t interruptRequested = 0;
+
+// what recent lines were compiled to, see planLine
+CommandPlanCache<CommandPlan> commandPlans;
+uint64_t planGeneration = 0;
+
+vector<string> splitString(const string& s, char delimiter) {
+    vector<string> tokens;
+    string token;
+    istringstream tokenStream(s);
+    while (getline(tokenStream, token, delimiter)) {
+        tokens.push_back(token);
+    }
+    return tokens;
+}
+
+// reused for every line so that its token and scratch buffers are allocated only once
+Lexer commandLexer;
+
+// bytes of argv a program can be given: ARG_MAX less what the environment takes
+static size_t argumentBudget() {
+    long limit = sysconf(_SC_ARG_MAX);
+    size_t budget = limit > 0 ? limit : 128 << 10;
+    for (char** variable = environ; *variable != nullptr; variable++) {
+        size_t used = strlen(*variable) + 1 + sizeof(char*);
+        budget = budget > used ? budget - used : 0;
+    }
+    return budget;
+}
+
+// Replaces the glob @pattern by the paths it matches, sorted, or keeps @text, the word as written, if nothing
+// matches. A pattern whose matches couldn't be passed to a program is reported rather than expanded part way.
+bool expandGlob(string_view pattern, string_view text, vector<string>& arguments) {
+    TRACE_SPAN("expandGlob");
+    size_t budget = argumentBudget();
+    for (const string& argument : arguments) {
+        size_t used = argument.size() + 1 + sizeof(char*);
+        budget = budget > used ? budget - used : 0;
+    }
+    vector<string> matches;
+    if (!Glob::expandSorted(string(pattern), matches, budget)) {
+        cerr << "shell: " << text << ": argument list too long" << endl;
+        return false;
+    }
+    if (matches.empty()) arguments.emplace_back(text);
+    for (string& match : matches) arguments.push_back(std::move(match));
+    return true;
+}
+
+unordered_map<string, string> shellVariables;
+vector<vector<string>> positionalParameters;
+unordered_map<string, shared_ptr<const ScriptNode>> shellFunctions;
+
+static bool isVariableName(string_view name) {
+    if (name.empty() || !(isalpha((unsigned char)name[0]) || name[0] == '_')) return false;
+    return all_of(name.begin(), name.end(), [](char c) { return isalnum((unsigned char)c) || c == '_'; });
+}
+
+void assignVariable(const string& name, const string& value) {
+    auto it = shellVariables.find(name);
+    if (it != shellVariables.end()) {
+        it->second = value;
+        return;
+    }
+    // exported variables stay exported, so that programs see the new value
+    if (getenv(name.c_str()) != nullptr) {
+        setenv(name.c_str(), value.c_str(), 1);
+        if (name == "PATH") PATH = value;
+        return;
+    }
+    shellVariables[name] = value;
+}
+
+string variableValue(string_view name) {
+    static const vector<string> noParameters;
+    const vector<string>& parameters = positionalParameters.empty() ? noParameters : positionalParameters.back();
+    if (name == "?") return to_string(lastExitStatus);
+    if (name == "#") return to_string(parameters.size());
+    if (name == "0") return "shell";
+    if (name.size() == 1 && isdigit((unsigned char)name[0])) {
+        size_t index = name[0] - '1';
+        return index < parameters.size() ? parameters[index] : string();
+    }
+    if (name == "@" || name == "*") {
+        string joined;
+        for (size_t i = 0; i < parameters.size(); i++) joined += (i ? " " : "") + parameters[i];
+        return joined;
+    }
+    if (!shellVariables.empty()) {
+        auto it = shellVariables.find(string(name));
+        if (it != shellVariables.end()) return it->second;
+    }
+    const char* value = getenv(string(name).c_str());
+    return value != nullptr ? value : "";
+}
+
+// Puts a word with expansions together from its parts (WordPart or ScriptWordPart) and appends the fields it
+// makes to @fields. Unquoted values are split at blanks, "$@" gives a field per positional parameter, and an
+// assignment (name=...) is never split. For a glob word the matching pattern of each field, with the values
+// escaped, goes to @patterns.
+template <typename Part>
+static void expandParts(const Part* parts, size_t count, bool glob, vector<string>& fields, vector<string>& patterns) {
+    bool assignment = parts[0].kind == WordPartKind::Literal && parts[0].text.find('=') != string::npos &&
+                      isVariableName(parts[0].text.substr(0, parts[0].text.find('=')));
+    // a field in progress; "" quoted or a literal still make a field, an unquoted empty value doesn't
+    string field, pattern;
+    bool started = false;
+    auto endField = [&]() {
+        if (!started) return;
+        fields.push_back(std::move(field));
+        if (glob) patterns.push_back(std::move(pattern));
+        field.clear();
+        pattern.clear();
+        started = false;
+    };
+    auto append = [&](string_view text, string_view textPattern) {
+        field += text;
+        if (glob) pattern += textPattern;
+        started = true;
+    };
+    for (size_t i = 0; i < count; i++) {
+        const Part& part = parts[i];
+        if (part.kind == WordPartKind::Literal) {
+            append(part.text, part.pattern);
+            continue;
+        }
+        if (part.quoted && part.text == "@") {
+            const vector<string>* parameters = positionalParameters.empty() ? nullptr : &positionalParameters.back();
+            if (parameters == nullptr || parameters->empty()) continue;
+            for (size_t p = 0; p < parameters->size(); p++) {
+                if (p > 0) endField();
+                append((*parameters)[p], glob ? Glob::escape((*parameters)[p]) : string());
+            }
+            continue;
+        }
+        string value = variableValue(part.text);
+        if (part.quoted || assignment) {
+            append(value, glob ? Glob::escape(value) : string());
+            continue;
+        }
+        size_t at = 0;
+        while (at < value.size()) {
+            size_t blank = value.find_first_of(" \t\n", at);
+            if (blank == at) {
+                endField();
+                at++;
+                continue;
+            }
+            string_view piece = string_view(value).substr(at, blank == string::npos ? string::npos : blank - at);
+            append(piece, glob ? Glob::escape(string(piece)) : string());
+            at += piece.size();
+        }
+    }
+    endField();
+}
+
+// Appends the arguments the word (a Token or a ScriptWord) stands for: its expansions and path matches.
+// False after reporting a pattern with too many matches.
+template <typename Word, typename Part>
+static bool expandWord(const Word& word, const Part* parts, size_t count, vector<string>& arguments) {
+    if (count == 0) {
+        if (!word.glob) {
+            arguments.emplace_back(word.text);
+            return true;
+        }
+        return expandGlob(word.pattern, word.text, arguments);
+    }
+    vector<string> fields, patterns;
+    expandParts(parts, count, word.glob, fields, patterns);
+    for (size_t i = 0; i < fields.size(); i++) {
+        if (!word.glob) arguments.push_back(std::move(fields[i]));
+        else if (!expandGlob(patterns[i], fields[i], arguments)) return false;
+    }
+    return true;
+}
+
+// Appends the arguments a word of a command (a Token or a ScriptWord) stands for to the @arguments before it.
+// `glob` gets its patterns as they are, with quoted text and values escaped, and streams the matches itself.
+template <typename Word, typename Part>
+static bool expandCommandWord(const Word& word, const Part* parts, size_t count, vector<string>& arguments) {
+    if (arguments.empty() || arguments[0] != "glob") return expandWord(word, parts, count, arguments);
+    if (count == 0) {
+        arguments.push_back(word.glob ? string(word.pattern) : Glob::escape(word.text));
+        return true;
+    }
+    vector<string> fields, patterns;
+    expandParts(parts, count, word.glob, fields, patterns);
+    for (size_t i = 0; i < fields.size(); i++) {
+        arguments.push_back(word.glob ? std::move(patterns[i]) : Glob::escape(fields[i]));
+    }
+    return true;
+}
+
+// The text of a here-string's word (a Token or a ScriptWord): its expansions put in whole, like inside double
+// quotes, without field splitting or path expansion.
+template <typename Word, typename Part>
+static string hereStringText(const Word& word, const Part* parts, size_t count) {
+    if (count == 0) return string(word.text);
+    string text;
+    for (size_t i = 0; i < count; i++) {
+        if (parts[i].kind == WordPartKind::Literal) text += parts[i].text;
+        else text += variableValue(parts[i].text);
+    }
+    return text;
+}
+
+// splits the line into commands connected via pipe. On a syntax error, reports it and returns no commands.
+vector<ParsedCommand> parseInput(const string& s) {
+    bool runInBackground;
+    return parseInput(s, runInBackground);
+}
+
+// The lines of the here-document of @redirect as a word: tabs stripped for <<-, and split into literal text and
+// variables like a double-quoted word unless its delimiter was quoted.
+static ScriptWord hereDocumentWord(const Token& redirect) {
+    string text;
+    if (redirect.text != "<<-") text = redirect.hereDocument;
+    for (size_t start = 0; redirect.text == "<<-" && start < redirect.hereDocument.size();) {
+        size_t end = redirect.hereDocument.find('\n', start);
+        end = end == string_view::npos ? redirect.hereDocument.size() : end + 1;
+        string_view line = redirect.hereDocument.substr(start, end - start);
+        line.remove_prefix(min(line.find_first_not_of('\t'), line.size()));
+        text += line;
+        start = end;
+    }
+    ScriptWord word = {"", false, "", {}};
+    if (!redirect.hereDocumentExpands) {
+        word.text = std::move(text);
+        return word;
+    }
+
+    string literal;
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        // a backslash only escapes $, ` and itself, and joins lines
+        if (c == '\\' && i + 1 < text.size() && (text[i + 1] == '$' || text[i + 1] == '`' || text[i + 1] == '\\')) {
+            literal += text[++i];
+            continue;
+        }
+        if (c == '\\' && i + 1 < text.size() && text[i + 1] == '\n') {
+            i++;
+            continue;
+        }
+        string_view name;
+        size_t length = c == '$' ? Lexer::expansionLength(text, i, name) : 0;
+        if (length == 0 || length == string_view::npos) {
+            literal += c;
+            continue;
+        }
+        if (!literal.empty()) word.parts.push_back({WordPartKind::Literal, std::move(literal), false, ""});
+        word.parts.push_back({WordPartKind::Variable, string(name), true, ""});
+        literal.clear();
+        i += length - 1;
+    }
+    if (word.parts.empty()) word.text = literal;
+    else if (!literal.empty()) word.parts.push_back({WordPartKind::Literal, std::move(literal), false, ""});
+    return word;
+}
+
+static bool isRedirection(TokenKind kind) {
+    return kind == TokenKind::RedirectStdout || kind == TokenKind::AppendStdout || kind == TokenKind::RedirectStderr ||
+           kind == TokenKind::AppendStderr || kind == TokenKind::RedirectStdin || kind == TokenKind::HereDocument ||
+           kind == TokenKind::HereString;
+}
+
+// Points the stream the redirection @kind is for at @fields, what its word (@written) expanded to: a file
+// name, or the text of a here-document or here-string. False after reporting a file name that isn't one word.
+static bool setRedirection(ParsedCommand& command, TokenKind kind, vector<string>& fields, string_view written) {
+    if (kind == TokenKind::HereDocument || kind == TokenKind::HereString) {
+        // here-documents can be large, so the text is moved along rather than copied
+        string text = fields.size() == 1 ? std::move(fields[0]) : string();
+        for (size_t i = 0; fields.size() > 1 && i < fields.size(); i++) text += (i ? " " : "") + fields[i];
+        if (kind == TokenKind::HereString) text += '\n';
+        command.standardInputFile = {"", "text"};
+        command.inputText = std::move(text);
+        return true;
+    }
+    if (fields.size() != 1) {
+        cerr << "shell: " << written << ": ambiguous redirect" << endl;
+        return false;
+    }
+    if (kind == TokenKind::RedirectStdin) {
+        command.standardInputFile = {std::move(fields[0]), "r"};
+        command.inputText.clear();
+        return true;
+    }
+    bool toStdout = kind == TokenKind::RedirectStdout || kind == TokenKind::AppendStdout;
+    bool append = kind == TokenKind::AppendStdout || kind == TokenKind::AppendStderr;
+    StreamRedirectionMetadata& file = toStdout ? command.standardOutputFile : command.standardErrorFile;
+    file = {std::move(fields[0]), append ? "a" : "w"};
+    return true;
+}
+
+// parseInput on a line the lexer already split, without lists or compound commands
+static vector<ParsedCommand> parseTokens(const vector<Token>& tokens, const vector<WordPart>& parts, bool& runInBackground) {
+    vector<ParsedCommand> parsedCommands;
+    runInBackground = false;
+    ParsedCommand parsedCommand;
+
+    for (size_t i = 0; i < tokens.size(); i++) {
+        const Token& token = tokens[i];
+
+        if (token.kind == TokenKind::Word) {
+            if (!expandCommandWord(token, parts.data() + token.firstPart, token.partCount, parsedCommand.tokens)) {
+                return {};
+            }
+            continue;
+        }
+
+        if (token.kind == TokenKind::Background) {
+            // only a whole pipeline can be sent to the background, so `&` has to end the line
+            if (parsedCommand.tokens.empty() || i + 1 < tokens.size()) {
+                string unexpected = parsedCommand.tokens.empty() ? "&" : string(tokens[i + 1].text);
+                cerr << "shell: syntax error near unexpected token `" << unexpected << "'" << endl;
+                return {};
+            }
+            runInBackground = true;
+            continue;
+        }
+
+        if (token.kind == TokenKind::Pipe) {
+            if (parsedCommand.tokens.empty()) {
+                cerr << "shell: syntax error near unexpected token `|'" << endl;
+                return {};
+            }
+            parsedCommands.push_back(std::move(parsedCommand));
+            parsedCommand = ParsedCommand();
+            continue;
+        }
+
+        // lists and compound commands are the interpreter's, see planLine
+        if (!isRedirection(token.kind)) {
+            cerr << "shell: syntax error near unexpected token `" << token.text << "'" << endl;
+            return {};
+        }
+
+        // redirection operators take the next word as the file name
+        if (i + 1 == tokens.size() || tokens[i + 1].kind != TokenKind::Word) {
+            string unexpected = i + 1 == tokens.size() ? "newline" : string(tokens[i + 1].text);
+            cerr << "shell: syntax error near unexpected token `" << unexpected << "'" << endl;
+            return {};
+        }
+        const Token& target = tokens[++i];
+        vector<string> fields;
+        if (token.kind == TokenKind::HereDocument) {
+            ScriptWord document = hereDocumentWord(token);
+            if (document.parts.empty()) fields.push_back(std::move(document.text));
+            else expandWord(document, document.parts.data(), document.parts.size(), fields);
+        }
+        else if (token.kind == TokenKind::HereString) {
+            fields.push_back(hereStringText(target, parts.data() + target.firstPart, target.partCount));
+        }
+        else if (target.partCount == 0) {
+            fields.emplace_back(target.text);
+        }
+        else if (!expandWord(target, parts.data() + target.firstPart, target.partCount, fields)) {
+            return {};
+        }
+        if (!setRedirection(parsedCommand, token.kind, fields, target.text)) return {};
+    }
+
+    if (!parsedCommand.tokens.empty()) {
+        parsedCommands.push_back(std::move(parsedCommand));
+    }
+    else if (!parsedCommands.empty()) {
+        cerr << "shell: syntax error: unexpected end of input after `|'" << endl;
+        return {};
+    }
+
+    return parsedCommands;
+}
+
+// same, and sets @runInBackground if the line ends with `&`
+vector<ParsedCommand> parseInput(const string& s, bool& runInBackground) {
+    TRACE_SPAN("parseInput");
+    runInBackground = false;
+    if (!commandLexer.tokenize(s)) {
+        cerr << "shell: " << commandLexer.error() << endl;
+        return {};
+    }
+    return parseTokens(commandLexer.tokens(), commandLexer.parts(), runInBackground);
+}
+
+
+bool isBuiltinCommand(const string& command) {
+    return find(permissibleCommands.begin(), permissibleCommands.end(), command) != permissibleCommands.end();
+}
+
+// builtins that neither read stdin nor change the shell's state; in a pipeline they run in the shell process
+// instead of a forked child, since the child's output would be all that is observable. the same goes for
+// cat/head/wc when they only read files.
+bool runsInProcessInPipeline(const vector<string>& tokens) {
+    const string& command = tokens.front();
+    if (findFunction(command) != nullptr) return false;
+    if (command == "echo" || command == "type" || command == "pwd" || command == "history") return true;
+    FastUtilityCall call;
+    return parseFastUtility(tokens, call) && !fastUtilityReadsStdin(call);
+}
+
+void executeEcho(const vector<string>& arguments) {
+    for (int i=0; i< arguments.size(); i++) {
+        cout << arguments[i];
+        if (i != arguments.size()-1) {
+            cout << " ";
+        }
+    }
+    cout << endl;
+}
+
+vector<string> directoriesInPath() {
+    return splitString(PATH, ':');
+}
+
+// returns the absolute path of the program if found, else "";
+// lookups go through the command hash table, which only re-probes PATH directories whose mtime changed.
+string programLocationInPATH(const string& program, bool countHit) {
+    TRACE_SPAN("programLocationInPATH");
+    return commandHashTable.lookup(PATH, program, countHit);
+}
+
+void executeType(const vector<string>& arguments) {
+    for (auto &arg: arguments) {
+        if (findFunction(arg) != nullptr) {
+            cout << arg << " is a function" << endl;
+        }
+        else if ( find(permissibleCommands.begin(), permissibleCommands.end(), arg) != permissibleCommands.end() ) {
+            cout << arg << " is a shell builtin" << endl;
+        }
+        else {
+            string cmdLocation = programLocationInPATH(arg, false);
+
+            if (!cmdLocation.empty()) {
+                cout << arg << " is " << cmdLocation << endl;
+            }
+            else {
+                cout << arg << ": not found" << endl;
+                lastExitStatus = 1;
+            }
+        }
+    }
+}
+
+void executeHash(const vector<string>& arguments) {
+    size_t i = 0;
+    if (i < arguments.size() && arguments[i] == "-r") {
+        commandHashTable.clear();
+        i++;
+    }
+    else if (i < arguments.size() && arguments[i] == "-p") {
+        if (arguments.size() < 3) {
+            cout << "hash: -p: option requires an argument" << endl;
+            lastExitStatus = 2;
+            return;
+        }
+        for (size_t j = 2; j < arguments.size(); j++) {
+            commandHashTable.pin(arguments[j], arguments[1]);
+        }
+        return;
+    }
+
+    if (i == arguments.size()) {
+        if (i > 0) return; // plain `hash -r`
+
+        vector<CommandHashTable::Listing> entries = commandHashTable.list();
+        if (entries.empty()) {
+            cout << "hash: hash table empty" << endl;
+            return;
+        }
+        cout << "hits\tcommand" << endl;
+        for (auto &entry: entries) {
+            string hits = to_string(entry.hits);
+            cout << string(hits.size() < 4 ? 4 - hits.size() : 0, ' ') << hits << "\t" << entry.location << endl;
+        }
+        return;
+    }
+
+    for (; i < arguments.size(); i++) {
+        const string &name = arguments[i];
+        if (find(permissibleCommands.begin(), permissibleCommands.end(), name) != permissibleCommands.end()) {
+            continue;
+        }
+        if (programLocationInPATH(name, false).empty()) {
+            cout << "hash: " << name << ": not found" << endl;
+            lastExitStatus = 1;
+        }
+    }
+}
+
+// a <(command) or >(command) that is running: the shell's end of the pipe to it, which the command line names as
+// /dev/fd/N, and the forked shell running the command
+typedef struct {
+    int fd;
+    pid_t pid;
+} ProcessSubstitution;
+
+// innermost last; every program started meanwhile gets the pipe ends under their numbers
+static vector<ProcessSubstitution> processSubstitutions;
+
+void executeProgramWithoutFork(const std::string& programLocation, const std::vector<std::string>& arguments, bool doFork) {
+    std::filesystem::path pathObj(programLocation);
+    std::string programName = pathObj.filename().string();
+
+    // Child process
+    std::vector<char*> args;
+    args.push_back(const_cast<char*>(programName.c_str()));
+    for (const auto& arg : arguments) {
+        args.push_back(const_cast<char*>(arg.c_str()));
+    }
+    args.push_back(nullptr);
+
+    for (const ProcessSubstitution& substitution : processSubstitutions) fcntl(substitution.fd, F_SETFD, 0);
+    execv(programLocation.c_str(), args.data());
+    perror("execv failed");
+    _exit(1); // Exit child if execv fails
+}
+
+// adds the command's stdout/stderr redirections to the file actions of the launcher
+void addRedirections(ProcessLauncher& launcher, const ParsedCommand& parsedCommand) {
+    const StreamRedirectionMetadata& out = parsedCommand.standardOutputFile;
+    if (!out.fileName.empty()) {
+        launcher.open(STDOUT_FILENO, out.fileName, O_WRONLY | O_CREAT | (out.mode == "a" ? O_APPEND : O_TRUNC), 0644);
+    }
+    const StreamRedirectionMetadata& err = parsedCommand.standardErrorFile;
+    if (!err.fileName.empty()) {
+        launcher.open(STDERR_FILENO, err.fileName, O_WRONLY | O_CREAT | (err.mode == "a" ? O_APPEND : O_TRUNC), 0644);
+    }
+}
+
+// An anonymous file holding @text, read from its start. Sealed once written, so the reader gets exactly the
+// text without a temporary file or a writer on the other end of a pipe.
+static int sealedMemfd(string_view text) {
+    int fd = memfd_create("here-document", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) return -1;
+    for (size_t written = 0; written < text.size();) {
+        ssize_t n = write(fd, text.data() + written, text.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            int error = errno;
+            close(fd);
+            errno = error;
+            return -1;
+        }
+        written += n;
+    }
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+bool openStandardInput(const ParsedCommand& parsedCommand, int& fd) {
+    const StreamRedirectionMetadata& in = parsedCommand.standardInputFile;
+    fd = -1;
+    if (in.mode.empty()) return true;
+    fd = in.mode == "r" ? open(in.fileName.c_str(), O_RDONLY | O_CLOEXEC) : sealedMemfd(parsedCommand.inputText);
+    if (fd < 0) {
+        cerr << "shell: " << (in.mode == "r" ? in.fileName : "here-document") << ": " << strerror(errno) << endl;
+        return false;
+    }
+    return true;
+}
+
+// Starts @command for <(command), whose output the path it sets @path to reads, or for >(command) (@output
+// false), whose input the path writes to. The command runs in a forked copy of the shell at the other end of a
+// pipe; the shell keeps its end open under the /dev/fd/N name until finishProcessSubstitutions. False after
+// reporting why the command could not be started.
+static bool startProcessSubstitution(bool output, const string& command, string& path) {
+    // /dev/fd/N can't open a socket, so the channel is a pipe whatever the pipeline transport
+    PipeSettings settings = pipeSettings;
+    settings.transport = PipeTransport::Pipe;
+    int ends[2];
+    if (!PipeMonitor::openChannel(ends, settings)) {
+        cerr << "shell: pipe: " << strerror(errno) << endl;
+        return false;
+    }
+    int shellEnd = output ? ends[0] : ends[1];
+    int commandEnd = output ? ends[1] : ends[0];
+    cout.flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("shell: fork");
+        close(ends[0]);
+        close(ends[1]);
+        return false;
+    }
+    if (pid == 0) {
+        jobControl = false;
+        struct sigaction defaultAction = {};
+        defaultAction.sa_handler = SIG_DFL;
+        sigaction(SIGINT, &defaultAction, nullptr);
+        // the ends of other substitutions would keep their commands from seeing EOF
+        close(shellEnd);
+        for (const ProcessSubstitution& substitution : processSubstitutions) close(substitution.fd);
+        processSubstitutions.clear();
+        dup2(commandEnd, output ? STDOUT_FILENO : STDIN_FILENO);
+        close(commandEnd);
+        executeLine(command);
+        cout.flush();
+        exit(lastExitStatus);
+    }
+    close(commandEnd);
+    processSubstitutions.push_back({shellEnd, pid});
+    path = "/dev/fd/" + to_string(shellEnd);
+    return true;
+}
+
+// Closes the shell's ends of the process substitutions started since there were @from of them, so that their
+// commands get EOF or EPIPE, and reaps them unless the command line went to the background (the SIGCHLD handler
+// collects those, and drops their statuses). An interrupted line doesn't wait for them to finish on their own.
+static void finishProcessSubstitutions(size_t from, bool wait) {
+    for (size_t i = from; i < processSubstitutions.size(); i++) close(processSubstitutions[i].fd);
+    bool interrupted = interruptRequested || lastExitStatus == 128 + SIGINT;
+    for (size_t i = from; i < processSubstitutions.size(); i++) {
+        if (!wait) {
+            jobs.abandon(processSubstitutions[i].pid);
+            continue;
+        }
+        if (interrupted) kill(processSubstitutions[i].pid, SIGTERM);
+        waitForProcess(processSubstitutions[i].pid);
+    }
+    processSubstitutions.resize(from);
+}
+
+// starts the program with a complete @argv, given both as strings and as the array for exec
+static pid_t startProgram(const ProcessLauncher& launcher, const string& programLocation, const vector<string>& argv,
+                          char* const* argvPointers) {
+    TRACE_SPAN("spawn");
+    cout.flush(); // the child's output must come after everything the shell printed so far
+    // /dev/fd/N in the arguments has to name the same pipe in the program
+    ProcessLauncher withSubstitutions;
+    const ProcessLauncher* used = &launcher;
+    if (!processSubstitutions.empty()) {
+        withSubstitutions = launcher;
+        for (const ProcessSubstitution& substitution : processSubstitutions) {
+            withSubstitutions.dup(substitution.fd, substitution.fd);
+        }
+        used = &withSubstitutions;
+    }
+    int err = 0;
+    pid_t pid = -1;
+    if (used->mode != LaunchMode::Server || !forkServer.launch(*used, programLocation, argv, pid, err)) {
+        pid = used->launch(programLocation, argvPointers, err);
+    }
+    // posix_spawn gives the same errors for a redirection the child can't open as for the exec
+    if (pid < 0) {
+        string path = used->failedOpen(err);
+        if (!path.empty()) {
+            cerr << "shell: " << path << ": " << strerror(err) << endl;
+            lastExitStatus = 1;
+        }
+        else {
+            cerr << argv[0] << ": " << strerror(err) << endl;
+            lastExitStatus = err == ENOENT ? 127 : 126;
+        }
+    }
+    return pid;
+}
+
+// starts the program with argv[0] set to its file name. returns its pid, or -1 after reporting why it could not run.
+pid_t launchProgram(const ProcessLauncher& launcher, const string& programLocation, const vector<string>& arguments) {
+    vector<string> argv;
+    argv.reserve(arguments.size() + 1);
+    argv.push_back(filesystem::path(programLocation).filename().string());
+    argv.insert(argv.end(), arguments.begin(), arguments.end());
+    vector<char*> argvPointers;
+    for (const string& arg : argv) argvPointers.push_back(const_cast<char*>(arg.c_str()));
+    argvPointers.push_back(nullptr);
+    return startProgram(launcher, programLocation, argv, argvPointers.data());
+}
+
+// waits for a program started for a foreground line as its job, and adds it to the line's timing
+static void waitInForeground(const string& input, const vector<string>& tokens, pid_t pid) {
+    if (pid <= 0) return;
+    Job finished;
+    waitForJob(jobs.add(jobControl ? pid : 0, {pid}, input, false), &finished);
+    if (currentTiming != nullptr) currentTiming->stages.push_back(jobStageTiming(commandText(tokens), finished, 0));
+}
+
+// waits for a child that was started outside of any job
+void waitForProcess(pid_t pid) {
+    if (pid < 0) return;
+    jobs.waitForPid(pid);
+}
+
+void executeProgram(const std::string& programLocation, const std::vector<std::string>& arguments, bool doFork) {
+    if (doFork) {
+        ProcessLauncher launcher;
+        waitForProcess(launchProgram(launcher, programLocation, arguments));
+    }
+    else {
+        executeProgramWithoutFork(programLocation, arguments);
+    }
+}
+
+
+void executePwd() {
+    char cwd[1024];
+    if (getcwd(cwd, sizeof(cwd)) != nullptr) {
+        std::cout << cwd << std::endl;
+    } else {
+        perror("getcwd failed");
+        lastExitStatus = 1;
+    }
+}
+
+void executeCd(const std::vector<std::string>& arguments) {
+    string goToPath = "";
+    if (arguments.empty() || arguments[0].empty()) {
+        goToPath = getenv("HOME");
+        // no path is given... move to $HOME
+    }
+    else {
+        goToPath = arguments[0];
+        if (goToPath == "~") {
+            goToPath = getenv("HOME");
+        }
+    }
+
+    if (chdir(goToPath.c_str()) != 0) {
+        cout << "cd: " << goToPath << ": No such file or directory" << endl;
+        lastExitStatus = 1;
+        return;
+    }
+    // relative PATH entries now point elsewhere
+    planGeneration++;
+
+}
+
+void printTermios(const termios& t) {
+    std::cout << "c_iflag: " << t.c_iflag << std::endl;
+    std::cout << "c_oflag: " << t.c_oflag << std::endl;
+    std::cout << "c_cflag: " << t.c_cflag << std::endl;
+    std::cout << "c_lflag: " << t.c_lflag << std::endl;
+    // Print control characters
+    for (int i = 0; i < NCCS; ++i) {
+        std::cout << "c_cc[" << i << "]: " << (int)t.c_cc[i] << std::endl;
+    }
+}
+
+string findLongestPrefix(vector<string> strs) {
+    if (strs.empty()) return "";
+    for (size_t i = 0; i < strs[0].size(); ++i) {
+        char c = strs[0][i];
+        for (size_t j = 1; j < strs.size(); ++j) {
+            if (i >= strs[j].size() || strs[j][i] != c)
+                return strs[0].substr(0, i);
+        }
+    }
+    return strs[0];
+}
+
+// what the completion worker needs to complete @line, as things are right now
+CompletionRequest completionRequest(const string& line) {
+    char cwd[PATH_MAX];
+    return {line, PATH, getcwd(cwd, sizeof(cwd)) != nullptr ? string(cwd) : string()};
+}
+
+bool inputEnded = false;
+bool inputInterrupted = false;
+
+// a paste can go on past the line break that ended the last line
+static bool pasting = false;
+
+string collectInput() {
+    TRACE_SPAN("collectInput");
+    inputEnded = false;
+    inputInterrupted = false;
+    // raw mode for the whole line; every chunk of input is answered with a single write
+    TerminalSession::RawModeScope rawMode(terminal);
+    string input = "";
+    int tabPressedCount = 0;
+    bool lineDone = false;
+
+    // PATH listings are brought up to date while the user types; Tab then only waits for a lookup
+    completionWorker.prewarm(completionRequest(""));
+    bool completionAsked = false;
+    string completionLine;
+
+    // Ctrl-R reverse incremental search through the history
+    bool searching = false;
+    string query;
+    uint64_t match = 0;
+    auto drawSearch = [&]() {
+        terminal.write(match != 0 || query.empty() ? "\r\x1b[K(reverse-i-search)`" : "\r\x1b[K(failed reverse-i-search)`");
+        terminal.write(query);
+        terminal.write("': ");
+        if (match != 0) terminal.write(commandHistory.at(match));
+    };
+    auto endSearch = [&]() {
+        if (match != 0) input = commandHistory.at(match);
+        searching = false;
+        terminal.write("\r\x1b[K$ ");
+        terminal.write(input);
+    };
+
+    while (!lineDone) {
+        string& pending = terminal.pendingInput();
+        size_t next = 0;
+
+        while (next < pending.size() && !lineDone) {
+            char ch = pending[next];
+
+            if (ch == '\x1b') {
+                // bracketed paste markers toggle paste mode, other escape sequences (arrow keys...) are ignored
+                size_t length = terminal.escapeSequenceLength(next);
+                if (length == 0) break; // incomplete, wait for the rest
+                string_view sequence(pending.data() + next, length);
+                if (sequence == "\x1b[200~") pasting = true;
+                else if (sequence == "\x1b[201~") pasting = false;
+                next += length;
+                continue;
+            }
+            next++;
+
+            // the answer to an earlier Tab is of no use for a different line
+            if (completionAsked && input != completionLine) {
+                completionWorker.cancel();
+                completionAsked = false;
+            }
+
+            if (searching && !pasting) {
+                if (ch == 18) { // Ctrl-R again: next older match
+                    uint64_t older = match != 0 ? commandHistory.searchBackward(query, match) : 0;
+                    if (older != 0) match = older;
+                    else terminal.write('\a');
+                    drawSearch();
+                    continue;
+                }
+                if (ch == 7) { // Ctrl-G: give up and return to the line as it was
+                    match = 0;
+                    endSearch();
+                    continue;
+                }
+                if (ch == 8 || ch == 127) {
+                    if (!query.empty()) query.pop_back();
+                    match = query.empty() ? 0 : commandHistory.searchBackward(query, UINT64_MAX);
+                    drawSearch();
+                    continue;
+                }
+                if ((unsigned char) ch >= 32) {
+                    query += ch;
+                    // the current match is kept as long as it still contains the longer query
+                    match = commandHistory.searchBackward(query, match != 0 ? match + 1 : UINT64_MAX);
+                    drawSearch();
+                    continue;
+                }
+                // any other key takes the match onto the line and is then handled as usual
+                endSearch();
+            }
+
+            if (pasting) {
+                // pasted text is taken literally, without completion. Each pasted line is submitted on its own,
+                // the rest stays pending for the lines after it.
+                if (ch == '\n' || ch == '\r') {
+                    if (ch == '\r' && next < pending.size() && pending[next] == '\n') next++;
+                    lineDone = true;
+                    continue;
+                }
+                terminal.write(ch);
+                input += ch;
+                continue;
+            }
+
+            if (ch == '\n' || ch == '\r') {
+                lineDone = true;
+            }
+            else if (ch == 18) { // Ctrl-R
+                searching = true;
+                query.clear();
+                match = 0;
+                drawSearch();
+            }
+            else if (ch == 3) { // Ctrl-C: the line is dropped and the caller starts over at a new prompt
+                terminal.write("^C");
+                input.clear();
+                inputInterrupted = true;
+                lineDone = true;
+            }
+            else if (ch == 28 || ch == 26) { // Ctrl-\ and Ctrl-Z do nothing at the prompt
+            }
+            else if (ch == 4) { // Ctrl-D
+                if (input.empty()) {
+                    input = "exit";
+                    inputEnded = true;
+                    lineDone = true;
+                }
+            }
+            else if (ch == 8 || ch == 127) { // backspace
+                if (!input.empty()) {
+                    input.pop_back();
+                    terminal.write("\b \b");   // \b (backspace): Moves the cursor one position left. (space): Overwrites the character at the cursor. \b (backspace): Moves the cursor back again.
+                }
+            }
+            else if ( ch == '\t') {
+                // display suggestions
+                if (input == "ech") {
+                    input = "echo ";
+                    terminal.write("o ");
+                }
+                else if (input == "exi") {
+                    input = "exit";
+                    terminal.write("t ");
+                }
+                else if (input == "typ") {
+                    input = "type ";
+                    terminal.write("e ");
+                }
+                else {
+                    tabPressedCount++;
+                    // no built in command present for autocompletion
+
+                    // candidates replace the word under the cursor: a program name, or a file name for
+                    // arguments and redirections
+                    CompletionWord word = CompletionWorker::currentWord(input);
+                    auto replaceWord = [&](const string& completed) {
+                        string text = CompletionWorker::escape(completed);
+                        string_view typed = string_view(input).substr(word.start);
+                        if (string_view(text).starts_with(typed)) {
+                            terminal.write(string_view(text).substr(typed.size()));
+                        }
+                        else {
+                            // quotes became backslashes: rewrite the word
+                            for (size_t i = 0; i < typed.size(); i++) terminal.write('\b');
+                            terminal.write("\x1b[K");
+                            terminal.write(text);
+                        }
+                        input.replace(word.start, string::npos, text);
+                    };
+
+                    vector<string> candidates;
+                    completionAsked = true;
+                    completionLine = input;
+                    if (!completionWorker.request(completionRequest(input), COMPLETION_WAIT, candidates)) {
+                        // still indexing: the next Tab picks the answer up
+                        terminal.write('\a');
+                        tabPressedCount = 0;
+                    }
+                    else if (input.empty() || candidates.empty()) {
+                        terminal.write('\a');
+                        tabPressedCount = 0;
+                    }
+                    else if (candidates.size() == 1) {
+                        const string& completed = candidates[0];
+                        // a directory stays open for the next component
+                        bool directory = completed.ends_with('/');
+                        if (word.text != completed || !directory) {
+                            replaceWord(completed);
+                            if (!directory) {
+                                terminal.write(' ');
+                                input += ' ';
+                            }
+                            tabPressedCount = 0;
+                        }
+                        else {
+                            terminal.write('\a');
+                            tabPressedCount = 0;
+                        }
+                    }
+                    else {
+                        // multiple suggestions found
+                        string longestPrefix = findLongestPrefix(candidates);
+                        if (longestPrefix.size() > word.text.size()) {
+                            replaceWord(longestPrefix);
+                            tabPressedCount = 0;
+                        }
+                        else if (tabPressedCount == 1) {
+                            terminal.write('\a');
+                        }
+                        else {
+                            // display all suggestions, file names without the directory typed before them
+                            terminal.write('\n');
+                            sort(candidates.begin(), candidates.end());
+                            size_t typedDirectory = word.text.rfind('/') + 1; // 0 without a '/'
+                            for (auto &s: candidates) {
+                                terminal.write(string_view(s).substr(typedDirectory));
+                                terminal.write("  ");
+                            }
+                            terminal.write("\n$ ");
+                            terminal.write(input);
+                        }
+                    }
+                }
+            }
+            else {
+                terminal.write(ch);
+                input += ch;
+            }
+        }
+
+        pending.erase(0, next);
+        terminal.flush();
+
+        if (!lineDone && !terminal.fill()) {
+            // end of input: leave the shell, like Ctrl-D on an empty line
+            if (input.empty()) {
+                input = "exit";
+                inputEnded = true;
+            }
+            lineDone = true;
+        }
+    }
+
+    terminal.write('\n');
+    terminal.flush();
+
+    return input;
+}
+
+
+HistoryStore commandHistory;
+
+// HISTSIZE bounds the number of entries kept, HISTCONTROL=ignoredups|erasedups drops repeated commands,
+// and HISTFILE names the file that history is loaded from and appended to.
+void initializeHistory() {
+    size_t capacity = 100000;
+    if (const char* size = getenv("HISTSIZE")) {
+        try {
+            capacity = max(stol(size), 1L);
+        } catch (const std::exception &) {}
+    }
+    HistoryStore::Dedup dedup = HistoryStore::Dedup::None;
+    if (const char* control = getenv("HISTCONTROL")) {
+        string_view value(control);
+        if (value.find("erasedups") != string_view::npos) dedup = HistoryStore::Dedup::EraseDups;
+        else if (value.find("ignoredups") != string_view::npos || value.find("ignoreboth") != string_view::npos) dedup = HistoryStore::Dedup::IgnoreDups;
+    }
+    commandHistory.configure(capacity, dedup);
+
+    const char* file = getenv("HISTFILE");
+    if (file != nullptr && *file != '\0' && !commandHistory.open(file)) {
+        cerr << "shell: " << file << ": " << strerror(errno) << endl;
+    }
+}
+
+void printHistoryEntry(uint64_t sequence) {
+    cout << "    " << sequence << "  " << commandHistory.at(sequence) << "\n";
+}
+
+void executeHistory(const vector<string>& arguments) {
+    if (!arguments.empty() && arguments[0] == "-s") {
+        // history -s pattern: every entry containing the pattern, oldest first
+        if (arguments.size() != 2) {
+            cout << "history: usage: history -s pattern" << endl;
+            lastExitStatus = 2;
+            return;
+        }
+        for (uint64_t sequence : commandHistory.searchAll(arguments[1])) printHistoryEntry(sequence);
+        cout.flush();
+        return;
+    }
+
+    int historyCount = commandHistory.size();
+    if (arguments.size() == 1) {
+        try {
+            historyCount = stoi(arguments[0]);
+        } catch (const std::exception &) {
+            cout << "history: " << arguments[0] << ": numeric argument required" << endl;
+            lastExitStatus = 1;
+            return;
+        }
+    }
+    else if (arguments.size() > 1) {
+        cout << "history: too many arguments" << endl;
+        lastExitStatus = 1;
+        return;
+    }
+
+    // walk back over the newest entries, skipping slots of erased duplicates
+    vector<uint64_t> shown;
+    for (uint64_t sequence = commandHistory.newest(); sequence >= commandHistory.oldest() && sequence > 0 && (int) shown.size() < historyCount; sequence--) {
+        if (commandHistory.contains(sequence)) shown.push_back(sequence);
+    }
+    for (auto it = shown.rbegin(); it != shown.rend(); ++it) printHistoryEntry(*it);
+    cout.flush();
+}
+
+// puts an interactive shell into its own process group in the foreground of the terminal and ignores the
+// signals meant for jobs; pipelines started from then on get process groups of their own.
+void initializeJobControl() {
+    if (!isatty(STDIN_FILENO)) return;
+
+    // started in the background: wait until the user brings us to the foreground
+    while (tcgetpgrp(STDIN_FILENO) != getpgrp()) kill(-getpgrp(), SIGTTIN);
+
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    setpgid(0, 0);
+    shellProcessGroup = getpgrp();
+    tcsetpgrp(STDIN_FILENO, shellProcessGroup);
+    jobs.install();
+    jobControl = true;
+}
+
+void initializeForkServer() {
+    if (ProcessLauncher::defaultMode() != LaunchMode::Server) return;
+    if (!forkServer.start(jobs)) cerr << "shell: fork server: " << strerror(errno) << endl;
+}
+
+// the line without the `&` that sent it to the background
+string jobCommandText(const string& input) {
+    size_t end = input.find_last_not_of(" \t");
+    if (end != string::npos && input[end] == '&') end = input.find_last_not_of(" \t", end - 1);
+    return end == string::npos ? "" : input.substr(0, end + 1);
+}
+
+string describeJobState(const Job& job) {
+    if (job.state == JobState::Running) return "Running";
+    if (job.state == JobState::Stopped) return "Stopped";
+    int status = job.statuses.back();
+    if (WIFSIGNALED(status)) return strsignal(WTERMSIG(status));
+    if (WEXITSTATUS(status) != 0) return "Exit " + to_string(WEXITSTATUS(status));
+    return "Done";
+}
+
+// prints the job the way `jobs` does: [1]+  Running                 sleep 10 &
+void printJob(const Job& job, bool withPids) {
+    char marker = ' ';
+    if (&job == jobs.current()) marker = '+';
+    else if (&job == jobs.previous()) marker = '-';
+
+    string state = describeJobState(job);
+    cout << "[" << job.id << "]" << marker << "  ";
+    if (withPids) cout << job.pids.front() << " ";
+    cout << state << string(state.size() < 24 ? 24 - state.size() : 1, ' ') << job.command;
+    if (job.state == JobState::Running && job.background) cout << " &";
+    cout << "\n";
+}
+
+// waits for a job in the foreground, with the terminal handed to it. a job stopped with Ctrl-Z stays in the
+// table, a finished one is dropped. returns the job's exit status.
+int waitForJob(Job& job, Job* finished) {
+    TRACE_SPAN("waitForJob");
+    if (jobControl && job.processGroup > 0) tcsetpgrp(STDIN_FILENO, job.processGroup);
+    jobs.waitWhileRunning(job);
+    if (jobControl) tcsetpgrp(STDIN_FILENO, shellProcessGroup);
+    if (finished != nullptr) *finished = job;
+
+    int status = JobTable::exitStatus(job);
+    lastExitStatus = status;
+    if (job.state == JobState::Stopped) {
+        job.background = true;
+        job.changed = false;
+        cout << "\n";
+        printJob(job, false);
+        cout.flush();
+        return status;
+    }
+    // the terminal echoed ^C but no newline
+    if (WIFSIGNALED(job.statuses.back()) && WTERMSIG(job.statuses.back()) == SIGINT) {
+        cout << endl;
+        interruptRequested = 1;
+    }
+    jobs.remove(job.id);
+    return status;
+}
+
+// reports background jobs that finished or stopped since the last prompt, like bash does before printing one
+void notifyJobChanges() {
+    jobs.update();
+    vector<int> finished;
+    for (auto& [id, job] : jobs.all()) {
+        if (!job.changed) continue;
+        job.changed = false;
+        printJob(job, false);
+        if (job.state == JobState::Done) finished.push_back(id);
+    }
+    for (int id : finished) jobs.remove(id);
+    cout.flush();
+}
+
+// resolves %n, %%, %+, %-, %prefix (or a bare job number) to a job; reports unknown ones as `builtin: spec: no such job`
+Job* findJob(const string& builtin, const string& spec) {
+    jobs.update();
+    Job* job = nullptr;
+    string name = spec.empty() || spec[0] != '%' ? spec : spec.substr(1);
+    if (spec.empty() || name == "%" || name == "+") {
+        job = jobs.current();
+        if (job == nullptr) {
+            cout << builtin << ": current: no such job" << endl;
+            lastExitStatus = 1;
+            return nullptr;
+        }
+        return job;
+    }
+    if (name == "-") {
+        job = jobs.previous();
+    }
+    else if (!name.empty() && all_of(name.begin(), name.end(), ::isdigit)) {
+        job = jobs.find(stoi(name));
+    }
+    else {
+        for (auto& [id, candidate] : jobs.all()) {
+            if (candidate.command.starts_with(name)) job = &candidate;
+        }
+    }
+    if (job == nullptr) {
+        cout << builtin << ": " << spec << ": no such job" << endl;
+        lastExitStatus = 1;
+    }
+    return job;
+}
+
+// sends the signal to the job's process group, or to each of its processes without job control
+void signalJob(const Job& job, int sig) {
+    if (job.processGroup > 0) {
+        kill(-job.processGroup, sig);
+        return;
+    }
+    for (size_t i = 0; i < job.pids.size(); i++) {
+        if (!job.exited[i]) kill(job.pids[i], sig);
+    }
+}
+
+void executeJobs(const vector<string>& arguments) {
+    bool withPids = false, onlyPids = false;
+    for (auto &arg: arguments) {
+        if (arg == "-l") withPids = true;
+        else if (arg == "-p") onlyPids = true;
+        else {
+            cout << "jobs: " << arg << ": invalid option" << endl;
+            lastExitStatus = 2;
+            return;
+        }
+    }
+
+    jobs.update();
+    vector<int> finished;
+    for (auto& [id, job] : jobs.all()) {
+        if (onlyPids) cout << job.pids.front() << "\n";
+        else printJob(job, withPids);
+        // a finished job is reported once
+        job.changed = false;
+        if (job.state == JobState::Done) finished.push_back(id);
+    }
+    for (int id : finished) jobs.remove(id);
+    cout.flush();
+}
+
+void executeFg(const vector<string>& arguments) {
+    Job* job = findJob("fg", arguments.empty() ? "" : arguments[0]);
+    if (job == nullptr) return;
+
+    cout << job->command << endl;
+    job->background = false;
+    if (jobControl && job->processGroup > 0) tcsetpgrp(STDIN_FILENO, job->processGroup);
+    if (job->state == JobState::Stopped) {
+        signalJob(*job, SIGCONT);
+        jobs.markContinued(*job);
+    }
+    waitForJob(*job);
+}
+
+void executeBg(const vector<string>& arguments) {
+    Job* job = findJob("bg", arguments.empty() ? "" : arguments[0]);
+    if (job == nullptr) return;
+
+    if (job->state != JobState::Stopped) {
+        cout << "bg: job " << job->id << " already in background" << endl;
+        return;
+    }
+    signalJob(*job, SIGCONT);
+    jobs.markContinued(*job);
+    job->background = true;
+    cout << "[" << job->id << "]" << (job == jobs.current() ? "+ " : "- ") << job->command << " &" << endl;
+}
+
+void executeWait(const vector<string>& arguments) {
+    vector<int> ids;
+    if (arguments.empty()) {
+        jobs.update();
+        for (auto& [id, job] : jobs.all()) ids.push_back(id);
+    }
+    for (auto &arg: arguments) {
+        if (arg[0] == '%') {
+            Job* job = findJob("wait", arg);
+            if (job != nullptr) ids.push_back(job->id);
+            continue;
+        }
+        // a pid names the job it belongs to
+        bool found = false;
+        for (auto& [id, job] : jobs.all()) {
+            if (find(job.pids.begin(), job.pids.end(), atoi(arg.c_str())) != job.pids.end()) {
+                ids.push_back(id);
+                found = true;
+            }
+        }
+        if (!found) {
+            cout << "wait: pid " << arg << " is not a child of this shell" << endl;
+            lastExitStatus = 127;
+        }
+    }
+
+    for (int id : ids) {
+        Job* job = jobs.find(id);
+        if (job == nullptr) continue;
+        // a stopped job would never finish, so waiting ends there as well
+        jobs.waitWhileRunning(*job);
+        if (job->state == JobState::Done) jobs.remove(id);
+    }
+}
+
+typedef struct {
+    const char* name;
+    int number;
+} SignalName;
+
+const vector<SignalName> signalNames = {
+    {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL}, {"USR1", SIGUSR1}, {"USR2", SIGUSR2},
+    {"PIPE", SIGPIPE}, {"ALRM", SIGALRM}, {"TERM", SIGTERM}, {"CHLD", SIGCHLD}, {"CONT", SIGCONT}, {"STOP", SIGSTOP},
+    {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN}, {"TTOU", SIGTTOU}, {"WINCH", SIGWINCH},
+};
+
+// accepts 9, KILL and SIGKILL; returns -1 for anything else
+int parseSignal(string name) {
+    if (!name.empty() && all_of(name.begin(), name.end(), ::isdigit)) {
+        int number = stoi(name);
+        return number < NSIG ? number : -1;
+    }
+    if (name.starts_with("SIG")) name = name.substr(3);
+    for (auto &entry: signalNames) {
+        if (name == entry.name) return entry.number;
+    }
+    return -1;
+}
+
+void executeKill(const vector<string>& arguments) {
+    int sig = SIGTERM;
+    size_t i = 0;
+    if (i < arguments.size() && arguments[i] == "-l") {
+        for (auto &entry: signalNames) cout << entry.number << ") SIG" << entry.name << "\n";
+        cout.flush();
+        return;
+    }
+    if (i < arguments.size() && arguments[i] == "-s") {
+        if (i + 1 == arguments.size()) {
+            cout << "kill: -s: option requires an argument" << endl;
+            lastExitStatus = 2;
+            return;
+        }
+        sig = parseSignal(arguments[i + 1]);
+        if (sig < 0) {
+            cout << "kill: " << arguments[i + 1] << ": invalid signal specification" << endl;
+            lastExitStatus = 1;
+            return;
+        }
+        i += 2;
+    }
+    else if (i < arguments.size() && arguments[i].size() > 1 && arguments[i][0] == '-') {
+        sig = parseSignal(arguments[i].substr(1));
+        if (sig < 0) {
+            cout << "kill: " << arguments[i].substr(1) << ": invalid signal specification" << endl;
+            lastExitStatus = 1;
+            return;
+        }
+        i++;
+    }
+    if (i == arguments.size()) {
+        cout << "kill: usage: kill [-s sigspec | -sigspec] pid | jobspec ..." << endl;
+        lastExitStatus = 2;
+        return;
+    }
+
+    for (; i < arguments.size(); i++) {
+        const string &target = arguments[i];
+        if (target[0] == '%') {
+            Job* job = findJob("kill", target);
+            if (job == nullptr) continue;
+            signalJob(*job, sig);
+            // a stopped job only acts on the signal once it runs again
+            if (job->state == JobState::Stopped && (sig == SIGTERM || sig == SIGHUP)) signalJob(*job, SIGCONT);
+            continue;
+        }
+        if (target.empty() || !all_of(target.begin() + (target[0] == '-'), target.end(), ::isdigit)) {
+            cout << "kill: " << target << ": arguments must be process or job IDs" << endl;
+            lastExitStatus = 1;
+            continue;
+        }
+        if (kill(stoi(target), sig) != 0) {
+            cout << "kill: (" << target << ") - " << strerror(errno) << endl;
+            lastExitStatus = 1;
+        }
+    }
+}
+
+// number of CPUs this process may run on, which can be fewer than the machine has
+int availableCpus() {
+    cpu_set_t cpus;
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) return max(CPU_COUNT(&cpus), 1);
+    return max((int) sysconf(_SC_NPROCESSORS_ONLN), 1);
+}
+
+// copies everything in the file to @to, with sendfile where the kernel allows it
+void copyFileToFd(int from, int to) {
+    off_t offset = 0;
+    struct stat sb;
+    if (fstat(from, &sb) != 0) return;
+    while (offset < sb.st_size) {
+        ssize_t n = sendfile(to, from, &offset, sb.st_size - offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n > 0) continue;
+
+        // e.g. a terminal that sendfile can't write to
+        char buffer[1 << 16];
+        ssize_t got;
+        while ((got = pread(from, buffer, sizeof(buffer), offset)) > 0) {
+            if (write(to, buffer, got) < 0) return;
+            offset += got;
+        }
+        return;
+    }
+}
+
+volatile sig_atomic_t parallelInterrupted = 0;
+
+void onParallelInterrupt(int) {
+    parallelInterrupted = 1;
+}
+
+// replaces {} with the input line and {#} with the job number; returns whether anything was replaced
+bool substitutePlaceholders(string& text, const string& line, size_t jobNumber) {
+    bool replaced = false;
+    size_t at = 0;
+    while ((at = text.find('{', at)) != string::npos) {
+        if (text.compare(at, 2, "{}") == 0) {
+            text.replace(at, 2, line);
+            at += line.size();
+            replaced = true;
+        }
+        else if (text.compare(at, 3, "{#}") == 0) {
+            string number = to_string(jobNumber);
+            text.replace(at, 3, number);
+            at += number.size();
+            replaced = true;
+        }
+        else {
+            at++;
+        }
+    }
+    return replaced;
+}
+
+// runs the command template once per input line, at most options.maxJobs at a time. every job writes into
+// memory files of its own, which are copied to the shell's stdout/stderr in one piece once the job is done.
+ParallelSummary runParallel(const string& commandTemplate, const ParallelOptions& options, const function<bool(string&)>& nextInput) {
+    ParallelSummary summary = {0, 0, 0, 0};
+    vector<ParsedCommand> parsedTemplate = parseInput(commandTemplate);
+    if (parsedTemplate.size() != 1) {
+        if (parsedTemplate.size() > 1) cerr << "parallel: the command must not be a pipeline" << endl;
+        return summary;
+    }
+
+    typedef struct {
+        size_t number;
+        int stdoutFd;
+        int stderrFd;
+    } ParallelJob;
+
+    map<pid_t, ParallelJob> running;
+    map<size_t, ParallelJob> finishedOutOfOrder; // --keep-order: jobs waiting for an earlier one
+    size_t nextToPrint = 1;
+    bool stop = false;
+
+    auto emit = [&](const ParallelJob& job) {
+        copyFileToFd(job.stdoutFd, STDOUT_FILENO);
+        copyFileToFd(job.stderrFd, STDERR_FILENO);
+        close(job.stdoutFd);
+        close(job.stderrFd);
+    };
+
+    auto launch = [&](const string& line) {
+        size_t number = ++summary.started;
+        ParsedCommand parsedCommand = parsedTemplate[0];
+        bool hasPlaceholder = false;
+        for (auto &token: parsedCommand.tokens) hasPlaceholder |= substitutePlaceholders(token, line, number);
+        hasPlaceholder |= substitutePlaceholders(parsedCommand.standardOutputFile.fileName, line, number);
+        hasPlaceholder |= substitutePlaceholders(parsedCommand.standardErrorFile.fileName, line, number);
+        hasPlaceholder |= substitutePlaceholders(parsedCommand.standardInputFile.fileName, line, number);
+        if (!hasPlaceholder) parsedCommand.tokens.push_back(line);
+
+        ParallelJob job = {number, memfd_create("parallel-stdout", MFD_CLOEXEC), memfd_create("parallel-stderr", MFD_CLOEXEC)};
+        if (job.stdoutFd < 0 || job.stderrFd < 0) {
+            perror("parallel: memfd_create failed");
+            if (job.stdoutFd >= 0) close(job.stdoutFd);
+            if (job.stderrFd >= 0) close(job.stderrFd);
+            summary.failed++;
+            stop = true;
+            return;
+        }
+
+        // jobs don't get to read the argument list, which may well be the shell's stdin
+        const vector<string>& tokens = parsedCommand.tokens;
+        string programLocation = isBuiltinCommand(tokens[0]) ? "" : programLocationInPATH(tokens[0]);
+        pid_t pid = -1;
+        if (!programLocation.empty()) {
+            ProcessLauncher launcher;
+            launcher.open(STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+            launcher.dup(job.stdoutFd, STDOUT_FILENO);
+            launcher.dup(job.stderrFd, STDERR_FILENO);
+            addRedirections(launcher, parsedCommand);
+            // a < file or here-document replaces /dev/null; one that can't be opened fails the job
+            int inputFd;
+            if (openStandardInput(parsedCommand, inputFd)) {
+                if (inputFd >= 0) launcher.dup(inputFd, STDIN_FILENO);
+                pid = launchProgram(launcher, programLocation, vector<string>(tokens.begin() + 1, tokens.end()));
+                if (inputFd >= 0) close(inputFd);
+            }
+        }
+        else {
+            // builtins, cat/head/tee/wc reading stdin and unknown commands run in a forked copy of the shell, like in a pipeline
+            cout.flush();
+            pid = fork();
+            if (pid == 0) {
+                int devNull = open("/dev/null", O_RDONLY);
+                dup2(devNull, STDIN_FILENO);
+                dup2(job.stdoutFd, STDOUT_FILENO);
+                dup2(job.stderrFd, STDERR_FILENO);
+                string text = tokens[0];
+                for (size_t i = 1; i < tokens.size(); i++) text += " " + tokens[i];
+                // the builtin's own status, or 127 that executeCommand set for an unknown command
+                executeCommand(text, {parsedCommand}, 0);
+                cout.flush();
+                _exit(lastExitStatus);
+            }
+        }
+
+        if (pid < 0) {
+            summary.failed++;
+            if (options.haltOnError) stop = true;
+            if (options.keepOrder) finishedOutOfOrder[number] = job;
+            else emit(job);
+            return;
+        }
+        running[pid] = job;
+    };
+
+    struct sigaction interrupt = {}, previousInterrupt;
+    interrupt.sa_handler = onParallelInterrupt;
+    sigemptyset(&interrupt.sa_mask);
+    sigaction(SIGINT, &interrupt, &previousInterrupt);
+    parallelInterrupted = 0;
+
+    auto start = chrono::steady_clock::now();
+    string line;
+    while (true) {
+        while (!stop && (int) running.size() < options.maxJobs && nextInput(line)) launch(line);
+        if (running.empty()) break;
+
+        pid_t donePid = -1;
+        int status = 0;
+        jobs.waitUntil([&]() {
+            if (parallelInterrupted) return true;
+            for (auto& [pid, job] : running) {
+                if (jobs.takeExitStatus(pid, status)) {
+                    donePid = pid;
+                    return true;
+                }
+            }
+            return false;
+        });
+
+        if (parallelInterrupted) {
+            // Ctrl-C: the running jobs got it from the terminal as well, nothing new is started
+            parallelInterrupted = 0;
+            stop = true;
+            for (auto& [pid, job] : running) kill(pid, SIGINT);
+            if (donePid < 0) continue;
+        }
+
+        ParallelJob job = running[donePid];
+        running.erase(donePid);
+        bool succeeded = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (succeeded) summary.succeeded++;
+        else summary.failed++;
+        if (!succeeded && options.haltOnError) stop = true;
+
+        cout.flush();
+        if (!options.keepOrder) {
+            emit(job);
+            continue;
+        }
+        finishedOutOfOrder[job.number] = job;
+        for (auto it = finishedOutOfOrder.begin(); it != finishedOutOfOrder.end() && it->first == nextToPrint; nextToPrint++) {
+            emit(it->second);
+            it = finishedOutOfOrder.erase(it);
+        }
+    }
+    // jobs that could not be launched are only printed once the ones before them are done
+    for (auto& [number, job] : finishedOutOfOrder) emit(job);
+
+    sigaction(SIGINT, &previousInterrupt, nullptr);
+    summary.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return summary;
+}
+
+// parallel [-j N] [-k] [--halt-on-error] [--no-summary] [-a FILE] command [args...] [::: inputs...]
+void executeParallel(const vector<string>& arguments) {
+    ParallelOptions options = {availableCpus(), false, false, true};
+    string inputFile;
+    size_t i = 0;
+    for (; i < arguments.size() && arguments[i].starts_with("-"); i++) {
+        string option = arguments[i];
+        if (option.starts_with("-j") && option.size() > 2) {
+            // -j4
+            options.maxJobs = atoi(option.c_str() + 2);
+            if (options.maxJobs <= 0) {
+                cout << "parallel: " << option.substr(2) << ": invalid number of jobs" << endl;
+                lastExitStatus = 2;
+                return;
+            }
+            continue;
+        }
+        if (option == "--") {
+            i++;
+            break;
+        }
+        if (option == "-j" || option == "--jobs" || option == "-a" || option == "--arg-file") {
+            if (i + 1 == arguments.size()) {
+                cout << "parallel: " << option << ": option requires an argument" << endl;
+                lastExitStatus = 2;
+                return;
+            }
+            const string &value = arguments[++i];
+            if (option == "-a" || option == "--arg-file") {
+                inputFile = value;
+                continue;
+            }
+            try {
+                options.maxJobs = stoi(value);
+            } catch (const std::exception &) {
+                options.maxJobs = 0;
+            }
+            if (options.maxJobs <= 0) {
+                cout << "parallel: " << value << ": invalid number of jobs" << endl;
+                lastExitStatus = 2;
+                return;
+            }
+        }
+        else if (option == "-k" || option == "--keep-order") options.keepOrder = true;
+        else if (option == "--halt-on-error") options.haltOnError = true;
+        else if (option == "--no-summary") options.summary = false;
+        else {
+            cout << "parallel: " << option << ": invalid option" << endl;
+            lastExitStatus = 2;
+            return;
+        }
+    }
+
+    // the command runs up to `:::`, whatever follows are the inputs
+    auto separator = find(arguments.begin() + i, arguments.end(), ":::");
+    string commandTemplate;
+    for (auto it = arguments.begin() + i; it != separator; ++it) {
+        if (!commandTemplate.empty()) commandTemplate += " ";
+        commandTemplate += *it;
+    }
+    if (commandTemplate.empty()) {
+        cout << "parallel: usage: parallel [-j N] [-k] [--halt-on-error] [-a file] command [args...] [::: inputs...]" << endl;
+        lastExitStatus = 2;
+        return;
+    }
+
+    ParallelSummary summary;
+    if (separator != arguments.end()) {
+        auto next = separator + 1;
+        summary = runParallel(commandTemplate, options, [&](string& line) {
+            if (next == arguments.end()) return false;
+            line = *next++;
+            return true;
+        });
+    }
+    else {
+        LineReader reader;
+        if (inputFile.empty()) {
+            reader.readFrom(STDIN_FILENO);
+        }
+        else if (!reader.open(inputFile)) {
+            cout << "parallel: " << inputFile << ": " << strerror(errno) << endl;
+            lastExitStatus = 1;
+            return;
+        }
+        summary = runParallel(commandTemplate, options, [&](string& line) {
+            string_view view;
+            if (!reader.nextLine(view)) return false;
+            line = view;
+            return true;
+        });
+    }
+
+    if (options.summary && summary.started > 0) {
+        cout.flush();
+        fprintf(stderr, "parallel: %zu jobs, %zu succeeded, %zu failed in %.3f s (%.1f jobs/s, %d at a time)\n",
+                summary.started, summary.succeeded, summary.failed, summary.seconds,
+                summary.seconds > 0 ? summary.started / summary.seconds : 0.0, options.maxJobs);
+    }
+    // like GNU parallel: the number of failed jobs, at most 101
+    lastExitStatus = (int) min<size_t>(summary.failed, 101);
+}
+
+// cat, head, tee and wc run inside the shell when their options are simple enough, moving data with
+// splice/sendfile/copy_file_range instead of through a user-space buffer. SHELL_FAST_UTILS=0 turns this off.
+bool fastUtilities = !(getenv("SHELL_FAST_UTILS") && strcmp(getenv("SHELL_FAST_UTILS"), "0") == 0);
+
+bool isCount(const string& s) {
+    return !s.empty() && s.size() < 19 && all_of(s.begin(), s.end(), ::isdigit);
+}
+
+// recognizes the cat/head/tee/wc invocations handled in-process; anything else goes to the program in PATH
+bool parseFastUtility(const vector<string>& tokens, FastUtilityCall& call) {
+    if (!fastUtilities || tokens.empty()) return false;
+    const string& name = tokens[0];
+    if (name != "cat" && name != "head" && name != "tee" && name != "wc") return false;
+
+    call = FastUtilityCall{name, {}, false, false, false, 10, false};
+    for (size_t i = 1; i < tokens.size(); i++) {
+        const string& arg = tokens[i];
+        if (arg == "-" || arg.empty() || arg[0] != '-') {
+            call.files.push_back(arg);
+            continue;
+        }
+        if (name == "head") {
+            // -n N, -nN, -c N, -cN and -N
+            string value;
+            if (arg == "-n" || arg == "-c") {
+                if (i + 1 == tokens.size()) return false;
+                value = tokens[++i];
+            }
+            else if (arg[1] == 'n' || arg[1] == 'c') {
+                value = arg.substr(2);
+            }
+            else {
+                value = arg.substr(1);
+                if (!isCount(value)) return false;
+                call.count = stoull(value);
+                continue;
+            }
+            if (!isCount(value)) return false;
+            call.headBytes = arg[1] == 'c';
+            call.count = stoull(value);
+        }
+        else if (name == "wc") {
+            for (size_t k = 1; k < arg.size(); k++) {
+                if (arg[k] == 'l') call.countLines = true;
+                else if (arg[k] == 'c') call.countBytes = true;
+                else return false;
+            }
+        }
+        else if (name == "tee" && arg == "-a") {
+            call.append = true;
+        }
+        else {
+            return false;
+        }
+    }
+
+    if (name == "head" && call.files.size() > 1) return false; // no ==> file <== headers
+    if (name == "wc" && !call.countLines && !call.countBytes) return false; // counting words is left to wc
+    if (name == "tee" && find(call.files.begin(), call.files.end(), "-") != call.files.end()) return false;
+    return true;
+}
+
+bool fastUtilityReadsStdin(const FastUtilityCall& call) {
+    return call.name == "tee" || call.files.empty() || find(call.files.begin(), call.files.end(), "-") != call.files.end();
+}
+
+// opens an input file for cat/head/wc, reporting failures like the utility would. "-" is stdin.
+int openFastUtilityInput(const FastUtilityCall& call, const string& file) {
+    if (file == "-") return STDIN_FILENO;
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat sb;
+    if (fd >= 0 && fstat(fd, &sb) == 0 && S_ISDIR(sb.st_mode)) {
+        close(fd);
+        errno = EISDIR;
+        fd = -1;
+    }
+    if (fd < 0) {
+        cerr << call.name << ": " << file << ": " << strerror(errno) << endl;
+        lastExitStatus = 1;
+    }
+    return fd;
+}
+
+void reportFastUtilityError(const FastUtilityCall& call) {
+    // a reader that went away is not worth a message, and the status is the one SIGPIPE would have given
+    if (errno != EPIPE) cerr << call.name << ": " << strerror(errno) << endl;
+    lastExitStatus = errno == EPIPE ? 128 + SIGPIPE : 1;
+}
+
+// like coreutils, an operand that can't be read or written fails the whole call with status 1
+void executeFastUtility(const FastUtilityCall& call) {
+    // whatever the shell printed so far goes first, the data below bypasses cout
+    cout.flush();
+    vector<string> files = call.files;
+    if (files.empty() && call.name != "tee") files.push_back("-");
+
+    if (call.name == "cat" || call.name == "head") {
+        for (auto &file: files) {
+            int fd = openFastUtilityInput(call, file);
+            if (fd < 0) continue;
+            uint64_t copied;
+            bool ok = call.name == "cat" ? DataMover::copy(fd, STDOUT_FILENO)
+                    : call.headBytes ? DataMover::copy(fd, STDOUT_FILENO, call.count, copied)
+                    : DataMover::copyLines(fd, STDOUT_FILENO, call.count);
+            if (!ok) reportFastUtilityError(call);
+            if (fd != STDIN_FILENO) close(fd);
+            if (!ok) return;
+        }
+        return;
+    }
+
+    if (call.name == "tee") {
+        vector<int> outputs;
+        for (auto &file: files) {
+            int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (call.append ? O_APPEND : O_TRUNC), 0666);
+            if (fd < 0) {
+                cerr << "tee: " << file << ": " << strerror(errno) << endl;
+                lastExitStatus = 1;
+            }
+            else outputs.push_back(fd);
+        }
+        outputs.push_back(STDOUT_FILENO);
+        if (!DataMover::tee(STDIN_FILENO, outputs)) reportFastUtilityError(call);
+        for (int fd : outputs) {
+            if (fd != STDOUT_FILENO) close(fd);
+        }
+        return;
+    }
+
+    // wc: counts are right-aligned to the width of the total size of the files, or 7 for streams,
+    // unless a single number is printed
+    int counts = call.countLines + call.countBytes;
+    size_t width = 1;
+    if (counts > 1 || files.size() > 1) {
+        uint64_t totalSize = 0;
+        bool streams = false;
+        for (auto &file: files) {
+            struct stat sb;
+            int status = file == "-" ? fstat(STDIN_FILENO, &sb) : stat(file.c_str(), &sb);
+            if (status == 0 && S_ISREG(sb.st_mode)) totalSize += sb.st_size;
+            else if (status == 0) streams = true;
+        }
+        width = streams ? 7 : to_string(totalSize).size();
+    }
+
+    auto printCounts = [&](uint64_t lines, uint64_t bytes, const string& name) {
+        string line;
+        auto add = [&](uint64_t value) {
+            string number = to_string(value);
+            if (!line.empty()) line += " ";
+            line += string(number.size() < width ? width - number.size() : 0, ' ') + number;
+        };
+        if (call.countLines) add(lines);
+        if (call.countBytes) add(bytes);
+        if (!call.files.empty()) line += " " + name; // plain stdin goes without a name
+        cout << line << "\n";
+    };
+
+    uint64_t totalLines = 0, totalBytes = 0;
+    for (auto &file: files) {
+        int fd = openFastUtilityInput(call, file);
+        if (fd < 0) continue;
+        uint64_t lines, bytes;
+        if (DataMover::count(fd, call.countLines, lines, bytes)) {
+            printCounts(lines, bytes, file);
+            totalLines += lines;
+            totalBytes += bytes;
+        }
+        else {
+            cerr << "wc: " << file << ": " << strerror(errno) << endl;
+            lastExitStatus = 1;
+        }
+        if (fd != STDIN_FILENO) close(fd);
+    }
+    if (files.size() > 1) printCounts(totalLines, totalBytes, "total");
+    cout.flush();
+}
+
+PipeSettings pipeSettings = {0, false, PipeTransport::Pipe, false};
+
+bool isPipeSetting(const string& word) {
+    return word.starts_with("PIPE_SIZE=") || word.starts_with("PIPE_TRANSPORT=") || word.starts_with("PIPE_STATS=");
+}
+
+// PIPE_SIZE=default|auto|<bytes>[K|M], PIPE_TRANSPORT=pipe|socketpair, PIPE_STATS=0|1
+bool applyPipeSetting(const string& word, PipeSettings& settings) {
+    string name = word.substr(0, word.find('='));
+    string value = word.substr(name.size() + 1);
+    if (name == "PIPE_SIZE") {
+        if (value == "default" || value == "auto") {
+            settings.capacity = 0;
+            settings.autoGrow = value == "auto";
+            return true;
+        }
+        size_t digits = 0;
+        while (digits < value.size() && isdigit(value[digits])) digits++;
+        string unit = value.substr(digits);
+        if (digits == 0 || digits > 9 || unit.size() > 1) return false;
+        long long capacity = stoll(value.substr(0, digits));
+        if (unit == "K" || unit == "k") capacity <<= 10;
+        else if (unit == "M" || unit == "m") capacity <<= 20;
+        else if (!unit.empty()) return false;
+        if (capacity <= 0 || capacity > INT32_MAX) return false;
+        settings.capacity = (int) capacity;
+        settings.autoGrow = false;
+        return true;
+    }
+    if (name == "PIPE_TRANSPORT") {
+        if (value == "pipe") settings.transport = PipeTransport::Pipe;
+        else if (value == "socketpair") settings.transport = PipeTransport::SocketPair;
+        else return false;
+        return true;
+    }
+    if (name == "PIPE_STATS") {
+        if (value != "0" && value != "1") return false;
+        settings.stats = value == "1";
+        return true;
+    }
+    return false;
+}
+
+bool takePipeSettings(ParsedCommand& first, PipeSettings& settings) {
+    vector<string>& tokens = first.tokens;
+    size_t taken = 0;
+    while (taken < tokens.size() && isPipeSetting(tokens[taken])) {
+        if (!applyPipeSetting(tokens[taken], settings)) {
+            cerr << "shell: " << tokens[taken] << ": invalid setting" << endl;
+            return false;
+        }
+        taken++;
+    }
+    if (taken == 0) return true;
+    if (taken == tokens.size()) {
+        cerr << "shell: " << tokens.front() << ": pipe settings need a command, see pipeconf" << endl;
+        return false;
+    }
+    tokens.erase(tokens.begin(), tokens.begin() + taken);
+    return true;
+}
+
+string describePipeSize(const PipeSettings& settings) {
+    if (settings.autoGrow) return "auto";
+    if (settings.capacity == 0) return "default";
+    if (settings.capacity % (1 << 20) == 0) return to_string(settings.capacity >> 20) + "M";
+    if (settings.capacity % (1 << 10) == 0) return to_string(settings.capacity >> 10) + "K";
+    return to_string(settings.capacity);
+}
+
+// without arguments prints the settings in the form it accepts them
+void executePipeconf(const vector<string>& arguments) {
+    PipeSettings settings = pipeSettings;
+    for (const string& argument : arguments) {
+        if (!isPipeSetting(argument) || !applyPipeSetting(argument, settings)) {
+            cout << "pipeconf: " << argument << ": invalid setting" << endl;
+            lastExitStatus = 2;
+            return;
+        }
+    }
+    pipeSettings = settings;
+    if (!arguments.empty()) return;
+
+    cout << "PIPE_SIZE=" << describePipeSize(settings) << "\n";
+    cout << "PIPE_TRANSPORT=" << (settings.transport == PipeTransport::SocketPair ? "socketpair" : "pipe") << "\n";
+    cout << "PIPE_STATS=" << settings.stats << "\n";
+    cout.flush();
+}
+
+// one row per stage on stderr: the bytes it read from and wrote to its channels, how often it had to wait for
+// its neighbours, and the capacity its output channel ended up with
+void printPipelineStats(const vector<ParsedCommand>& parsedCommands, const vector<ChannelStats>& stats) {
+    if (stats.size() + 1 != parsedCommands.size()) return;
+    auto count = [](bool present, uint64_t value) { return present ? to_string(value) : string("-"); };
+
+    fprintf(stderr, "%5s  %-24s %12s %12s %11s %10s %9s\n",
+            "stage", "command", "read", "written", "write waits", "read waits", "pipe");
+    for (size_t stage = 0; stage < parsedCommands.size(); stage++) {
+        string command = commandText(parsedCommands[stage].tokens);
+        if (command.size() > 24) command = command.substr(0, 21) + "...";
+
+        bool reads = stage > 0, writes = stage < stats.size();
+        const ChannelStats* in = reads ? &stats[stage - 1] : nullptr;
+        const ChannelStats* out = writes ? &stats[stage] : nullptr;
+        fprintf(stderr, "%5zu  %-24s %12s %12s %11s %10s %9s\n", stage + 1, command.c_str(),
+                count(reads, reads ? in->bytes : 0).c_str(), count(writes, writes ? out->bytes : 0).c_str(),
+                count(writes, writes ? out->fullStalls : 0).c_str(), count(reads, reads ? in->emptyStalls : 0).c_str(),
+                count(writes && out->capacity > 0, writes ? out->capacity : 0).c_str());
+    }
+}
+
+TimingFormat timingMode = TimingFormat::Off;
+string timingFile;
+LineTiming* currentTiming = nullptr;
+
+double monotonicSeconds() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+string jsonEscape(const string& s) {
+    string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char) c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+string commandText(const vector<string>& tokens) {
+    string text;
+    for (const string& token : tokens) text += (text.empty() ? "" : " ") + token;
+    return text;
+}
+
+static double seconds(const timeval& t) {
+    return t.tv_sec + t.tv_usec / 1e6;
+}
+
+static timeval difference(const timeval& after, const timeval& before) {
+    timeval result;
+    timersub(&after, &before, &result);
+    return result;
+}
+
+struct rusage usageSince(const struct rusage& before) {
+    struct rusage now;
+    getrusage(RUSAGE_THREAD, &now);
+    struct rusage used = {};
+    used.ru_utime = difference(now.ru_utime, before.ru_utime);
+    used.ru_stime = difference(now.ru_stime, before.ru_stime);
+    used.ru_maxrss = now.ru_maxrss;
+    used.ru_nvcsw = now.ru_nvcsw - before.ru_nvcsw;
+    used.ru_nivcsw = now.ru_nivcsw - before.ru_nivcsw;
+    used.ru_minflt = now.ru_minflt - before.ru_minflt;
+    used.ru_majflt = now.ru_majflt - before.ru_majflt;
+    return used;
+}
+
+StageTiming jobStageTiming(const string& command, const Job& job, size_t index) {
+    double finishedAt = job.exited[index] ? job.exitTimes[index] : monotonicSeconds();
+    return {command, job.pids[index], JobTable::exitStatus(job.statuses[index]), finishedAt - currentTiming->start,
+            job.usages[index]};
+}
+
+bool takeTimePrefix(ParsedCommand& first, TimingFormat& format) {
+    vector<string>& tokens = first.tokens;
+    if (tokens.empty() || tokens.front() != "time") return true;
+    size_t taken = 1;
+    format = TimingFormat::Table;
+    for (; taken < tokens.size(); taken++) {
+        if (tokens[taken] == "-p") format = TimingFormat::Posix;
+        else if (tokens[taken] == "-j") format = TimingFormat::Json;
+        else break;
+    }
+    if (taken == tokens.size()) {
+        cerr << "time: usage: time [-p | -j] pipeline" << endl;
+        return false;
+    }
+    tokens.erase(tokens.begin(), tokens.begin() + taken);
+    return true;
+}
+
+static string describeMemory(long kilobytes) {
+    char text[32];
+    if (kilobytes < 1024) snprintf(text, sizeof(text), "%ldK", kilobytes);
+    else if (kilobytes < 1024 * 1024) snprintf(text, sizeof(text), "%.1fM", kilobytes / 1024.0);
+    else snprintf(text, sizeof(text), "%.1fG", kilobytes / (1024.0 * 1024.0));
+    return text;
+}
+
+static string timingJson(const StageTiming& stage, bool withProcess) {
+    const struct rusage& u = stage.usage;
+    char numbers[512];
+    snprintf(numbers, sizeof(numbers),
+             "\"real\":%.6f,\"user\":%.6f,\"sys\":%.6f,\"max_rss_kb\":%ld,\"voluntary_switches\":%ld,"
+             "\"involuntary_switches\":%ld,\"minor_faults\":%ld,\"major_faults\":%ld,\"status\":%d",
+             stage.seconds, seconds(u.ru_utime), seconds(u.ru_stime), u.ru_maxrss, u.ru_nvcsw, u.ru_nivcsw,
+             u.ru_minflt, u.ru_majflt, stage.status);
+    string json = "{\"command\":\"" + jsonEscape(stage.command) + "\",";
+    if (withProcess) json += "\"pid\":" + to_string(stage.pid) + ",\"in_process\":" + (stage.pid == 0 ? "true," : "false,");
+    return json + numbers;
+}
+
+void reportTiming(const LineTiming& timing, const string& command, TimingFormat format, const string& file) {
+    // the whole line: wall time until now, everything else summed over the stages except for the peak RSS
+    StageTiming total = {command, 0, 0, monotonicSeconds() - timing.start, {}};
+    for (const StageTiming& stage : timing.stages) {
+        timeradd(&total.usage.ru_utime, &stage.usage.ru_utime, &total.usage.ru_utime);
+        timeradd(&total.usage.ru_stime, &stage.usage.ru_stime, &total.usage.ru_stime);
+        total.usage.ru_maxrss = max(total.usage.ru_maxrss, stage.usage.ru_maxrss);
+        total.usage.ru_nvcsw += stage.usage.ru_nvcsw;
+        total.usage.ru_nivcsw += stage.usage.ru_nivcsw;
+        total.usage.ru_minflt += stage.usage.ru_minflt;
+        total.usage.ru_majflt += stage.usage.ru_majflt;
+        total.status = stage.status;
+    }
+
+    string report;
+    char line[256];
+    if (format == TimingFormat::Posix) {
+        snprintf(line, sizeof(line), "real %.2f\nuser %.2f\nsys %.2f\n", total.seconds, seconds(total.usage.ru_utime),
+                 seconds(total.usage.ru_stime));
+        report = line;
+    }
+    else if (format == TimingFormat::Json) {
+        report = timingJson(total, false) + ",\"timestamp\":" + to_string(time(nullptr)) + ",\"stages\":[";
+        for (size_t i = 0; i < timing.stages.size(); i++) {
+            report += (i > 0 ? "," : "") + timingJson(timing.stages[i], true) + "}";
+        }
+        report += "]}\n";
+    }
+    else {
+        snprintf(line, sizeof(line), "%10s %9s %9s %9s %9s %9s %6s  %s\n",
+                 "real", "user", "sys", "max rss", "switches", "faults", "status", "command");
+        report = line;
+        vector<StageTiming> rows = timing.stages;
+        if (rows.size() != 1) {
+            rows.push_back(total);
+            rows.back().command = "total";
+        }
+        for (const StageTiming& row : rows) {
+            const struct rusage& u = row.usage;
+            snprintf(line, sizeof(line), "%9.3fs %8.3fs %8.3fs %9s %9ld %9ld %6d  %s\n", row.seconds,
+                     seconds(u.ru_utime), seconds(u.ru_stime), describeMemory(u.ru_maxrss).c_str(),
+                     u.ru_nvcsw + u.ru_nivcsw, u.ru_minflt + u.ru_majflt, row.status, row.command.c_str());
+            report += line;
+        }
+    }
+
+    if (file.empty()) {
+        cout.flush();
+        DataMover::writeAll(STDERR_FILENO, report.data(), report.size());
+        return;
+    }
+    int fd = open(file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0 || !DataMover::writeAll(fd, report.data(), report.size())) {
+        cerr << "shell: " << file << ": " << strerror(errno) << endl;
+    }
+    if (fd >= 0) close(fd);
+}
+
+// Runs the pipeline @commands with @run and reports what it used in @format, to @file or else to stderr. Nothing is
+// timed with the format Off, or in the background, where nobody waits for the pipeline.
+template <typename Run>
+static int runTimed(const vector<ParsedCommand>& commands, bool background, TimingFormat format, const string& file,
+                    Run run) {
+    if (format == TimingFormat::Off || background) return run();
+    LineTiming timing = {monotonicSeconds(), {}};
+    struct rusage before;
+    getrusage(RUSAGE_THREAD, &before);
+    // a pipeline timed within a timed line, like a `time` in a function, is reported on its own
+    LineTiming* outer = currentTiming;
+    currentTiming = &timing;
+    int result = run();
+    currentTiming = outer;
+    // a builtin or in-process utility: what the shell itself spent on it
+    if (timing.stages.empty() && commands.size() == 1) {
+        timing.stages.push_back({commandText(commands[0].tokens), 0, lastExitStatus, monotonicSeconds() - timing.start,
+                                 usageSince(before)});
+    }
+    string command;
+    for (const ParsedCommand& parsedCommand : commands) {
+        command += (command.empty() ? "" : " | ") + commandText(parsedCommand.tokens);
+    }
+    reportTiming(timing, command, format, file);
+    return result;
+}
+
+// timing [off | table | posix | json [file]]: reports every foreground line from now on
+void executeTiming(const vector<string>& arguments) {
+    static const vector<pair<string, TimingFormat>> modes = {
+        {"off", TimingFormat::Off}, {"table", TimingFormat::Table}, {"posix", TimingFormat::Posix}, {"json", TimingFormat::Json},
+    };
+    if (arguments.empty()) {
+        for (auto& [name, mode] : modes) {
+            if (mode == timingMode) cout << "timing " << name << (timingFile.empty() ? "" : " " + timingFile) << endl;
+        }
+        return;
+    }
+    auto it = find_if(modes.begin(), modes.end(), [&](auto& mode) { return mode.first == arguments[0]; });
+    if (it == modes.end() || arguments.size() > 2 || (arguments.size() == 2 && it->second == TimingFormat::Off)) {
+        cout << "timing: usage: timing [off | table | posix | json [file]]" << endl;
+        lastExitStatus = 2;
+        return;
+    }
+    timingMode = it->second;
+    timingFile = arguments.size() == 2 ? arguments[1] : "";
+}
+
+ResultCache resultCache;
+
+bool openResultCache() {
+    static bool opened = false;
+    if (opened) return true;
+    string directory;
+    if (const char* configured = getenv("SHELL_CACHE_DIR")) directory = configured;
+    else if (const char* xdg = getenv("XDG_CACHE_HOME")) directory = string(xdg) + "/shell/results";
+    else if (const char* home = getenv("HOME")) directory = string(home) + "/.cache/shell/results";
+    else return false;
+    uint64_t megabytes = getenv("SHELL_CACHE_MAX_MB") ? strtoull(getenv("SHELL_CACHE_MAX_MB"), nullptr, 10) : 256;
+    opened = resultCache.open(directory, megabytes << 20);
+    if (!opened) {
+        cout << "cache: " << directory << ": cannot create the cache directory" << endl;
+        lastExitStatus = 1;
+    }
+    return opened;
+}
+
+string resultCacheKey(const string& programLocation, const vector<string>& arguments,
+                      const vector<string>& variables, const vector<string>& inputs) {
+    string material = "v1";
+    auto add = [&](const string& part) {
+        material += '\0';
+        material += part;
+    };
+    add(programLocation);
+    add(to_string(arguments.size()));
+    for (const string& argument : arguments) add(argument);
+    add(filesystem::current_path().string());
+    for (const string& variable : variables) {
+        const char* value = getenv(variable.c_str());
+        add(value ? variable + "=" + value : variable + " unset");
+    }
+    for (const string& input : inputs) {
+        struct stat st;
+        if (stat(input.c_str(), &st) < 0) {
+            add(input + " missing");
+            continue;
+        }
+        add(input + " " + to_string(st.st_size) + " " + to_string(st.st_mtim.tv_sec) + "." + to_string(st.st_mtim.tv_nsec) +
+            " " + to_string(st.st_ino) + " " + to_string(st.st_dev));
+    }
+    return ResultCache::hash(material);
+}
+
+static void printCacheStats() {
+    ResultCache::Stats stats = resultCache.stats();
+    uint64_t entries, bytes;
+    resultCache.usage(entries, bytes);
+    uint64_t lookups = stats.hits + stats.misses;
+    printf("hits %llu\nmisses %llu\nhit rate %.1f%%\nentries %llu\nsize %.1f MiB of %.1f MiB\nevictions %llu\n"
+           "saved %.3f s\ndirectory %s\n",
+           (unsigned long long) stats.hits, (unsigned long long) stats.misses,
+           lookups == 0 ? 0.0 : 100.0 * stats.hits / lookups, (unsigned long long) entries, bytes / 1048576.0,
+           resultCache.limit() / 1048576.0, (unsigned long long) stats.evictions, stats.savedSeconds,
+           resultCache.directory().c_str());
+    fflush(stdout);
+}
+
+// writes a stored output to @fd; false if it vanished in the meantime
+static bool replayCachedOutput(const string& hash, int fd) {
+    int stored = resultCache.openOutput(hash);
+    if (stored < 0) return false;
+    DataMover::copy(stored, fd);
+    close(stored);
+    return true;
+}
+
+void executeCache(const vector<string>& arguments) {
+    const char* usage = "cache: usage: cache [-t seconds] [-e variable]... [-i file]... command [argument]... | --stats | --clear";
+    time_t ttl = getenv("SHELL_CACHE_TTL") ? atol(getenv("SHELL_CACHE_TTL")) : 3600;
+    vector<string> variables, inputs;
+    size_t i = 0;
+    for (; i < arguments.size() && arguments[i].starts_with("-"); i++) {
+        const string& option = arguments[i];
+        if (option == "--") {
+            i++;
+            break;
+        }
+        if ((option == "--stats" || option == "--clear") && arguments.size() == 1) {
+            if (!openResultCache()) return;
+            if (option == "--stats") printCacheStats();
+            else if (!resultCache.clear()) {
+                cout << "cache: " << resultCache.directory() << ": " << strerror(errno) << endl;
+                lastExitStatus = 1;
+            }
+            return;
+        }
+        if ((option != "-t" && option != "-e" && option != "-i") || i + 1 == arguments.size()) {
+            cout << usage << endl;
+            lastExitStatus = 2;
+            return;
+        }
+        const string& value = arguments[++i];
+        if (option == "-t") {
+            if (!isCount(value)) {
+                cout << "cache: " << value << ": invalid number of seconds" << endl;
+                lastExitStatus = 2;
+                return;
+            }
+            ttl = atol(value.c_str());
+        }
+        else if (option == "-e") variables.push_back(value);
+        else inputs.push_back(value);
+    }
+    if (i == arguments.size()) {
+        cout << usage << endl;
+        lastExitStatus = 2;
+        return;
+    }
+
+    // only programs: builtins either change the shell or cost nothing to rerun
+    vector<string> command(arguments.begin() + i, arguments.end());
+    string programLocation = isBuiltinCommand(command[0]) ? "" : programLocationInPATH(command[0]);
+    if (programLocation.empty()) {
+        cout << "cache: " << command[0] << ": not a program in PATH" << endl;
+        lastExitStatus = 127;
+        return;
+    }
+    if (!openResultCache()) return;
+
+    cout.flush();
+    string key = resultCacheKey(programLocation, command, variables, inputs);
+    ResultCache::Entry entry;
+    if (resultCache.lookup(key, ttl, entry) && replayCachedOutput(entry.stdoutHash, STDOUT_FILENO)) {
+        replayCachedOutput(entry.stderrHash, STDERR_FILENO);
+        resultCache.recordHit(entry.seconds);
+        lastExitStatus = entry.status;
+        return;
+    }
+    resultCache.recordMiss();
+
+    // the output is collected and then written out, so stdout and stderr no longer interleave as they ran
+    int capturedStdout = memfd_create("cache-stdout", MFD_CLOEXEC);
+    int capturedStderr = memfd_create("cache-stderr", MFD_CLOEXEC);
+    if (capturedStdout < 0 || capturedStderr < 0) {
+        cout << "cache: memfd_create: " << strerror(errno) << endl;
+        lastExitStatus = 1;
+        if (capturedStdout >= 0) close(capturedStdout);
+        if (capturedStderr >= 0) close(capturedStderr);
+        return;
+    }
+    // a result that depends on stdin could not be replayed
+    ProcessLauncher launcher;
+    launcher.open(STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    launcher.dup(capturedStdout, STDOUT_FILENO);
+    launcher.dup(capturedStderr, STDERR_FILENO);
+    if (jobControl) {
+        launcher.processGroup = 0;
+        launcher.terminalFd = STDIN_FILENO;
+    }
+    double start = monotonicSeconds();
+    pid_t pid = launchProgram(launcher, programLocation, vector<string>(command.begin() + 1, command.end()));
+    if (pid > 0) {
+        Job finished;
+        waitForJob(jobs.add(jobControl ? pid : 0, {pid}, commandText(command), false), &finished);
+        // a command that was interrupted or stopped did not produce its result
+        if (finished.state == JobState::Done && !WIFSIGNALED(finished.statuses[0])) {
+            entry = {time(nullptr), monotonicSeconds() - start, lastExitStatus, "", ""};
+            if (!resultCache.store(key, entry, capturedStdout, capturedStderr)) {
+                cerr << "cache: " << resultCache.directory() << ": could not store the result" << endl;
+            }
+        }
+        lseek(capturedStdout, 0, SEEK_SET);
+        lseek(capturedStderr, 0, SEEK_SET);
+        DataMover::copy(capturedStdout, STDOUT_FILENO);
+        DataMover::copy(capturedStderr, STDERR_FILENO);
+    }
+    close(capturedStdout);
+    close(capturedStderr);
+}
+
+// glob [-0] pattern...: streams the matches, unsorted, one per line or NUL-terminated
+void executeGlob(const vector<string>& arguments) {
+    size_t first = 0;
+    char separator = '\n';
+    if (!arguments.empty() && arguments[0] == "-0") {
+        separator = '\0';
+        first = 1;
+    }
+    if (first == arguments.size()) {
+        cout << "glob: usage: glob [-0] pattern..." << endl;
+        lastExitStatus = 2;
+        return;
+    }
+    size_t found = 0;
+    for (size_t i = first; i < arguments.size(); i++) {
+        bool complete = Glob(arguments[i]).expand([&](const string& match) {
+            cout << match << separator;
+            found++;
+            return bool(cout);
+        });
+        if (!complete) break;
+    }
+    cout.flush();
+    lastExitStatus = found == 0 ? 1 : 0;
+}
+
+// trace start | stop | dump <file> | status
+void executeTrace(const vector<string>& arguments) {
+    string action = arguments.empty() ? "status" : arguments[0];
+    if (action == "start" && arguments.size() == 1) {
+#ifdef SHELL_TRACING
+        if (!Tracer::start()) {
+            cout << "trace: " << strerror(errno) << endl;
+            lastExitStatus = 1;
+        }
+#else
+        cout << "trace: this shell was built without SHELL_TRACING" << endl;
+        lastExitStatus = 1;
+#endif
+    } else if (action == "stop" && arguments.size() == 1) {
+        Tracer::stop();
+    } else if (action == "dump" && arguments.size() == 2) {
+        if (Tracer::dump(arguments[1]) < 0) {
+            cout << "trace: " << arguments[1] << ": " << strerror(errno) << endl;
+            lastExitStatus = 1;
+        }
+    } else if (action == "status" && arguments.size() <= 1) {
+        cout << "tracing " << (Tracer::enabled() ? "on" : "off") << ", " << Tracer::recorded()
+             << " events recorded, the last " << Tracer::capacity() << " are kept" << endl;
+    } else {
+        cout << "trace: usage: trace start | stop | dump <file> | status" << endl;
+        lastExitStatus = 2;
+    }
+}
+
+// ---- scripts: lists, && ||, loops, if, functions
+
+static bool isAssignment(const string& word) {
+    size_t equals = word.find('=');
+    return equals != string::npos && isVariableName(string_view(word).substr(0, equals));
+}
+
+const ScriptNode* findFunction(const string& name) {
+    if (shellFunctions.empty()) return nullptr;
+    auto it = shellFunctions.find(name);
+    return it == shellFunctions.end() ? nullptr : it->second.get();
+}
+
+static bool isReservedWord(string_view word) {
+    static const vector<string_view> reserved = {"if", "then", "elif", "else", "fi", "do", "done", "while",
+                                                 "until", "for", "{", "}", "!", "function"};
+    return find(reserved.begin(), reserved.end(), word) != reserved.end();
+}
+
+// true if the line has more than a pipeline: a list, a compound command or a line still to be continued
+static bool needsInterpreter(const vector<Token>& tokens) {
+    for (size_t i = 0; i < tokens.size(); i++) {
+        const Token& token = tokens[i];
+        switch (token.kind) {
+            case TokenKind::Separator:
+            case TokenKind::And:
+            case TokenKind::Or:
+            case TokenKind::OpenParen:
+            case TokenKind::CloseParen:
+            // process substitutions start their commands afresh on every run, as the interpreter expands the words
+            case TokenKind::ProcessOutput:
+            case TokenKind::ProcessInput:
+                return true;
+            case TokenKind::Background:
+                if (i + 1 < tokens.size()) return true;
+                break;
+            case TokenKind::Pipe:
+                if (i + 1 == tokens.size()) return true;
+                break;
+            case TokenKind::Word: {
+                bool commandPosition = i == 0 || tokens[i - 1].kind == TokenKind::Pipe;
+                if (commandPosition && token.partCount == 0 && isReservedWord(token.text)) return true;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return false;
+}
+
+// where parseScript is in the tokens of a line
+typedef struct {
+    const vector<Token>& tokens;
+    const vector<WordPart>& parts;
+    size_t at;
+    string error;
+    bool incomplete;
+} ScriptParser;
+
+static shared_ptr<ScriptNode> parseList(ScriptParser& p);
+
+static const Token* peek(const ScriptParser& p) {
+    return p.at < p.tokens.size() ? &p.tokens[p.at] : nullptr;
+}
+
+// the next token is the reserved word @word; quoted or expanded it would be an ordinary word
+static bool nextIsWord(const ScriptParser& p, string_view word) {
+    const Token* token = peek(p);
+    return token != nullptr && token->kind == TokenKind::Word && token->partCount == 0 && !token->glob &&
+           token->text == word;
+}
+
+static bool nextIs(const ScriptParser& p, TokenKind kind) {
+    const Token* token = peek(p);
+    return token != nullptr && token->kind == kind;
+}
+
+// fails the parse at the next token; at the end of the line the script may just be unfinished
+static nullptr_t syntaxError(ScriptParser& p) {
+    const Token* token = peek(p);
+    if (token == nullptr) {
+        p.incomplete = true;
+        p.error = "syntax error: unexpected end of input";
+    }
+    else {
+        string unexpected = token->text == "\n" ? "newline" : string(token->text);
+        p.error = "syntax error near unexpected token `" + unexpected + "'";
+    }
+    return nullptr;
+}
+
+static bool expectWord(ScriptParser& p, string_view word) {
+    if (!nextIsWord(p, word)) return syntaxError(p), false;
+    p.at++;
+    return true;
+}
+
+// blank lines, and a ; after words like do and then, where bash wants a newline
+static void skipSeparators(ScriptParser& p) {
+    while (nextIs(p, TokenKind::Separator)) p.at++;
+}
+
+// words that end the list before them
+static bool atListEnd(const ScriptParser& p) {
+    const Token* token = peek(p);
+    if (token == nullptr || token->kind == TokenKind::CloseParen) return true;
+    for (string_view word : {"then", "elif", "else", "fi", "do", "done", "}"}) {
+        if (nextIsWord(p, word)) return true;
+    }
+    return false;
+}
+
+static bool isProcessSubstitution(TokenKind kind) {
+    return kind == TokenKind::ProcessOutput || kind == TokenKind::ProcessInput;
+}
+
+static ScriptWord scriptWord(const ScriptParser& p, const Token& token) {
+    ScriptWord word = {string(token.text), token.glob, string(token.pattern), {}, token.kind};
+    for (uint32_t i = 0; i < token.partCount; i++) {
+        const WordPart& part = p.parts[token.firstPart + i];
+        word.parts.push_back({part.kind, string(part.text), part.quoted, string(part.pattern)});
+    }
+    return word;
+}
+
+// here-documents from this size on that are used as written go into their memfd while the line is parsed,
+// straight from the line, instead of being copied into the script first
+static const size_t SEALED_HERE_DOCUMENT = 64 * 1024;
+
+// The redirection of a large here-document used as written to the file of a memfd holding it, or false if there
+// is none to be made.
+static bool sealedHereDocument(const Token& redirect, vector<pair<TokenKind, ScriptWord>>& redirections) {
+    if (redirect.text != "<<" || redirect.hereDocumentExpands || redirect.hereDocument.size() < SEALED_HERE_DOCUMENT) {
+        return false;
+    }
+    int fd = sealedMemfd(redirect.hereDocument);
+    if (fd < 0) return false;
+    // every command opens the file afresh, with an offset of its own
+    ScriptWord file = {"/dev/fd/" + to_string(fd), false, "", {}};
+    file.document = shared_ptr<const int>(new int(fd), [](const int* fd) {
+        close(*fd);
+        delete fd;
+    });
+    redirections.push_back({TokenKind::RedirectStdin, std::move(file)});
+    return true;
+}
+
+// the redirection at the next token and its file
+static bool parseRedirection(ScriptParser& p, vector<pair<TokenKind, ScriptWord>>& redirections) {
+    const Token& redirect = p.tokens[p.at++];
+    TokenKind kind = redirect.kind;
+    const Token* target = peek(p);
+    // a file can also be a process substitution, as in `< <(command)`
+    bool isFile = target != nullptr && (target->kind == TokenKind::Word ||
+                                         (isProcessSubstitution(target->kind) && kind != TokenKind::HereDocument &&
+                                          kind != TokenKind::HereString));
+    if (!isFile) {
+        // a redirection without its file isn't worth another line
+        if (target == nullptr) p.error = "syntax error near unexpected token `newline'";
+        else syntaxError(p);
+        return false;
+    }
+    if (kind != TokenKind::HereDocument || !sealedHereDocument(redirect, redirections)) {
+        redirections.push_back({kind, kind == TokenKind::HereDocument ? hereDocumentWord(redirect) : scriptWord(p, *target)});
+    }
+    p.at++;
+    return true;
+}
+
+static bool parseSimpleCommand(ScriptParser& p, ScriptCommand& command) {
+    while (const Token* token = peek(p)) {
+        if (token->kind == TokenKind::Word || isProcessSubstitution(token->kind)) {
+            command.words.push_back(scriptWord(p, *token));
+            p.at++;
+        }
+        else if (isRedirection(token->kind)) {
+            if (!parseRedirection(p, command.redirections)) return false;
+        }
+        else break;
+    }
+    if (command.words.empty()) return syntaxError(p), false;
+    return true;
+}
+
+// commands and text of a pipeline whose words are the same on every run
+static void prepareReady(ScriptNode& node) {
+    for (const ScriptCommand& stage : node.stages) {
+        for (const ScriptWord& word : stage.words) {
+            if (word.glob || !word.parts.empty() || word.kind != TokenKind::Word) return;
+        }
+        for (const auto& [kind, target] : stage.redirections) {
+            if (target.glob || !target.parts.empty() || target.kind != TokenKind::Word) return;
+        }
+    }
+    // the stages are not looked at again once the node is ready, so a here-document is moved out of them
+    for (ScriptCommand& stage : node.stages) {
+        ParsedCommand command;
+        for (const ScriptWord& word : stage.words) expandCommandWord(word, word.parts.data(), 0, command.tokens);
+        for (auto& [kind, target] : stage.redirections) {
+            vector<string> fields;
+            if (kind == TokenKind::HereDocument) fields.push_back(std::move(target.text));
+            else fields.push_back(target.text);
+            setRedirection(command, kind, fields, target.text);
+        }
+        if (!node.text.empty()) node.text += " | ";
+        for (size_t i = 0; i < command.tokens.size(); i++) node.text += (i ? " " : "") + command.tokens[i];
+        node.commands.push_back(std::move(command));
+    }
+    node.ready = true;
+}
+
+static shared_ptr<ScriptNode> makeNode(ScriptNodeKind kind, vector<shared_ptr<ScriptNode>> children = {}) {
+    auto node = make_shared<ScriptNode>();
+    node->kind = kind;
+    node->children = std::move(children);
+    return node;
+}
+
+// a list that can't be empty: the body of a loop, a branch and the like
+static shared_ptr<ScriptNode> parseBody(ScriptParser& p) {
+    shared_ptr<ScriptNode> body = parseList(p);
+    if (body == nullptr) return nullptr;
+    if (body->kind == ScriptNodeKind::Sequence && body->children.empty()) return syntaxError(p);
+    return body;
+}
+
+// if, or the elif of one, which shares the fi of the outermost
+static shared_ptr<ScriptNode> parseIf(ScriptParser& p, bool elif) {
+    p.at++;
+    shared_ptr<ScriptNode> condition = parseBody(p);
+    if (condition == nullptr || !expectWord(p, "then")) return nullptr;
+    shared_ptr<ScriptNode> then = parseBody(p);
+    if (then == nullptr) return nullptr;
+    shared_ptr<ScriptNode> node = makeNode(ScriptNodeKind::If, {condition, then});
+    if (nextIsWord(p, "elif")) {
+        shared_ptr<ScriptNode> otherwise = parseIf(p, true);
+        if (otherwise == nullptr) return nullptr;
+        node->children.push_back(otherwise);
+    }
+    else if (nextIsWord(p, "else")) {
+        p.at++;
+        shared_ptr<ScriptNode> otherwise = parseBody(p);
+        if (otherwise == nullptr) return nullptr;
+        node->children.push_back(otherwise);
+    }
+    if (!elif && !expectWord(p, "fi")) return nullptr;
+    return node;
+}
+
+// do ... done of a loop
+static shared_ptr<ScriptNode> parseLoopBody(ScriptParser& p) {
+    if (!expectWord(p, "do")) return nullptr;
+    shared_ptr<ScriptNode> body = parseBody(p);
+    if (body == nullptr || !expectWord(p, "done")) return nullptr;
+    return body;
+}
+
+// name() compound or function name [()] compound
+static bool startsFunction(const ScriptParser& p) {
+    if (nextIsWord(p, "function")) return true;
+    const Token* token = peek(p);
+    return token != nullptr && token->kind == TokenKind::Word && p.at + 1 < p.tokens.size() &&
+           p.tokens[p.at + 1].kind == TokenKind::OpenParen;
+}
+
+static bool startsCompound(const ScriptParser& p) {
+    for (string_view word : {"if", "while", "until", "for", "{"}) {
+        if (nextIsWord(p, word)) return true;
+    }
+    return nextIs(p, TokenKind::OpenParen) || startsFunction(p);
+}
+
+static shared_ptr<ScriptNode> parseCompound(ScriptParser& p) {
+    if (nextIsWord(p, "if")) return parseIf(p, false);
+
+    if (nextIsWord(p, "while") || nextIsWord(p, "until")) {
+        ScriptNodeKind kind = nextIsWord(p, "while") ? ScriptNodeKind::While : ScriptNodeKind::Until;
+        p.at++;
+        shared_ptr<ScriptNode> condition = parseBody(p);
+        if (condition == nullptr) return nullptr;
+        shared_ptr<ScriptNode> body = parseLoopBody(p);
+        if (body == nullptr) return nullptr;
+        return makeNode(kind, {condition, body});
+    }
+
+    if (nextIsWord(p, "for")) {
+        p.at++;
+        const Token* name = peek(p);
+        if (name == nullptr || name->kind != TokenKind::Word || name->partCount > 0 || !isVariableName(name->text)) {
+            if (name != nullptr && name->kind == TokenKind::Word) {
+                p.error = "`" + string(name->text) + "': not a valid identifier";
+                return nullptr;
+            }
+            return syntaxError(p);
+        }
+        shared_ptr<ScriptNode> node = makeNode(ScriptNodeKind::For);
+        node->name = name->text;
+        p.at++;
+        skipSeparators(p);
+        if (nextIsWord(p, "in")) {
+            node->hasIn = true;
+            p.at++;
+            while (nextIs(p, TokenKind::Word)) node->words.push_back(scriptWord(p, p.tokens[p.at++]));
+        }
+        skipSeparators(p);
+        shared_ptr<ScriptNode> body = parseLoopBody(p);
+        if (body == nullptr) return nullptr;
+        node->children.push_back(body);
+        return node;
+    }
+
+    if (nextIsWord(p, "{")) {
+        p.at++;
+        shared_ptr<ScriptNode> body = parseBody(p);
+        if (body == nullptr || !expectWord(p, "}")) return nullptr;
+        return makeNode(ScriptNodeKind::Group, {body});
+    }
+
+    if (nextIs(p, TokenKind::OpenParen)) {
+        p.at++;
+        shared_ptr<ScriptNode> body = parseBody(p);
+        if (body == nullptr) return nullptr;
+        if (!nextIs(p, TokenKind::CloseParen)) return syntaxError(p);
+        p.at++;
+        return makeNode(ScriptNodeKind::Subshell, {body});
+    }
+
+    // a function definition
+    bool keyword = nextIsWord(p, "function");
+    if (keyword) p.at++;
+    const Token* name = peek(p);
+    if (name == nullptr || name->kind != TokenKind::Word) return syntaxError(p);
+    if (name->partCount > 0 || name->glob || isReservedWord(name->text) || isAssignment(string(name->text))) {
+        p.error = "`" + string(name->text) + "': not a valid function name";
+        return nullptr;
+    }
+    shared_ptr<ScriptNode> node = makeNode(ScriptNodeKind::Function);
+    node->name = name->text;
+    p.at++;
+    if (nextIs(p, TokenKind::OpenParen) || !keyword) {
+        if (!nextIs(p, TokenKind::OpenParen)) return syntaxError(p);
+        p.at++;
+        if (!nextIs(p, TokenKind::CloseParen)) return syntaxError(p);
+        p.at++;
+    }
+    skipSeparators(p);
+    if (!startsCompound(p) || startsFunction(p)) return syntaxError(p);
+    shared_ptr<ScriptNode> body = parseCompound(p);
+    if (body == nullptr) return nullptr;
+    node->children.push_back(body);
+    return node;
+}
+
+// [!] command | command ..., or a compound command on its own
+static shared_ptr<ScriptNode> parsePipeline(ScriptParser& p) {
+    bool negated = nextIsWord(p, "!");
+    if (negated) p.at++;
+    if (startsCompound(p)) {
+        if (negated) {
+            p.error = "syntax error: ! only applies to pipelines of simple commands";
+            return nullptr;
+        }
+        shared_ptr<ScriptNode> compound = parseCompound(p);
+        while (compound != nullptr && peek(p) != nullptr && isRedirection(peek(p)->kind)) {
+            if (compound->kind == ScriptNodeKind::Function) break;
+            if (!parseRedirection(p, compound->redirections)) return nullptr;
+        }
+        if (compound != nullptr && nextIs(p, TokenKind::Pipe)) {
+            p.error = "syntax error: a compound command can't be piped";
+            return nullptr;
+        }
+        return compound;
+    }
+    shared_ptr<ScriptNode> node = makeNode(ScriptNodeKind::Pipeline);
+    node->negated = negated;
+    while (true) {
+        ScriptCommand command;
+        if (!parseSimpleCommand(p, command)) return nullptr;
+        node->stages.push_back(std::move(command));
+        if (!nextIs(p, TokenKind::Pipe)) break;
+        p.at++;
+        skipSeparators(p);
+        if (startsCompound(p)) {
+            p.error = "syntax error: a compound command can't be piped";
+            return nullptr;
+        }
+    }
+    prepareReady(*node);
+    return node;
+}
+
+static shared_ptr<ScriptNode> parseAndOr(ScriptParser& p) {
+    shared_ptr<ScriptNode> left = parsePipeline(p);
+    while (left != nullptr && (nextIs(p, TokenKind::And) || nextIs(p, TokenKind::Or))) {
+        ScriptNodeKind kind = nextIs(p, TokenKind::And) ? ScriptNodeKind::And : ScriptNodeKind::Or;
+        p.at++;
+        skipSeparators(p);
+        shared_ptr<ScriptNode> right = parsePipeline(p);
+        if (right == nullptr) return nullptr;
+        left = makeNode(kind, {left, right});
+    }
+    return left;
+}
+
+// commands separated by ; & and newlines, up to a word or ) that ends the list
+static shared_ptr<ScriptNode> parseList(ScriptParser& p) {
+    shared_ptr<ScriptNode> sequence = makeNode(ScriptNodeKind::Sequence);
+    while (true) {
+        skipSeparators(p);
+        if (atListEnd(p)) break;
+        shared_ptr<ScriptNode> item = parseAndOr(p);
+        if (item == nullptr) return nullptr;
+        if (nextIs(p, TokenKind::Background)) {
+            // like a line, only a pipeline can be sent to the background
+            if (item->kind != ScriptNodeKind::Pipeline) {
+                p.error = "syntax error: only a pipeline can be run in the background";
+                return nullptr;
+            }
+            item->background = true;
+            p.at++;
+        }
+        else if (nextIs(p, TokenKind::Separator)) p.at++;
+        else if (!atListEnd(p)) return syntaxError(p);
+        sequence->children.push_back(item);
+    }
+    if (sequence->children.size() == 1) return sequence->children[0];
+    return sequence;
+}
+
+shared_ptr<ScriptNode> parseScript(const vector<Token>& tokens, const vector<WordPart>& parts, string& error, bool& incomplete) {
+    TRACE_SPAN("parseScript");
+    ScriptParser p = {tokens, parts, 0, "", false};
+    shared_ptr<ScriptNode> script = parseList(p);
+    if (script != nullptr && p.at < tokens.size()) script = syntaxError(p);
+    error = p.error;
+    incomplete = p.incomplete;
+    return script;
+}
+
+// break, continue and return on their way out of the loops and function they leave
+enum class ScriptJump { None, Break, Continue, Return };
+static ScriptJump pendingJump = ScriptJump::None;
+static int jumpLevels = 0;    // loops still to leave
+static int loopDepth = 0;
+int previousExitStatus = 0;
+static int runningScripts = 0;
+static struct sigaction shellInterrupt;
+
+static const size_t MAX_FUNCTION_DEPTH = 1000;
+
+static void onScriptInterrupt(int) {
+    interruptRequested = 1;
+}
+
+// Ctrl-C stops a script rather than the shell, which is in the foreground whenever the script runs a builtin
+static void enterScript() {
+    if (runningScripts++ > 0) return;
+    interruptRequested = 0;
+    if (!jobControl) return;
+    struct sigaction interrupt = {};
+    interrupt.sa_handler = onScriptInterrupt;
+    sigemptyset(&interrupt.sa_mask);
+    sigaction(SIGINT, &interrupt, &shellInterrupt);
+}
+
+static void leaveScript() {
+    if (--runningScripts > 0) return;
+    if (jobControl) sigaction(SIGINT, &shellInterrupt, nullptr);
+    // break or continue outside of a loop and the like were reported already
+    pendingJump = ScriptJump::None;
+}
+
+static bool stopRunning() {
+    return pendingJump != ScriptJump::None || interruptRequested;
+}
+
+// after a loop's body or condition: false if the loop has to stop
+static bool continueLoop() {
+    if (interruptRequested) return false;
+    if (pendingJump == ScriptJump::Break || pendingJump == ScriptJump::Continue) {
+        bool continues = pendingJump == ScriptJump::Continue && jumpLevels == 1;
+        if (--jumpLevels == 0) pendingJump = ScriptJump::None;
+        return continues;
+    }
+    return pendingJump == ScriptJump::None;
+}
+
+// a process substitution expands to the path of its pipe, and its command starts right away; see runNode
+static bool expandScriptWord(const ScriptWord& word, vector<string>& arguments) {
+    if (word.kind != TokenKind::Word) {
+        string path;
+        if (!startProcessSubstitution(word.kind == TokenKind::ProcessOutput, word.text, path)) return false;
+        arguments.push_back(std::move(path));
+        return true;
+    }
+    return expandWord(word, word.parts.data(), word.parts.size(), arguments);
+}
+
+// the fields a redirection's word expands to; a here-string's is always one
+static bool expandRedirection(TokenKind kind, const ScriptWord& target, vector<string>& fields) {
+    if (kind != TokenKind::HereString) return expandScriptWord(target, fields);
+    fields.push_back(hereStringText(target, target.parts.data(), target.parts.size()));
+    return true;
+}
+
+// the commands of a pipeline with their words expanded; false after reporting a word that can't be
+static bool expandStages(const vector<ScriptCommand>& stages, vector<ParsedCommand>& commands, string& text) {
+    for (const ScriptCommand& stage : stages) {
+        ParsedCommand command;
+        for (const ScriptWord& word : stage.words) {
+            bool expanded = word.kind == TokenKind::Word
+                          ? expandCommandWord(word, word.parts.data(), word.parts.size(), command.tokens)
+                          : expandScriptWord(word, command.tokens);
+            if (!expanded) return false;
+        }
+        for (const auto& [kind, target] : stage.redirections) {
+            vector<string> fields;
+            if (!expandRedirection(kind, target, fields) || !setRedirection(command, kind, fields, target.text)) return false;
+        }
+        if (!text.empty()) text += " | ";
+        for (size_t i = 0; i < command.tokens.size(); i++) text += (i ? " " : "") + command.tokens[i];
+        commands.push_back(std::move(command));
+    }
+    return true;
+}
+
+static int runPipeline(const ScriptNode& node) {
+    const vector<ParsedCommand>* commands = &node.commands;
+    const string* text = &node.text;
+    vector<ParsedCommand> expanded;
+    string expandedText;
+    if (!node.ready) {
+        if (!expandStages(node.stages, expanded, expandedText)) {
+            lastExitStatus = 1;
+            return 0;
+        }
+        commands = &expanded;
+        text = &expandedText;
+    }
+    // a command that expanded to nothing, like $unset, does nothing
+    for (const ParsedCommand& command : *commands) {
+        if (!command.tokens.empty()) continue;
+        if (commands->size() > 1) {
+            cerr << "shell: " << *text << ": empty command in pipeline" << endl;
+            lastExitStatus = 1;
+            return 0;
+        }
+        lastExitStatus = 0;
+        return 0;
+    }
+
+    // `time` in front of the pipeline, the same as on a line of its own
+    TimingFormat format = TimingFormat::Off;
+    if (commands->front().tokens.front() == "time") {
+        if (commands == &node.commands) expanded = node.commands;
+        commands = &expanded;
+        if (!takeTimePrefix(expanded.front(), format)) {
+            lastExitStatus = 2;
+            return 0;
+        }
+    }
+
+    PipeSettings settings = pipeSettings;
+    if (isPipeSetting(commands->front().tokens.front())) {
+        if (commands == &node.commands) expanded = node.commands;
+        commands = &expanded;
+        if (!takePipeSettings(expanded.front(), settings)) {
+            lastExitStatus = 2;
+            return 0;
+        }
+    }
+
+    int result = runTimed(*commands, node.background, format, "", [&]() {
+        if (commands->size() == 1 && !node.background) return executeCommand(*text, *commands, 0, false);
+        executePipeline(*text, *commands, node.background, settings);
+        if (node.background) lastExitStatus = 0;
+        return 0;
+    });
+    if (node.negated) lastExitStatus = lastExitStatus == 0 ? 1 : 0;
+    return result;
+}
+
+// runs a copy of the shell for ( ... ), so that cd, variables and exit stay inside
+static void runSubshell(const ScriptNode& body) {
+    cout.flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("shell: fork");
+        lastExitStatus = 1;
+        return;
+    }
+    if (pid == 0) {
+        // the child is part of the job that runs the shell; its pipelines are not jobs of their own
+        jobControl = false;
+        struct sigaction defaultAction = {};
+        defaultAction.sa_handler = SIG_DFL;
+        sigaction(SIGINT, &defaultAction, nullptr);
+        runScript(body);
+        cout.flush();
+        exit(lastExitStatus);
+    }
+    int status = jobs.waitForPid(pid);
+    lastExitStatus = JobTable::exitStatus(status);
+    if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT) interruptRequested = 1;
+}
+
+static int runNode(const ScriptNode& node);
+
+static int runCommands(const ScriptNode& node);
+
+// runs a compound command with its streams going where its redirections say
+static int runRedirected(const ScriptNode& node) {
+    ParsedCommand streams;
+    for (const auto& [kind, target] : node.redirections) {
+        vector<string> fields;
+        if (!expandRedirection(kind, target, fields) || !setRedirection(streams, kind, fields, target.text)) {
+            lastExitStatus = 1;
+            return 0;
+        }
+    }
+    int targets[3] = {-1, -1, -1};   // for stdin, stdout and stderr
+    bool opened = openStandardInput(streams, targets[0]);
+    // the files are opened and emptied once, however often the commands inside write to them
+    const StreamRedirectionMetadata* outputs[2] = {&streams.standardOutputFile, &streams.standardErrorFile};
+    for (int stream = 1; stream < 3 && opened; stream++) {
+        const StreamRedirectionMetadata& file = *outputs[stream - 1];
+        if (file.fileName.empty()) continue;
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (file.mode == "a" ? O_APPEND : O_TRUNC);
+        targets[stream] = open(file.fileName.c_str(), flags, 0644);
+        if (targets[stream] < 0) {
+            cerr << "shell: " << file.fileName << ": " << strerror(errno) << endl;
+            opened = false;
+        }
+    }
+    if (!opened) {
+        for (int fd : targets) if (fd >= 0) close(fd);
+        lastExitStatus = 1;
+        return 0;
+    }
+
+    cout.flush();
+    cerr.flush();
+    int saved[3] = {-1, -1, -1};
+    for (int stream = 0; stream < 3; stream++) {
+        if (targets[stream] < 0) continue;
+        // kept away from the low descriptors the commands inside use, and from the programs they start
+        saved[stream] = fcntl(stream, F_DUPFD_CLOEXEC, 10);
+        dup2(targets[stream], stream);
+        close(targets[stream]);
+    }
+
+    int result = runCommands(node);
+
+    cout.flush();
+    cerr.flush();
+    for (int stream = 0; stream < 3; stream++) {
+        if (saved[stream] < 0) continue;
+        dup2(saved[stream], stream);
+        close(saved[stream]);
+    }
+    return result;
+}
+
+// the process substitutions the node's words started are done with once it has run
+static int runNode(const ScriptNode& node) {
+    size_t substitutions = processSubstitutions.size();
+    int result = node.redirections.empty() ? runCommands(node) : runRedirected(node);
+    if (processSubstitutions.size() > substitutions) finishProcessSubstitutions(substitutions, !node.background);
+    return result;
+}
+
+static int runCommands(const ScriptNode& node) {
+    switch (node.kind) {
+        case ScriptNodeKind::Pipeline:
+            return runPipeline(node);
+
+        case ScriptNodeKind::Sequence:
+        case ScriptNodeKind::Group:
+            for (const shared_ptr<ScriptNode>& child : node.children) {
+                if (runNode(*child) == -1) return -1;
+                if (stopRunning()) break;
+            }
+            return 0;
+
+        case ScriptNodeKind::And:
+        case ScriptNodeKind::Or:
+            if (runNode(*node.children[0]) == -1) return -1;
+            if (stopRunning()) return 0;
+            if ((lastExitStatus == 0) != (node.kind == ScriptNodeKind::And)) return 0;
+            return runNode(*node.children[1]);
+
+        case ScriptNodeKind::If:
+            if (runNode(*node.children[0]) == -1) return -1;
+            if (stopRunning()) return 0;
+            if (lastExitStatus == 0) return runNode(*node.children[1]);
+            if (node.children.size() > 2) return runNode(*node.children[2]);
+            lastExitStatus = 0;
+            return 0;
+
+        case ScriptNodeKind::While:
+        case ScriptNodeKind::Until: {
+            int status = 0;
+            loopDepth++;
+            while (true) {
+                if (runNode(*node.children[0]) == -1) return loopDepth--, -1;
+                if (stopRunning() && !continueLoop()) break;
+                if ((lastExitStatus == 0) != (node.kind == ScriptNodeKind::While)) break;
+                if (runNode(*node.children[1]) == -1) return loopDepth--, -1;
+                status = lastExitStatus;
+                if (!continueLoop()) break;
+            }
+            loopDepth--;
+            lastExitStatus = status;
+            return 0;
+        }
+
+        case ScriptNodeKind::For: {
+            vector<string> values;
+            if (!node.hasIn) {
+                if (!positionalParameters.empty()) values = positionalParameters.back();
+            }
+            else {
+                for (const ScriptWord& word : node.words) {
+                    if (!expandScriptWord(word, values)) {
+                        lastExitStatus = 1;
+                        return 0;
+                    }
+                }
+            }
+            int status = 0;
+            loopDepth++;
+            for (const string& value : values) {
+                assignVariable(node.name, value);
+                if (runNode(*node.children[0]) == -1) return loopDepth--, -1;
+                status = lastExitStatus;
+                if (!continueLoop()) break;
+            }
+            loopDepth--;
+            lastExitStatus = status;
+            return 0;
+        }
+
+        case ScriptNodeKind::Function:
+            shellFunctions[node.name] = node.children[0];
+            // plans made while the name meant a program or builtin are stale
+            planGeneration++;
+            lastExitStatus = 0;
+            return 0;
+
+        case ScriptNodeKind::Subshell:
+            runSubshell(*node.children[0]);
+            return 0;
+    }
+    return 0;
+}
+
+int runScript(const ScriptNode& node) {
+    TRACE_SPAN("runScript");
+    enterScript();
+    int result = runNode(node);
+    leaveScript();
+    return result;
+}
+
+int callFunction(const ScriptNode& body, const vector<string>& arguments) {
+    if (positionalParameters.size() >= MAX_FUNCTION_DEPTH) {
+        cerr << "shell: maximum function nesting level exceeded (" << MAX_FUNCTION_DEPTH << ")" << endl;
+        lastExitStatus = 1;
+        return 0;
+    }
+    enterScript();
+    positionalParameters.push_back(arguments);
+    // loops outside the function can't be left from inside it
+    int callerLoops = loopDepth;
+    loopDepth = 0;
+    int result = runNode(body);
+    loopDepth = callerLoops;
+    positionalParameters.pop_back();
+    if (pendingJump == ScriptJump::Return) pendingJump = ScriptJump::None;
+    leaveScript();
+    return result;
+}
+
+// the count of break n, continue n and return n: false after reporting a bad one
+static bool jumpArgument(const char* name, const vector<string>& arguments, int& value, bool allowZero) {
+    if (arguments.size() > 1) {
+        cout << name << ": too many arguments" << endl;
+        lastExitStatus = 2;
+        return false;
+    }
+    if (arguments.empty()) return true;
+    if (!isCount(arguments[0]) || (!allowZero && stoll(arguments[0]) == 0)) {
+        cout << name << ": " << arguments[0] << ": numeric argument required" << endl;
+        lastExitStatus = 2;
+        return false;
+    }
+    value = (int) min<long long>(stoll(arguments[0]), INT_MAX);
+    return true;
+}
+
+static void jumpOutOfLoops(const char* name, ScriptJump jump, const vector<string>& arguments) {
+    int levels = 1;
+    if (!jumpArgument(name, arguments, levels, false)) return;
+    if (loopDepth == 0) {
+        cout << name << ": only meaningful in a loop" << endl;
+        lastExitStatus = 1;
+        return;
+    }
+    pendingJump = jump;
+    jumpLevels = min(levels, loopDepth);
+}
+
+void executeBreak(const vector<string>& arguments) {
+    jumpOutOfLoops("break", ScriptJump::Break, arguments);
+}
+
+void executeContinue(const vector<string>& arguments) {
+    jumpOutOfLoops("continue", ScriptJump::Continue, arguments);
+}
+
+void executeReturn(const vector<string>& arguments) {
+    int status = previousExitStatus;
+    if (!jumpArgument("return", arguments, status, true)) return;
+    if (positionalParameters.empty()) {
+        cout << "return: can only `return' from a function" << endl;
+        lastExitStatus = 1;
+        return;
+    }
+    pendingJump = ScriptJump::Return;
+    lastExitStatus = status & 0xff;
+}
+
+static bool isBinaryTest(const string& op) {
+    static const vector<string> operators = {"=", "==", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+    return find(operators.begin(), operators.end(), op) != operators.end();
+}
+
+// Evaluates the test expression a[begin, end) the way POSIX does by the number of arguments; ! and
+// parentheses nest, -a and -o are left out for && and ||. Sets @malformed if it can't be evaluated.
+static bool evaluateTest(const vector<string>& a, size_t begin, size_t end, bool& malformed) {
+    size_t count = end - begin;
+    if (count == 0) return false;
+    bool binary = count == 3 && isBinaryTest(a[begin + 1]);
+    if (!binary && a[begin] == "!" && count > 1) return !evaluateTest(a, begin + 1, end, malformed);
+    if (!binary && a[begin] == "(" && a[end - 1] == ")" && count > 2) return evaluateTest(a, begin + 1, end - 1, malformed);
+    if (count == 1) return !a[begin].empty();
+
+    if (count == 2) {
+        const string& op = a[begin];
+        const string& operand = a[begin + 1];
+        if (op == "-n") return !operand.empty();
+        if (op == "-z") return operand.empty();
+        struct stat info;
+        bool link = op == "-L" || op == "-h";
+        bool exists = (link ? lstat(operand.c_str(), &info) : stat(operand.c_str(), &info)) == 0;
+        if (op == "-e") return exists;
+        if (op == "-f") return exists && S_ISREG(info.st_mode);
+        if (op == "-d") return exists && S_ISDIR(info.st_mode);
+        if (op == "-s") return exists && info.st_size > 0;
+        if (link) return exists && S_ISLNK(info.st_mode);
+        if (op == "-r") return access(operand.c_str(), R_OK) == 0;
+        if (op == "-w") return access(operand.c_str(), W_OK) == 0;
+        if (op == "-x") return access(operand.c_str(), X_OK) == 0;
+        cout << "test: " << op << ": unary operator expected" << endl;
+        malformed = true;
+        return false;
+    }
+
+    if (count == 3) {
+        const string& left = a[begin];
+        const string& op = a[begin + 1];
+        const string& right = a[begin + 2];
+        if (op == "=" || op == "==") return left == right;
+        if (op == "!=") return left != right;
+        if (binary) {
+            long long l, r;
+            for (auto [text, value] : {pair{&left, &l}, pair{&right, &r}}) {
+                const char* first = text->data() + (text->starts_with('-') || text->starts_with('+'));
+                auto [next, error] = from_chars(first, text->data() + text->size(), *value);
+                if (text->empty() || error != errc() || next != text->data() + text->size()) {
+                    cout << "test: " << *text << ": integer expression expected" << endl;
+                    malformed = true;
+                    return false;
+                }
+                if (text->starts_with('-')) *value = -*value;
+            }
+            if (op == "-eq") return l == r;
+            if (op == "-ne") return l != r;
+            if (op == "-lt") return l < r;
+            if (op == "-le") return l <= r;
+            if (op == "-gt") return l > r;
+            return l >= r;
+        }
+        cout << "test: " << op << ": binary operator expected" << endl;
+        malformed = true;
+        return false;
+    }
+
+    cout << "test: too many arguments" << endl;
+    malformed = true;
+    return false;
+}
+
+void executeTest(const vector<string>& arguments) {
+    bool malformed = false;
+    bool result = evaluateTest(arguments, 0, arguments.size(), malformed);
+    lastExitStatus = malformed ? 2 : result ? 0 : 1;
+}
+
+void executeBracketTest(const vector<string>& arguments) {
+    if (arguments.empty() || arguments.back() != "]") {
+        cout << "[: missing `]'" << endl;
+        lastExitStatus = 2;
+        return;
+    }
+    bool malformed = false;
+    bool result = evaluateTest(arguments, 0, arguments.size() - 1, malformed);
+    lastExitStatus = malformed ? 2 : result ? 0 : 1;
+}
+
+bool needsMoreInput(const string& input, InputContinuation& continuation) {
+    if (continuation.inHereDocument) {
+        size_t lineStart = input.rfind('\n') + 1;
+        string_view line = string_view(input).substr(lineStart);
+        if (continuation.stripTabs) line.remove_prefix(min(line.find_first_not_of('\t'), line.size()));
+        if (line != continuation.delimiter) return true;
+        continuation.inHereDocument = false;
+    }
+    if (!commandLexer.tokenize(input)) return false;
+    if (const Token* open = commandLexer.openHereDocument()) {
+        continuation = {true, string((open + 1)->text), open->text == "<<-"};
+        return true;
+    }
+    if (!needsInterpreter(commandLexer.tokens())) return false;
+    string error;
+    bool incomplete = false;
+    parseScript(commandLexer.tokens(), commandLexer.parts(), error, incomplete);
+    return incomplete;
+}
+
+string historyLine(const string& input) {
+    if (input.find('\n') == string::npos) return input;
+    // the lines of a here-document can't be joined; the history keeps the command
+    if (commandLexer.tokenize(input)) {
+        for (const Token& token : commandLexer.tokens()) {
+            if (token.kind == TokenKind::HereDocument) return input.substr(0, input.find('\n'));
+        }
+    }
+    string line;
+    for (const string& piece : splitString(input, '\n')) {
+        size_t start = piece.find_first_not_of(" \t");
+        if (start == string::npos) continue;
+        string_view trimmed = string_view(piece).substr(start);
+        if (!line.empty()) {
+            // after an operator or a word like do the command goes on; elsewhere a newline separates commands like ;
+            string_view last = string_view(line).substr(line.find_last_of(" \t") + 1);
+            bool continues = line.ends_with("|") || line.ends_with("&") || line.ends_with(";") || last == "do" ||
+                             last == "then" || last == "else" || last == "{";
+            line += continues ? " " : "; ";
+        }
+        line += trimmed;
+    }
+    return line;
+}
+
+BuiltinHandler findBuiltin(const string& command) {
+    static const unordered_map<string, BuiltinHandler> builtins = {
+        {"echo", executeEcho},
+        {"type", executeType},
+        {"pwd", [](const vector<string>&) { executePwd(); }},
+        {"cd", executeCd},
+        {"history", executeHistory},
+        {"hash", executeHash},
+        {"jobs", executeJobs},
+        {"fg", executeFg},
+        {"bg", executeBg},
+        {"wait", executeWait},
+        {"kill", executeKill},
+        {"parallel", executeParallel},
+        {"pipeconf", executePipeconf},
+        {"timing", executeTiming},
+        {"trace", executeTrace},
+        {"cache", executeCache},
+        {"glob", executeGlob},
+        {"test", executeTest},
+        {"[", executeBracketTest},
+        {":", [](const vector<string>&) {}},
+        {"break", executeBreak},
+        {"continue", executeContinue},
+        {"return", executeReturn},
+    };
+    auto it = builtins.find(command);
+    return it == builtins.end() ? nullptr : it->second;
+}
+
+// returns -1 if the REPL has to exit;
+int executeCommand(const string& input, const vector<ParsedCommand>& parsedCommands, int commandIndex, bool isForkedProcess) {
+    TRACE_SPAN("executeCommand");
+    // child process
+    const ParsedCommand &parsedCommand = parsedCommands[commandIndex];
+    const vector<string>& tokens = parsedCommand.tokens;
+
+
+    if (tokens.empty()) return 0;
+
+    // name=value words on their own set variables
+    if (isAssignment(tokens[0]) && all_of(tokens.begin(), tokens.end(), isAssignment)) {
+        for (const string& token : tokens) {
+            size_t equals = token.find('=');
+            assignVariable(token.substr(0, equals), token.substr(equals + 1));
+        }
+        lastExitStatus = 0;
+        return 0;
+    }
+
+    // functions go before builtins and programs of the same name
+    const ScriptNode* function = findFunction(tokens[0]);
+    FastUtilityCall fastUtility;
+    bool runsFastUtility = function == nullptr && parseFastUtility(tokens, fastUtility);
+    // one reading the terminal is spawned like any program, in a process group of its own, so that Ctrl-C and
+    // Ctrl-Z reach it rather than the shell
+    if (runsFastUtility && !isForkedProcess && fastUtilityReadsStdin(fastUtility) &&
+        parsedCommand.standardInputFile.mode.empty() && isatty(STDIN_FILENO)) {
+        runsFastUtility = false;
+    }
+    int inputFd;
+    if (!openStandardInput(parsedCommand, inputFd)) {
+        lastExitStatus = 1;
+        return 0;
+    }
+
+    // external programs started by the shell itself get their redirections as spawn file actions,
+    // so the shell's own stdout/stderr are left alone
+    if (!isForkedProcess && function == nullptr && !isBuiltinCommand(tokens[0]) && !runsFastUtility) {
+        string programLocation = programLocationInPATH(tokens[0]);
+        if (!programLocation.empty()) {
+            ProcessLauncher launcher;
+            addRedirections(launcher, parsedCommand);
+            if (inputFd >= 0) launcher.dup(inputFd, STDIN_FILENO);
+            if (jobControl) {
+                launcher.processGroup = 0;
+                launcher.terminalFd = STDIN_FILENO;
+            }
+            pid_t pid = launchProgram(launcher, programLocation, vector<string>(tokens.begin() + 1, tokens.end()));
+            if (inputFd >= 0) close(inputFd);
+            waitInForeground(input, tokens, pid);
+            return 0;
+        }
+    }
+
+    // for (auto &t: tokens) cout << "token - " << t << endl;
+    // cout << "standardOutputFile: " << parsedCommand.standardOutputFile << endl;
+    // cout << "standardErrorFile: " << parsedCommand.standardErrorFile << endl;
+
+    TRACE_BEGIN(redirectSpan, "redirect");
+    // most commands in a script redirect nothing, and then there is nothing to save and restore
+    bool redirects = !parsedCommand.standardOutputFile.fileName.empty() ||
+                     !parsedCommand.standardErrorFile.fileName.empty() || inputFd >= 0;
+    int default_stdout = redirects ? dup(STDOUT_FILENO) : -1;
+    int default_stderr = redirects ? dup(STDERR_FILENO) : -1;
+    int default_stdin = inputFd >= 0 ? dup(STDIN_FILENO) : -1;
+
+    if (inputFd >= 0) {
+        dup2(inputFd, STDIN_FILENO);
+        close(inputFd);
+    }
+
+    if (!parsedCommand.standardOutputFile.fileName.empty()) {
+        // we need to point stdout to a file...
+
+        int fd;
+
+        if (parsedCommand.standardOutputFile.mode == "w") {
+            fd = open(parsedCommand.standardOutputFile.fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                      0644);
+        } else if (parsedCommand.standardOutputFile.mode == "a") {
+            fd = open(parsedCommand.standardOutputFile.fileName.c_str(), O_WRONLY | O_CREAT | O_APPEND,
+                      0644);
+        } else {
+            cerr << "Something went wrong...Invalid file mode" << endl;
+            exit(1);
+        }
+
+        if (fd < 0) {
+            cerr << "Error while opening stdout file..." << endl;
+            exit(1);
+        }
+        if (dup2(fd, STDOUT_FILENO) < 0) {
+            cerr << "Error while dup2 on stdout file..." << endl;
+            exit(1);
+        }
+        close(fd);
+    }
+
+    if (!parsedCommand.standardErrorFile.fileName.empty()) {
+        // we need to point stdout to a file...
+
+        int fd;
+
+        if (parsedCommand.standardErrorFile.mode == "w") {
+            fd = open(parsedCommand.standardErrorFile.fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        } else if (parsedCommand.standardErrorFile.mode == "a") {
+            fd = open(parsedCommand.standardErrorFile.fileName.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        } else {
+            cerr << "Something went wrong...Invalid file mode" << endl;
+            exit(1);
+        }
+
+        if (fd < 0) {
+            cerr << "Error while opening stderr file..." << endl;
+            exit(1);
+        }
+        if (dup2(fd, STDERR_FILENO) < 0) {
+            cerr << "Error while dup2 on stderr file..." << endl;
+            exit(1);
+        }
+        close(fd);
+    }
+    TRACE_END(redirectSpan);
+
+
+    const string &command = tokens[0];
+    vector<string> arguments(tokens.begin() + 1, tokens.end());
+    BuiltinHandler builtin = function == nullptr ? findBuiltin(command) : nullptr;
+    bool builtInCommandFound = builtin != nullptr || (function == nullptr && command == "exit");
+
+    bool executeProgramInPath = !runsFastUtility && function == nullptr;
+    int result = 0;
+
+    if (runsFastUtility) {
+        lastExitStatus = 0;
+        executeFastUtility(fastUtility);
+    }
+
+    if (function != nullptr) {
+        result = callFunction(*function, arguments);
+    }
+
+    if (builtInCommandFound) {
+        executeProgramInPath = false;
+        previousExitStatus = lastExitStatus;
+        lastExitStatus = 0;
+
+        if (command == "exit") {
+            // exit N leaves with N, a bare exit with the status of the command before it
+            lastExitStatus = previousExitStatus;
+            if (!arguments.empty()) {
+                char* end;
+                long status = strtol(arguments[0].c_str(), &end, 10);
+                if (arguments[0].empty() || *end != '\0') {
+                    cerr << "shell: exit: " << arguments[0] << ": numeric argument required" << endl;
+                    status = 2;
+                }
+                lastExitStatus = status & 0xff;
+            }
+            return -1;
+        }
+
+        builtin(arguments);
+    }
+
+    if (executeProgramInPath) {
+        // searching for executable
+        string programLocation = programLocationInPATH(command);
+        if (!programLocation.empty()) {
+            executeProgram(programLocation, arguments, !isForkedProcess);
+        } else {
+            cout << input << ": command not found" << endl;
+            lastExitStatus = 127;
+        }
+    }
+
+
+    if (!redirects) return result;
+
+    // output may be buffered in batch mode; it belongs to the redirection target
+    TRACE_SPAN("restoreRedirect");
+    cout.flush();
+    dup2(default_stdout, STDOUT_FILENO);
+    close(default_stdout);
+
+    dup2(default_stderr, STDERR_FILENO);
+    close(default_stderr);
+
+    if (default_stdin >= 0) {
+        dup2(default_stdin, STDIN_FILENO);
+        close(default_stdin);
+    }
+
+    return result;
+}
+
+
+// runs commands connected via pipe as one job and waits for it unless it goes to the background. external programs
+// are spawned, side-effect free builtins run in the shell process and the remaining builtins in forked children.
+void executePipeline(const string& input, const vector<ParsedCommand>& parsedCommands, bool background,
+                     const PipeSettings& settings) {
+    TRACE_SPAN("executePipeline");
+    int totalCommands = parsedCommands.size();
+    int totalPipes = (int) totalCommands - 1;
+
+    // nobody waits for a background job, so it is neither metered nor sampled
+    PipeSettings channelSettings = settings;
+    if (background) {
+        channelSettings.stats = false;
+        channelSettings.autoGrow = false;
+    }
+    shared_ptr<PipeMonitor> monitor = make_shared<PipeMonitor>(channelSettings);
+
+    vector<vector<int>> pipes(totalPipes, vector<int>({0, 0}));
+    for (int p = 0; p < totalPipes; p++) {
+        // close-on-exec, so that spawned stages only keep the ends they were given as stdin/stdout
+        if (!monitor->open(pipes[p].data())) {
+            cerr << "shell: pipe: " << strerror(errno) << endl;
+            for (int opened = 0; opened < p; opened++) {
+                close(pipes[opened][0]);
+                close(pipes[opened][1]);
+            }
+            return;
+        }
+    }
+    /*
+     total commands = 3; total pipes = 2;
+      command 0:
+          stdin remains intact
+          stdout goes to pipes[0][1]
+      command 1:
+          stdin is pipes[0][0];
+          stdout goes to pipes[1][1]
+      command 2(last command):
+          stdin is pipes[1][0];
+          stdout remains intact
+
+    So, for command n,
+
+        if(n==0) {
+            // stdin remains intact
+            // stdout goes to pipes[0][1];
+        }
+        else if(n < commands.size-1) {
+            // stdin is pipes[n-1][0];
+            // stdout is pipes[n][1];
+        }
+        if(n == commands.size()-1){
+            // stdin is pipes[n-1][0];
+            // stdout remains intact
+        }
+     */
+
+    vector<pid_t> pids;
+    vector<pid_t> stagePids(totalCommands, -1);
+    vector<int> inProcessStages;
+    // the first process started leads the pipeline's process group, the others join it
+    pid_t processGroup = jobControl ? 0 : -1;
+
+    for (int subcommand = 0; subcommand < totalCommands; subcommand++) {
+        const string& subcommandName = parsedCommands[subcommand].tokens.front();
+
+        // side-effect free builtins run inside the shell once every other stage is started, see below.
+        // a background job must not hold up the shell, so there every stage gets a process of its own.
+        if (!background && runsInProcessInPipeline(parsedCommands[subcommand].tokens)) {
+            inProcessStages.push_back(subcommand);
+            continue;
+        }
+
+        // external programs are spawned straight from the shell, with the pipe ends wired up as file actions
+        ProcessLauncher launcher;
+        launcher.processGroup = processGroup;
+        if (jobControl && !background) launcher.terminalFd = STDIN_FILENO;
+
+        FastUtilityCall fastUtility;
+        bool forkShell = isBuiltinCommand(subcommandName) || findFunction(subcommandName) != nullptr ||
+                         parseFastUtility(parsedCommands[subcommand].tokens, fastUtility);
+        string programLocation = forkShell ? "" : programLocationInPATH(subcommandName);
+        if (!programLocation.empty()) {
+            if (subcommand > 0) {
+                launcher.dup(pipes[subcommand-1][0], STDIN_FILENO);
+            }
+            if (subcommand < totalCommands-1) {
+                launcher.dup(pipes[subcommand][1], STDOUT_FILENO);
+            }
+            addRedirections(launcher, parsedCommands[subcommand]);
+            // < and here-documents take the place of the pipe from the stage before
+            int inputFd;
+            if (!openStandardInput(parsedCommands[subcommand], inputFd)) {
+                lastExitStatus = 1;
+                continue;
+            }
+            if (inputFd >= 0) launcher.dup(inputFd, STDIN_FILENO);
+
+            const vector<string>& tokens = parsedCommands[subcommand].tokens;
+            pid_t pid = launchProgram(launcher, programLocation, vector<string>(tokens.begin() + 1, tokens.end()));
+            if (inputFd >= 0) close(inputFd);
+            if (pid > 0) {
+                pids.push_back(pid);
+                stagePids[subcommand] = pid;
+                if (processGroup == 0) processGroup = pid;
+            }
+            continue;
+        }
+
+        // builtins, cat/head/tee/wc reading stdin and unknown commands run in a forked copy of the shell
+        cout.flush();
+        TRACE_BEGIN(forkSpan, "fork");
+        pid_t pid = fork();
+        TRACE_END(forkSpan);
+        if (pid == 0) {
+            launcher.enterProcessGroup();
+
+            // used to track all the used pipe file descriptors
+            unordered_map<int, unordered_set<int>> usedPipeFds;
+
+            if (totalPipes == 0) {
+                // a single command sent to the background: stdin and stdout remain intact
+            }
+            else if (subcommand == 0) {
+                // stdin remains intact;
+                dup2(pipes[0][1], STDOUT_FILENO);
+                usedPipeFds[0].insert(1);
+            }
+            else if (subcommand < totalCommands-1) {
+                dup2(pipes[subcommand-1][0], STDIN_FILENO);
+                dup2(pipes[subcommand][1], STDOUT_FILENO);
+
+                usedPipeFds[subcommand-1].insert(0);
+                usedPipeFds[subcommand].insert(1);
+            }
+            else {
+                dup2(pipes[subcommand-1][0], STDIN_FILENO);
+                usedPipeFds[subcommand-1].insert(0);
+                // stdout remains intact
+            }
+
+            // close all the pipes this process won't interact with at all
+            for (int p=0; p<totalPipes; p++) {
+                if (!usedPipeFds[p].count(0)) {
+                    close(pipes[p][0]);
+                }
+                if (!usedPipeFds[p].count(1)) {
+                    close(pipes[p][1]);
+                }
+            }
+            for (int fd : monitor->relayedEnds()) close(fd);
+            
+            executeCommand(input, parsedCommands, subcommand);
+
+            if (totalPipes == 0) {
+                // no pipe ends to close
+            }
+            else if (subcommand == 0) {
+                close(pipes[0][1]);
+            }
+            else if (subcommand < totalCommands - 1) {
+                close(pipes[subcommand-1][0]);
+                close(pipes[subcommand][1]);
+            }
+            else {
+                close(pipes[subcommand-1][0]);
+            }
+            exit(lastExitStatus);
+        }
+        if (pid < 0) {
+            perror("fork failed");
+        }
+        else {
+            if (processGroup >= 0) setpgid(pid, processGroup == 0 ? pid : processGroup);
+            pids.push_back(pid);
+            stagePids[subcommand] = pid;
+            if (processGroup == 0) processGroup = pid;
+        }
+    }
+
+    // $? is the last stage's. One without a process to wait for, that runs in the shell below or could not be
+    // started, sets it itself.
+    int lastStageStatus = lastExitStatus;
+
+    // every stage is started, so the monitor's thread and its copies of the read ends stay in the shell
+    for (int p=0; p<totalPipes; p++) monitor->watch(pipes[p][0], stagePids[p+1]);
+    monitor->start();
+
+    // Closing the parent's pipe file descriptors ensures proper piping behavior, allowing EOF to be detected at the read end.
+    // Builtins never read stdin, so the shell only keeps the write ends of the in-process stages.
+    for (int p=0; p<totalPipes; p++) {
+        close(pipes[p][0]);
+        if (find(inProcessStages.begin(), inProcessStages.end(), p) == inProcessStages.end()) {
+            close(pipes[p][1]);
+        }
+    }
+
+    Job* job = nullptr;
+    if (!pids.empty()) {
+        job = &jobs.add(max(processGroup, 0), pids, jobCommandText(input), background);
+        if (background) {
+            if (jobControl) cout << "[" << job->id << "] " << pids.back() << endl;
+            return;
+        }
+    }
+
+    // stages in pipeline order, pid -1 for those that never ran
+    vector<StageTiming> stageTimings(totalCommands, StageTiming{"", -1, 0, 0, {}});
+    auto reportStageTimings = [&]() {
+        if (currentTiming == nullptr) return;
+        for (StageTiming& stage : stageTimings) {
+            if (stage.pid >= 0) currentTiming->stages.push_back(stage);
+        }
+    };
+
+    if (!inProcessStages.empty()) {
+        // every reader is running (or gone) by now, so writing can't block forever. With the shell's read ends
+        // closed, writing to a stage that exited fails with EPIPE, which must not kill the shell.
+        struct sigaction ignorePipe = {}, previousPipe;
+        ignorePipe.sa_handler = SIG_IGN;
+        sigaction(SIGPIPE, &ignorePipe, &previousPipe);
+
+        for (int subcommand: inProcessStages) {
+            bool writesToPipe = subcommand < totalCommands-1;
+            int savedStdout = -1;
+            if (writesToPipe) {
+                savedStdout = dup(STDOUT_FILENO);
+                dup2(pipes[subcommand][1], STDOUT_FILENO);
+                close(pipes[subcommand][1]);
+            }
+
+            struct rusage before;
+            getrusage(RUSAGE_THREAD, &before);
+            executeCommand(input, parsedCommands, subcommand, false);
+            cout.flush();
+            cout.clear();
+            if (subcommand == totalCommands-1) lastStageStatus = lastExitStatus;
+            if (currentTiming != nullptr) {
+                stageTimings[subcommand] = {commandText(parsedCommands[subcommand].tokens), 0, lastExitStatus,
+                                            monotonicSeconds() - currentTiming->start, usageSince(before)};
+            }
+
+            if (writesToPipe) {
+                // restoring stdout drops the last reference to the write end, so the next stage sees EOF
+                dup2(savedStdout, STDOUT_FILENO);
+                close(savedStdout);
+            }
+        }
+
+        sigaction(SIGPIPE, &previousPipe, nullptr);
+    }
+
+
+    if (job != nullptr) {
+        int id = job->id;
+        Job finished;
+        waitForJob(*job, &finished);
+        if (stagePids[totalCommands-1] < 0 && finished.state == JobState::Done) lastExitStatus = lastStageStatus;
+        for (int subcommand = 0; currentTiming != nullptr && subcommand < totalCommands; subcommand++) {
+            auto it = find(finished.pids.begin(), finished.pids.end(), stagePids[subcommand]);
+            if (it == finished.pids.end()) continue;
+            stageTimings[subcommand] = jobStageTiming(commandText(parsedCommands[subcommand].tokens), finished,
+                                                      it - finished.pids.begin());
+        }
+        if (jobs.find(id) != nullptr) {
+            reportStageTimings();
+            monitor->abandon();
+            return;
+        }
+    }
+    if (job == nullptr) lastExitStatus = lastStageStatus;
+    reportStageTimings();
+    monitor->finish();
+    if (channelSettings.stats) printPipelineStats(parsedCommands, monitor->stats());
+}
+
+// lines longer than this are mostly here-documents; a cached plan would keep the text twice over, once as the
+// key and once in the plan, and hashing it costs about as much as parsing it again
+static const size_t MAX_CACHED_LINE = 64 * 1024;
+
+shared_ptr<const CommandPlan> planLine(const string& input) {
+    bool cacheableLength = input.size() <= MAX_CACHED_LINE;
+    shared_ptr<const CommandPlan> cached = cacheableLength ? commandPlans.find(input, PATH, planGeneration) : nullptr;
+    if (cached != nullptr) {
+        // the program may have been removed, or another one of the name put earlier in PATH; the hash table
+        // notices from the mtimes of the PATH directories
+        if (cached->programLocation.empty() ||
+            programLocationInPATH(cached->commands[0].tokens[0]) == cached->programLocation) {
+            return cached;
+        }
+        commandPlans.forget(input);
+    }
+
+    TRACE_SPAN("planLine");
+    auto plan = make_shared<CommandPlan>();
+    if (!commandLexer.tokenize(input)) {
+        cerr << "shell: " << commandLexer.error() << endl;
+        return nullptr;
+    }
+    const vector<Token>& lineTokens = commandLexer.tokens();
+    // lists and compound commands are parsed into a script once; its words are expanded as it runs
+    if (needsInterpreter(lineTokens)) {
+        string error;
+        bool incomplete;
+        plan->script = parseScript(lineTokens, commandLexer.parts(), error, incomplete);
+        if (plan->script == nullptr) {
+            cerr << "shell: " << error << endl;
+            return nullptr;
+        }
+        if (cacheableLength) commandPlans.store(input, plan, PATH, planGeneration);
+        return plan;
+    }
+    plan->commands = parseTokens(lineTokens, commandLexer.parts(), plan->runInBackground);
+    if (plan->commands.empty()) return nullptr;
+    // matches of a pattern change with the files and values with the variables, so such lines are parsed
+    // afresh every time
+    bool cacheable = cacheableLength && none_of(lineTokens.begin(), lineTokens.end(),
+                             [](const Token& token) { return token.glob || token.partCount > 0; });
+
+    ParsedCommand& first = plan->commands.front();
+    plan->timePrefix = !first.tokens.empty() && first.tokens.front() == "time";
+    plan->prefixFormat = TimingFormat::Off;
+    if (!takeTimePrefix(first, plan->prefixFormat)) return nullptr;
+    plan->settings = pipeSettings;
+    size_t words = first.tokens.size();
+    if (!takePipeSettings(first, plan->settings)) return nullptr;
+    // settings in front of the line are on top of the pipeconf defaults of the moment
+    plan->ownSettings = first.tokens.size() != words;
+    cacheable = cacheable && !plan->ownSettings;
+
+    FastUtilityCall fastUtility;
+    const vector<string>& tokens = first.tokens;
+    // stdin redirections are opened afresh for every run, by executeCommand
+    if (plan->commands.size() == 1 && !plan->runInBackground && !tokens.empty() && first.standardInputFile.mode.empty() &&
+        !isBuiltinCommand(tokens[0]) &&
+        findFunction(tokens[0]) == nullptr && !isAssignment(tokens[0]) && !parseFastUtility(tokens, fastUtility)) {
+        plan->programLocation = programLocationInPATH(tokens[0]);
+    }
+    if (!plan->programLocation.empty()) {
+        plan->argv.push_back(filesystem::path(plan->programLocation).filename().string());
+        plan->argv.insert(plan->argv.end(), tokens.begin() + 1, tokens.end());
+        for (const string& arg : plan->argv) plan->argvPointers.push_back(const_cast<char*>(arg.c_str()));
+        plan->argvPointers.push_back(nullptr);
+        addRedirections(plan->launcher, first);
+    }
+
+    if (cacheable) commandPlans.store(input, plan, PATH, planGeneration);
+    return plan;
+}
+
+int executeLine(const string& input) {
+    TRACE_SPAN("executeLine");
+    shared_ptr<const CommandPlan> plan = planLine(input);
+    if (plan == nullptr) {
+        return 0;
+    }
+    if (plan->script != nullptr) return runScript(*plan->script);
+    const vector<ParsedCommand>& parsedCommands = plan->commands; // parsedCommands are connected via pipe
+    int totalCommands = parsedCommands.size();
+    bool runInBackground = plan->runInBackground;
+    TimingFormat format = plan->timePrefix ? plan->prefixFormat : timingMode;
+    const PipeSettings& settings = plan->ownSettings ? plan->settings : pipeSettings;
+
+    return runTimed(parsedCommands, runInBackground, format, plan->timePrefix ? "" : timingFile, [&]() {
+        if (!plan->programLocation.empty()) {
+            // straight to the launch: argv and redirections are ready
+            ProcessLauncher launcher = plan->launcher;
+            if (jobControl) {
+                launcher.processGroup = 0;
+                launcher.terminalFd = STDIN_FILENO;
+            }
+            waitInForeground(input, parsedCommands[0].tokens,
+                             startProgram(launcher, plan->programLocation, plan->argv, plan->argvPointers.data()));
+            return 0;
+        }
+        if (totalCommands == 1 && !runInBackground) return executeCommand(input, parsedCommands, 0, false);
+        executePipeline(input, parsedCommands, runInBackground, settings);
+        return 0;
+    });
+}
+
+int executeScript(LineReader& reader) {
+    // nothing is typed interactively, so builtin output is written once per line instead of once per <<
+    cout << nounitbuf;
+
+    string_view line;
+    string input;
+    InputContinuation continuation;
+    while (reader.nextLine(line)) {
+        // a compound command, a here-document or a list ending in | && || goes on on the next lines
+        if (input.empty()) input = line;
+        else input.append("\n").append(line);
+        if (needsMoreInput(input, continuation)) continue;
+        commandHistory.add(historyLine(input));
+
+        int result = executeLine(input);
+        input.clear();
+        cout.flush();
+        if (result == -1) break;
+    }
+    // the script ended inside one: executeLine reports it
+    if (!input.empty()) executeLine(input);
+
+    cout << unitbuf;
+    return lastExitStatus;
+}
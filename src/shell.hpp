@@ -0,0 +1,386 @@
+#ifndef SHELL_HPP
+#define SHELL_HPP
+#include <vector>
+#include <string>
+#include <termios.h>
+#include <sys/resource.h>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <csignal>
+
+#include "utils/Trie.cpp"
+#include "utils/CommandHashTable.cpp"
+#include "utils/ExecutableIndex.cpp"
+#include "utils/CompletionWorker.cpp"
+#include "utils/Lexer.cpp"
+#include "utils/ProcessLauncher.cpp"
+#include "utils/LineReader.cpp"
+#include "utils/TerminalSession.cpp"
+#include "utils/HistoryStore.cpp"
+#include "utils/JobTable.cpp"
+#include "utils/ForkServer.cpp"
+#include "utils/DataMover.cpp"
+#include "utils/PipeMonitor.cpp"
+#include "utils/Tracer.cpp"
+#include "utils/ResultCache.cpp"
+#include "utils/Glob.cpp"
+#include "utils/CommandPlanCache.cpp"
+
+using namespace std;
+
+typedef struct {
+    string fileName;
+    string mode;
+} StreamRedirectionMetadata;
+
+typedef struct {
+    vector<string> tokens;
+    StreamRedirectionMetadata standardOutputFile;
+    StreamRedirectionMetadata standardErrorFile;
+    // mode "r" for < file, "text" for a here-document or here-string, whose text is inputText; "" if none
+    StreamRedirectionMetadata standardInputFile;
+    string inputText;
+} ParsedCommand;
+
+extern vector<string> permissibleCommands;
+extern vector<string> commandSuggestions;
+extern string PATH;
+extern CommandHashTable commandHashTable;
+extern CompletionWorker completionWorker;
+extern TerminalSession terminal;
+extern Lexer commandLexer;
+extern HistoryStore commandHistory;
+extern JobTable jobs;
+extern ForkServer forkServer;
+extern bool jobControl;
+extern pid_t shellProcessGroup;
+// of the last foreground command: its exit code, 128+n if signal n ended or stopped it, 127 if not found
+extern int lastExitStatus;
+// set when Ctrl-C ended a foreground job or reached the shell while a script ran; the script stops
+extern volatile sig_atomic_t interruptRequested;
+
+vector<string> splitString(const string& s, char delimiter);
+
+// appends the sorted paths the glob @pattern matches, or @text, the word it came from, if none; false after
+// reporting it if there are too many to pass to a program
+bool expandGlob(string_view pattern, string_view text, vector<string>& arguments);
+
+// splits the line into commands connected via pipe. On a syntax error, reports it and returns no commands.
+vector<ParsedCommand> parseInput(const string& s);
+// same, and sets @runInBackground if the line ends with `&`
+vector<ParsedCommand> parseInput(const string& s, bool& runInBackground);
+
+vector<string> directoriesInPath();
+
+// returns the absolute path of the program if found, else "";
+string programLocationInPATH(const string& program, bool countHit=true);
+
+bool isBuiltinCommand(const string& command);
+
+// builtins that neither read stdin nor change the shell's state; in a pipeline they run in the shell process
+bool runsInProcessInPipeline(const vector<string>& tokens);
+
+void executeEcho(const vector<string>& arguments);
+void executeType(const vector<string>& arguments);
+void executeHash(const vector<string>& arguments);
+void executePwd();
+void executeCd(const std::vector<std::string>& arguments);
+void initializeHistory();
+void printHistoryEntry(uint64_t sequence);
+void executeHistory(const vector<string>& arguments);
+
+void executeProgramWithoutFork(const std::string& programLocation, const std::vector<std::string>& arguments, bool doFork=false);
+void executeProgram(const std::string& programLocation, const std::vector<std::string>& arguments, bool doFork=false);
+
+// adds the command's stdout/stderr redirections to the file actions of the launcher
+void addRedirections(ProcessLauncher& launcher, const ParsedCommand& parsedCommand);
+// sets @fd to what the command's stdin is redirected to: the file of <, or a sealed memfd with the text of a
+// here-document or here-string; -1 if it isn't. false after reporting a file that can't be opened.
+bool openStandardInput(const ParsedCommand& parsedCommand, int& fd);
+
+// starts the program with argv[0] set to its file name. returns its pid, or -1 after reporting why it could not run.
+pid_t launchProgram(const ProcessLauncher& launcher, const string& programLocation, const vector<string>& arguments);
+
+// waits for a child that was started outside of any job
+void waitForProcess(pid_t pid);
+
+void initializeJobControl();
+// starts the fork server if SHELL_LAUNCHER=server
+void initializeForkServer();
+string jobCommandText(const string& input);
+string describeJobState(const Job& job);
+void printJob(const Job& job, bool withPids);
+// waits for a job in the foreground; returns its exit status. @finished gets a copy of the job as it was
+// when the wait ended, since a finished job is dropped from the table.
+int waitForJob(Job& job, Job* finished=nullptr);
+void notifyJobChanges();
+Job* findJob(const string& builtin, const string& spec);
+void signalJob(const Job& job, int sig);
+int parseSignal(string name);
+void executeJobs(const vector<string>& arguments);
+void executeFg(const vector<string>& arguments);
+void executeBg(const vector<string>& arguments);
+void executeWait(const vector<string>& arguments);
+void executeKill(const vector<string>& arguments);
+
+typedef struct {
+    int maxJobs;        // children running at the same time
+    bool haltOnError;   // start nothing new once a job failed
+    bool keepOrder;     // print output in input order instead of completion order
+    bool summary;       // report throughput on stderr when done
+} ParallelOptions;
+
+typedef struct {
+    size_t started;
+    size_t succeeded;
+    size_t failed;
+    double seconds;
+} ParallelSummary;
+
+int availableCpus();
+void copyFileToFd(int from, int to);
+bool substitutePlaceholders(string& text, const string& line, size_t jobNumber);
+// runs the command template once per line returned by @nextInput, with bounded concurrency
+ParallelSummary runParallel(const string& commandTemplate, const ParallelOptions& options, const function<bool(string&)>& nextInput);
+void executeParallel(const vector<string>& arguments);
+
+void printTermios(const termios& t);
+string findLongestPrefix(vector<string> strs);
+// what the completion worker needs to complete @line: the line, PATH and the working directory
+CompletionRequest completionRequest(const string& line);
+string collectInput();
+// set when collectInput returned "exit" for Ctrl-D on an empty line or the end of input
+extern bool inputEnded;
+// set when collectInput returned "" because Ctrl-C threw the line away
+extern bool inputInterrupted;
+
+typedef struct {
+    string name;            // cat, head, tee or wc
+    vector<string> files;   // "-" is stdin
+    bool countLines;        // wc -l
+    bool countBytes;        // wc -c
+    bool headBytes;         // head -c instead of -n
+    uint64_t count;         // head
+    bool append;            // tee -a
+} FastUtilityCall;
+
+extern bool fastUtilities;
+// recognizes the cat/head/tee/wc invocations handled in-process; anything else goes to the program in PATH
+bool parseFastUtility(const vector<string>& tokens, FastUtilityCall& call);
+bool fastUtilityReadsStdin(const FastUtilityCall& call);
+int openFastUtilityInput(const FastUtilityCall& call, const string& file);
+void reportFastUtilityError(const FastUtilityCall& call);
+void executeFastUtility(const FastUtilityCall& call);
+
+// defaults for the channels of every pipeline, changed with `pipeconf` and overridden per pipeline by
+// PIPE_SIZE=, PIPE_TRANSPORT= and PIPE_STATS= words in front of its first command
+extern PipeSettings pipeSettings;
+bool isPipeSetting(const string& word);
+// applies one NAME=value word; false if the value is invalid
+bool applyPipeSetting(const string& word, PipeSettings& settings);
+// strips the setting words in front of the first command into @settings. false after reporting an error.
+bool takePipeSettings(ParsedCommand& first, PipeSettings& settings);
+void executePipeconf(const vector<string>& arguments);
+void printPipelineStats(const vector<ParsedCommand>& parsedCommands, const vector<ChannelStats>& stats);
+
+enum class TimingFormat {
+    Off,
+    Table,   // a row per stage and a total
+    Posix,   // time -p: real, user and sys of the whole line
+    Json,    // one object per line, for feeding other tools
+};
+
+typedef struct {
+    string command;
+    pid_t pid;              // 0 for stages run inside the shell
+    int status;             // exit status in the shell's sense
+    double seconds;         // from the start of the line until the stage finished
+    struct rusage usage;    // wait4()'s. max RSS never reads below the shell's own, since the kernel
+                            // carries the high-water mark of the memory the program was spawned from over exec
+} StageTiming;
+
+typedef struct {
+    double start;           // CLOCK_MONOTONIC seconds
+    vector<StageTiming> stages;
+} LineTiming;
+
+// `timing` reports every foreground line, to stderr or appended to timingFile
+extern TimingFormat timingMode;
+extern string timingFile;
+// set while a timed line runs; executeCommand and executePipeline add a stage for everything they run
+extern LineTiming* currentTiming;
+
+double monotonicSeconds();
+string jsonEscape(const string& s);
+string commandText(const vector<string>& tokens);
+// what the calling thread used since @before was taken with RUSAGE_THREAD; max RSS is the process's
+struct rusage usageSince(const struct rusage& before);
+StageTiming jobStageTiming(const string& command, const Job& job, size_t index);
+// strips `time [-p|-j]` in front of the first command and sets @format. false after reporting an error.
+bool takeTimePrefix(ParsedCommand& first, TimingFormat& format);
+// writes the report to @file, or to stderr if it is empty
+void reportTiming(const LineTiming& timing, const string& command, TimingFormat format, const string& file);
+void executeTiming(const vector<string>& arguments);
+
+extern ResultCache resultCache;
+// opens the store on first use: $SHELL_CACHE_DIR, else $XDG_CACHE_HOME/shell/results, else ~/.cache/shell/results
+bool openResultCache();
+// the key of a command line: the resolved program, argv, working directory, the listed environment variables
+// and the size, mtime and inode of the listed input files
+string resultCacheKey(const string& programLocation, const vector<string>& arguments,
+                      const vector<string>& variables, const vector<string>& inputs);
+// cache [-t seconds] [-e variable]... [-i file]... command [argument]...  |  cache --stats  |  cache --clear
+void executeCache(const vector<string>& arguments);
+
+// glob [-0] pattern...: prints the paths each pattern matches as the walk finds them, unsorted, one per line
+// (NUL-terminated with -0), never building an argument list; a ** pattern is walked by a thread per core
+void executeGlob(const vector<string>& arguments);
+
+// trace start | stop | dump <file> | status
+void executeTrace(const vector<string>& arguments);
+
+// the builtins by name; every one of them takes the arguments after its name
+typedef void (*BuiltinHandler)(const vector<string>& arguments);
+// the handler of @command, or nullptr if it isn't a builtin (`exit` has none: executeCommand handles it)
+BuiltinHandler findBuiltin(const string& command);
+
+// returns -1 if the REPL has to exit;
+int executeCommand(const string& input, const vector<ParsedCommand>& parsedCommands, int commandIndex, bool isForkedProcess=true);
+
+// runs commands connected via pipe as one job and waits for it unless it goes to the background. external programs
+// are spawned, side-effect free builtins run in the shell process and the remaining builtins in forked children.
+void executePipeline(const string& input, const vector<ParsedCommand>& parsedCommands, bool background=false,
+                     const PipeSettings& settings=pipeSettings);
+
+// A word of a script, owning what the lexer gave for it.
+typedef struct {
+    WordPartKind kind;
+    string text;
+    bool quoted;
+    string pattern;
+} ScriptWordPart;
+
+typedef struct {
+    string text;                    // after quote removal; for a word with expansions, without them
+    bool glob;
+    string pattern;                 // if glob
+    vector<ScriptWordPart> parts;   // the word has expansions, see Lexer
+    TokenKind kind = TokenKind::Word;   // or ProcessOutput/ProcessInput, whose command is the text
+    shared_ptr<const int> document = nullptr;  // a sealed memfd that the text names as /dev/fd/N, closed with the last copy
+} ScriptWord;
+
+typedef struct {
+    vector<ScriptWord> words;
+    vector<pair<TokenKind, ScriptWord>> redirections;   // > >> 2> 2>> and the file, in order
+} ScriptCommand;
+
+enum class ScriptNodeKind {
+    Pipeline,
+    Sequence,   // a; b; c
+    And,        // a && b
+    Or,         // a || b
+    If,
+    While,
+    Until,
+    For,
+    Function,   // name() { ...; }: defines it when run
+    Group,      // { ...; }
+    Subshell,   // ( ... ), run in a forked copy of the shell
+};
+
+// The syntax tree of a line with control flow, parsed once and run by runScript as often as loops and calls
+// ask. A pipeline whose words expand to nothing different from run to run keeps its commands ready.
+struct ScriptNode {
+    ScriptNodeKind kind;
+    // Pipeline
+    vector<ScriptCommand> stages;
+    bool background = false;
+    bool negated = false;            // ! in front
+    bool ready = false;              // nothing to expand: commands and text are used as they are
+    vector<ParsedCommand> commands;
+    string text;                     // for jobs and messages
+    // Sequence: the commands; And, Or: both sides; If: condition, then and else if there is one (elif is an If
+    // there); While, Until: condition and body; For, Function, Group, Subshell: body
+    vector<shared_ptr<ScriptNode>> children;
+    string name;                     // For: the variable, Function: the function
+    vector<ScriptWord> words;        // For: the words after in
+    bool hasIn = false;              // For: without in, it loops over the positional parameters
+    // compound commands: the redirections after the closing word, which apply to everything inside
+    vector<pair<TokenKind, ScriptWord>> redirections;
+};
+
+// Parses the lexer's tokens into a script. Returns nullptr with @error set if they don't form one, and sets
+// @incomplete if they could still be the beginning of one.
+shared_ptr<ScriptNode> parseScript(const vector<Token>& tokens, const vector<WordPart>& parts, string& error, bool& incomplete);
+// Runs @node and leaves its exit status in lastExitStatus. Returns -1 if the shell has to exit.
+int runScript(const ScriptNode& node);
+
+// shell variables set by name=value and for, and the positional parameters of the functions being called
+extern unordered_map<string, string> shellVariables;
+extern vector<vector<string>> positionalParameters;
+// sets a shell variable, or the environment variable of that name if there is one (PATH included)
+void assignVariable(const string& name, const string& value);
+// $name: a special parameter, a shell variable or an environment variable; "" if unset
+string variableValue(string_view name);
+// the functions defined so far, by name
+extern unordered_map<string, shared_ptr<const ScriptNode>> shellFunctions;
+// the body of function @name, or nullptr
+const ScriptNode* findFunction(const string& name);
+// runs function @body with @arguments as its positional parameters. Returns -1 if the shell has to exit.
+int callFunction(const ScriptNode& body, const vector<string>& arguments);
+
+// test expression, [ expression ]: exit status 0 if true, 1 if false, 2 on a malformed expression
+void executeTest(const vector<string>& arguments);
+void executeBracketTest(const vector<string>& arguments);
+// break [n], continue [n] in loops and return [n] in functions
+void executeBreak(const vector<string>& arguments);
+void executeContinue(const vector<string>& arguments);
+void executeReturn(const vector<string>& arguments);
+
+// What executeLine made of a line, cached by its text so that running it again starts at the launch.
+typedef struct {
+    vector<ParsedCommand> commands;   // without the time prefix and pipe settings
+    bool runInBackground;
+    bool timePrefix;
+    TimingFormat prefixFormat;        // if timePrefix
+    bool ownSettings;                 // PIPE_*= words in front; the line is then not cached
+    PipeSettings settings;            // if ownSettings
+    // for a line that is one external program in the foreground: where PATH had it, its argv (argv[0] being
+    // the file name) as strings and as the nullptr-terminated array handed to the launch, and its redirections
+    string programLocation;
+    vector<string> argv;
+    vector<char*> argvPointers;
+    ProcessLauncher launcher;
+    // for a line with control flow (; && || loops, if, functions), what runScript runs instead of the above
+    shared_ptr<const ScriptNode> script;
+} CommandPlan;
+
+// plans of recent lines, valid for the PATH and the generation they were made under
+extern CommandPlanCache<CommandPlan> commandPlans;
+// bumped by every change of the working directory and every function definition
+extern uint64_t planGeneration;
+// the cached plan of @line if it still holds, or a new one (cached if it can be); nullptr if the line is empty
+// or malformed, after reporting why
+shared_ptr<const CommandPlan> planLine(const string& input);
+// where a command read line by line stands: inside a here-document, the lines are only compared with its
+// delimiter rather than the whole command being lexed again for every one
+typedef struct {
+    bool inHereDocument = false;
+    string delimiter;
+    bool stripTabs = false;
+} InputContinuation;
+// true if @input, with its last line just added, ends inside a compound command or a here-document or after
+// | && ||, so that the next line belongs to it
+bool needsMoreInput(const string& input, InputContinuation& continuation);
+// @input as one line for the history, its lines joined with ; where that keeps the meaning; just the first
+// line if it has here-documents
+string historyLine(const string& input);
+
+// parses and runs one line. returns -1 if the REPL has to exit, with lastExitStatus as the status to exit with
+int executeLine(const string& input);
+
+// runs every line of a script, -c string or non-interactive stdin, without any line editing. returns the exit status.
+int executeScript(LineReader& reader);
+
+#endif // SHELL_HPP
@@ -0,0 +1,182 @@
+#ifndef COMMAND_HASH_TABLE_CPP
+#define COMMAND_HASH_TABLE_CPP
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <sstream>
+#include <unordered_map>
+#include <sys/stat.h>
+using namespace std;
+
+// Remembers where commands were found in PATH (and where they were not found), so repeated lookups
+// skip the per-directory file probing. Entries are invalidated per directory by watching the mtime of
+// every PATH directory: adding or removing a file in a directory bumps that directory's mtime.
+class CommandHashTable {
+    static constexpr size_t NOT_FOUND = (size_t) -1;
+
+    struct Directory {
+        string path;
+        bool present = false;
+        bool statted = false;
+        struct timespec mtime = {0, 0};
+    };
+
+    struct Entry {
+        string location;              // empty for a negative (not found) entry
+        size_t dirIndex = NOT_FOUND;  // index of the PATH directory the command was found in
+        int hits = 0;
+        bool pinned = false;          // set through `hash -p`, never invalidated by mtime
+    };
+
+    string cachedPath;
+    vector<Directory> dirs;
+    unordered_map<string, Entry> table;
+
+    static bool sameTime(const struct timespec& a, const struct timespec& b) {
+        return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+    }
+
+    // Re-splits PATH and drops everything if PATH changed since the last lookup.
+    void syncPath(const string& path) {
+        if (path == cachedPath && !dirs.empty()) return;
+
+        cachedPath = path;
+        dirs.clear();
+        string dir;
+        istringstream stream(path);
+        while (getline(stream, dir, ':')) {
+            Directory d;
+            d.path = dir;
+            dirs.push_back(d);
+        }
+        forgetUnpinned();
+    }
+
+    // A change in directory `index` can remove commands found in it, and can shadow commands found in
+    // later directories. Negative entries can be satisfied by any directory.
+    void invalidateFrom(size_t index) {
+        for (auto it = table.begin(); it != table.end();) {
+            const Entry& e = it->second;
+            if (!e.pinned && (e.dirIndex == NOT_FOUND || e.dirIndex >= index)) {
+                it = table.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Stats the directory once and invalidates dependent entries if its mtime moved.
+    void revalidate(size_t index) {
+        Directory& d = dirs[index];
+        struct stat sb;
+        bool present = stat(d.path.c_str(), &sb) == 0 && S_ISDIR(sb.st_mode);
+        struct timespec mtime = present ? sb.st_mtim : timespec{0, 0};
+
+        if (d.statted && (present != d.present || !sameTime(mtime, d.mtime))) {
+            invalidateFrom(index);
+        }
+        d.statted = true;
+        d.present = present;
+        d.mtime = mtime;
+    }
+
+    // Returns true if the entry is still valid after revalidating the directories it depends on.
+    bool validate(const string& command) {
+        auto it = table.find(command);
+        if (it == table.end()) return false;
+        if (it->second.pinned) return true;
+
+        size_t limit = it->second.dirIndex == NOT_FOUND ? dirs.size() : it->second.dirIndex + 1;
+        for (size_t i = 0; i < limit; i++) {
+            revalidate(i);
+        }
+        return table.count(command) > 0;
+    }
+
+    // Walks PATH with one stat per directory and one per candidate file.
+    Entry& search(const string& command) {
+        Entry entry;
+        for (size_t i = 0; i < dirs.size(); i++) {
+            revalidate(i);
+            if (!dirs[i].present) continue;
+
+            const string& dir = dirs[i].path;
+            string candidate = dir.empty() || dir.back() == '/' ? dir + command : dir + "/" + command;
+            struct stat sb;
+            if (stat(candidate.c_str(), &sb) == 0 && S_ISREG(sb.st_mode) && (sb.st_mode & S_IXUSR)) {
+                entry.location = candidate;
+                entry.dirIndex = i;
+                break;
+            }
+        }
+        return remember(command, entry);
+    }
+
+    Entry& remember(const string& command, const Entry& entry) {
+        return table[command] = entry;
+    }
+
+    void forgetUnpinned() {
+        for (auto it = table.begin(); it != table.end();) {
+            if (it->second.pinned) ++it;
+            else it = table.erase(it);
+        }
+    }
+
+public:
+    struct Listing {
+        string command;
+        string location;
+        int hits;
+    };
+
+    // Returns the absolute location of the command in the given PATH, or "" if it is not there.
+    // @countHit is false for lookups that only report the location (e.g. `type`).
+    string lookup(const string& path, const string& command, bool countHit = true) {
+        syncPath(path);
+
+        Entry* entry;
+        if (validate(command)) {
+            entry = &table[command];
+        } else {
+            entry = &search(command);
+        }
+
+        if (countHit && !entry->location.empty()) entry->hits++;
+        return entry->location;
+    }
+
+    // Remembers @location as the location of @command, bypassing the PATH search (`hash -p`).
+    void pin(const string& command, const string& location) {
+        Entry entry;
+        entry.location = location;
+        entry.pinned = true;
+        remember(command, entry);
+    }
+
+    // Returns true if the command currently has a (positive) entry.
+    bool isHashed(const string& command) const {
+        auto it = table.find(command);
+        return it != table.end() && !it->second.location.empty();
+    }
+
+    // Returns all positive entries sorted by command name.
+    vector<Listing> list() const {
+        vector<Listing> result;
+        for (auto& [command, entry] : table) {
+            if (!entry.location.empty()) {
+                result.push_back({command, entry.location, entry.hits});
+            }
+        }
+        sort(result.begin(), result.end(), [](const Listing& a, const Listing& b) { return a.command < b.command; });
+        return result;
+    }
+
+    // Forgets all remembered locations, including pinned ones (`hash -r`).
+    void clear() {
+        table.clear();
+        for (auto& d : dirs) d.statted = false;
+    }
+};
+
+#endif // COMMAND_HASH_TABLE_CPP
@@ -0,0 +1,81 @@
+#ifndef COMMAND_PLAN_CACHE_CPP
+#define COMMAND_PLAN_CACHE_CPP
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+using namespace std;
+
+// What the shell worked out for a command line, kept by the raw text of the line so that typing or running
+// the same line again skips lexing, parsing and building the launch. A plan is only valid for the PATH and
+// the working directory it was made for: the shell bumps the directory generation on every `cd`, and a plan
+// made under another PATH or generation is dropped on lookup. Anything else a plan depends on (a program
+// appearing earlier in PATH, for one) the caller checks itself before using it.
+// The least recently used plans are dropped beyond the capacity; a capacity of 0 keeps nothing.
+template <typename Plan>
+class CommandPlanCache {
+    struct Stored {
+        shared_ptr<const Plan> plan;
+        string path;
+        uint64_t generation;
+        list<string>::iterator recency;
+    };
+
+    size_t capacity;
+    list<string> recency;   // most recently used first
+    unordered_map<string, Stored> plans;
+    uint64_t hits = 0, misses = 0;
+
+public:
+    explicit CommandPlanCache(size_t capacity = 512) : capacity(capacity) {}
+
+    // the plan stored for @line under @path and @generation, or nullptr
+    shared_ptr<const Plan> find(const string& line, const string& path, uint64_t generation) {
+        auto it = plans.find(line);
+        if (it == plans.end()) {
+            misses++;
+            return nullptr;
+        }
+        if (it->second.generation != generation || it->second.path != path) {
+            forget(line);
+            misses++;
+            return nullptr;
+        }
+        recency.splice(recency.begin(), recency, it->second.recency);
+        hits++;
+        return it->second.plan;
+    }
+
+    void store(const string& line, shared_ptr<const Plan> plan, const string& path, uint64_t generation) {
+        if (capacity == 0) return;
+        forget(line);
+        recency.push_front(line);
+        plans[line] = {move(plan), path, generation, recency.begin()};
+        while (plans.size() > capacity) forget(string(recency.back()));
+    }
+
+    // drops the plan for @line, when the caller found it no longer applies
+    void forget(const string& line) {
+        auto it = plans.find(line);
+        if (it == plans.end()) return;
+        recency.erase(it->second.recency);
+        plans.erase(it);
+    }
+
+    void clear() {
+        plans.clear();
+        recency.clear();
+    }
+
+    void setCapacity(size_t plansKept) {
+        capacity = plansKept;
+        while (plans.size() > capacity) forget(string(recency.back()));
+    }
+
+    size_t size() const { return plans.size(); }
+    uint64_t planHits() const { return hits; }
+    uint64_t planMisses() const { return misses; }
+};
+
+#endif // COMMAND_PLAN_CACHE_CPP
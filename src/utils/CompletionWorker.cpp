@@ -0,0 +1,268 @@
+#ifndef COMPLETION_WORKER_CPP
+#define COMPLETION_WORKER_CPP
+#include <vector>
+#include <string>
+#include <sstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "ExecutableIndex.cpp"
+#include "DirectoryCache.cpp"
+using namespace std;
+
+// What a completion is computed from: the line up to the cursor, and PATH and the working directory as they
+// were when it was asked for. The worker never reads the shell's own, which `cd` and PATH changes move under it.
+typedef struct {
+    string line;
+    string path;
+    string cwd;
+} CompletionRequest;
+
+// The word under the cursor, which Tab completes.
+typedef struct {
+    size_t start;       // where it begins in the line
+    string text;        // with quotes and backslashes removed
+    bool command;       // it names the program of a pipeline stage
+} CompletionWord;
+
+// Computes Tab completions on a background thread, so that a cold page cache or a slow PATH directory never
+// freezes the prompt. The prompt prewarms it, which lists whatever changed in PATH while the user types.
+// Only the newest request is worked on: a request replaces one that hasn't started, cancel() drops it and
+// any answer once the line changes, and an answer that arrives for a line no longer wanted is thrown away.
+// The thread is detached and shares its state, so neither the shell's exit nor a forked child's waits for a scan.
+class CompletionWorker {
+    struct State {
+        mutex lock;
+        condition_variable wake;       // for the worker: a request or a prewarm is waiting
+        condition_variable answered;   // for the shell: an answer is ready
+        bool started = false;
+        bool stopping = false;
+        bool hasRequest = false;       // queued, not yet started
+        CompletionRequest request;
+        bool hasWanted = false;        // what the shell is waiting for, queued or running
+        CompletionRequest wanted;
+        bool hasAnswer = false;
+        CompletionRequest answerFor;
+        vector<string> answer;
+        bool hasWarm = false;
+        CompletionRequest warm;
+
+        // only ever touched by the worker thread
+        ExecutableIndex executables;
+        DirectoryCache directories;
+    };
+
+    // name matches listed per completion before they are no longer checked for being directories one by one,
+    // on file systems that don't report entry types
+    static constexpr size_t TYPE_CHECKS = 256;
+
+    shared_ptr<State> state = make_shared<State>();
+    pid_t owner = 0;
+
+    static bool same(const CompletionRequest& a, const CompletionRequest& b) {
+        return a.line == b.line && a.path == b.path && a.cwd == b.cwd;
+    }
+
+    // PATH with relative entries (including empty ones, which mean ".") made absolute against @cwd
+    static string resolvePath(const string& path, const string& cwd) {
+        string resolved, dir;
+        istringstream stream(path);
+        while (getline(stream, dir, ':')) {
+            if (!resolved.empty()) resolved += ':';
+            if (dir.empty()) resolved += cwd;
+            else if (dir[0] != '/') resolved += cwd + "/" + dir;
+            else resolved += dir;
+        }
+        return resolved;
+    }
+
+    // files and directories in the directory part of @word that start with its last component; directories
+    // end in '/'. Dot files only if the component starts with a dot.
+    static vector<string> completeFilename(DirectoryCache& directories, const string& cwd, const string& word) {
+        size_t slash = word.rfind('/');
+        string typed = slash == string::npos ? "" : word.substr(0, slash + 1);
+        string prefix = word.substr(typed.size());
+        string directory = typed.empty() ? cwd : typed[0] == '/' ? typed : cwd + "/" + typed;
+
+        vector<string> candidates;
+        shared_ptr<const DirectoryCache::Listing> listing = directories.listing(directory);
+        if (listing == nullptr) return candidates;
+        auto [first, last] = listing->withPrefix(prefix);
+        bool checkTypes = last - first <= TYPE_CHECKS;
+        for (size_t i = first; i < last; i++) {
+            const DirectoryCache::Entry& entry = listing->all()[i];
+            if (entry.name[0] == '.' && !prefix.starts_with('.')) continue;
+            bool isDirectory = entry.type == DT_DIR;
+            if ((entry.type == DT_LNK || entry.type == DT_UNKNOWN) && checkTypes) {
+                struct stat st;
+                isDirectory = stat((directory + "/" + string(entry.name)).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+            }
+            candidates.push_back(typed + string(entry.name) + (isDirectory ? "/" : ""));
+        }
+        return candidates;
+    }
+
+    static vector<string> complete(State& state, const CompletionRequest& request) {
+        CompletionWord word = currentWord(request.line);
+        // a program by name comes from PATH; ./run or bin/tool is a file like any argument
+        if (word.command && word.text.find('/') == string::npos) {
+            return state.executables.complete(resolvePath(request.path, request.cwd), word.text);
+        }
+        return completeFilename(state.directories, request.cwd, word.text);
+    }
+
+    static void run(shared_ptr<State> state) {
+        unique_lock<mutex> guard(state->lock);
+        while (!state->stopping) {
+            if (state->hasRequest) {
+                CompletionRequest request = move(state->request);
+                state->hasRequest = false;
+                guard.unlock();
+                vector<string> candidates = complete(*state, request);
+                guard.lock();
+                if (state->hasWanted && same(state->wanted, request)) {
+                    state->answerFor = move(request);
+                    state->answer = move(candidates);
+                    state->hasAnswer = true;
+                    state->answered.notify_all();
+                }
+            }
+            else if (state->hasWarm) {
+                CompletionRequest warm = move(state->warm);
+                state->hasWarm = false;
+                guard.unlock();
+                state->executables.warm(resolvePath(warm.path, warm.cwd));
+                guard.lock();
+            }
+            else {
+                state->wake.wait(guard);
+            }
+        }
+    }
+
+    // with the lock held
+    void startLocked() {
+        if (state->started) return;
+        state->started = true;
+        owner = getpid();
+        thread(run, state).detach();
+    }
+
+public:
+    // Finds the word at the end of @line: after the last unquoted blank or operator. It is in command position
+    // at the start of the line and after | or &, and after a redirection (> 2>> ...) it is a file name.
+    static CompletionWord currentWord(const string& line) {
+        CompletionWord word = {0, "", true};
+        bool afterRedirection = false;
+        char quote = 0;
+        for (size_t i = 0; i < line.size(); i++) {
+            char c = line[i];
+            if (quote != 0) {
+                if (c == quote) quote = 0;
+                else if (quote == '"' && c == '\\' && i + 1 < line.size()) word.text += line[++i];
+                else word.text += c;
+                continue;
+            }
+            if (c == '\'' || c == '"') {
+                quote = c;
+                continue;
+            }
+            if (c == '\\') {
+                if (i + 1 < line.size()) word.text += line[++i];
+                continue;
+            }
+            bool fdRedirect = (c == '1' || c == '2') && word.text.empty() && word.start == i && i + 1 < line.size() &&
+                              line[i + 1] == '>';
+            if (c == ' ' || c == '\t' || c == '|' || c == '&' || c == '>' || fdRedirect) {
+                if (c == '|' || c == '&') {
+                    word.command = true;
+                    afterRedirection = false;
+                }
+                else if (c == '>' || fdRedirect) {
+                    afterRedirection = true;
+                    if (fdRedirect) i++;
+                    while (i + 1 < line.size() && line[i + 1] == '>') i++;
+                }
+                else if (i > word.start) {
+                    // a word ended: the command was named, or a redirection got its file
+                    if (afterRedirection) afterRedirection = false;
+                    else word.command = false;
+                }
+                word.start = i + 1;
+                word.text.clear();
+                continue;
+            }
+            word.text += c;
+        }
+        if (afterRedirection) word.command = false;
+        return word;
+    }
+
+    // @text with the characters the lexer treats specially escaped by backslashes
+    static string escape(const string& text) {
+        string escaped;
+        for (char c : text) {
+            if (c == ' ' || c == '\t' || c == '\\' || c == '\'' || c == '"' || c == '|' || c == '>' || c == '&' || c == '#') {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    CompletionWorker() = default;
+    CompletionWorker(const CompletionWorker&) = delete;
+    CompletionWorker& operator=(const CompletionWorker&) = delete;
+
+    ~CompletionWorker() {
+        // a forked child has the state but not the thread, and the lock may have been held when it forked
+        if (owner != getpid()) return;
+        lock_guard<mutex> guard(state->lock);
+        state->stopping = true;
+        state->wake.notify_all();
+    }
+
+    // Brings the listings of @context's PATH up to date in the background, ahead of the first Tab.
+    void prewarm(const CompletionRequest& context) {
+        lock_guard<mutex> guard(state->lock);
+        startLocked();
+        state->warm = context;
+        state->hasWarm = true;
+        state->wake.notify_all();
+    }
+
+    // Forgets the request being waited for and its answer: the line changed.
+    void cancel() {
+        lock_guard<mutex> guard(state->lock);
+        state->hasRequest = false;
+        state->hasWanted = false;
+        state->hasAnswer = false;
+    }
+
+    // Asks for the candidates of @request and waits at most @budget for them. Returns false if they are not
+    // ready by then; the worker carries on, and asking again for the same request picks the answer up.
+    bool request(const CompletionRequest& request, chrono::milliseconds budget, vector<string>& candidates) {
+        unique_lock<mutex> guard(state->lock);
+        startLocked();
+        if (!(state->hasWanted && same(state->wanted, request))) {
+            state->wanted = request;
+            state->hasWanted = true;
+            state->hasAnswer = false;
+            state->request = request;
+            state->hasRequest = true;
+            state->wake.notify_all();
+        }
+        bool ready = state->answered.wait_for(guard, budget, [&]() {
+            return state->hasAnswer && same(state->answerFor, request);
+        });
+        if (ready) candidates = state->answer;
+        return ready;
+    }
+};
+
+#endif // COMPLETION_WORKER_CPP
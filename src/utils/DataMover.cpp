@@ -0,0 +1,309 @@
+#ifndef DATA_MOVER_CPP
+#define DATA_MOVER_CPP
+#include <vector>
+#include <array>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DATA_MOVER_HAS_X86_SIMD 1
+#endif
+using namespace std;
+
+// Moves bytes between file descriptors with as little copying through user space as the pair allows:
+// copy_file_range between regular files, sendfile out of a regular file, splice when either side is a
+// pipe, and large read/write blocks for everything else (terminals, O_APPEND files...). Each step falls
+// back to the next one when the kernel refuses, continuing from the current file offsets.
+// Newlines are counted with SSE2/AVX2 over memory-mapped files or over the read buffer.
+class DataMover {
+    static constexpr size_t BLOCK_SIZE = 1 << 18;
+    static constexpr size_t SPLICE_CHUNK = 1 << 20;
+
+    enum class Method { CopyFileRange, SendFile, Splice, ReadWrite };
+
+    static Method bestMethod(int in, int out) {
+        struct stat inStat, outStat;
+        if (fstat(in, &inStat) != 0 || fstat(out, &outStat) != 0) return Method::ReadWrite;
+        bool outAppends = (fcntl(out, F_GETFL) & O_APPEND) != 0;
+        if (S_ISREG(inStat.st_mode) && S_ISREG(outStat.st_mode) && !outAppends) return Method::CopyFileRange;
+        if (S_ISFIFO(inStat.st_mode) || (S_ISFIFO(outStat.st_mode) && !outAppends)) return Method::Splice;
+        if (S_ISREG(inStat.st_mode)) return Method::SendFile;
+        return Method::ReadWrite;
+    }
+
+    // one step of @method; returns bytes moved, 0 at end of input, -1 with errno set
+    static ssize_t step(Method method, int in, int out, size_t size, char* buffer) {
+        switch (method) {
+            case Method::CopyFileRange:
+                return copy_file_range(in, nullptr, out, nullptr, size, 0);
+            case Method::SendFile:
+                return sendfile(out, in, nullptr, size);
+            case Method::Splice:
+                return splice(in, nullptr, out, nullptr, min(size, SPLICE_CHUNK), SPLICE_F_MOVE | SPLICE_F_MORE);
+            default: {
+                ssize_t n = read(in, buffer, min(size, BLOCK_SIZE));
+                if (n > 0 && !writeAll(out, buffer, n)) return -1;
+                return n;
+            }
+        }
+    }
+
+    // errors that mean "this method does not work for these descriptors", not "the copy failed"
+    static bool isUnsupported(int err) {
+        return err == EINVAL || err == EXDEV || err == ENOSYS || err == EOPNOTSUPP || err == EBADF;
+    }
+
+#ifdef DATA_MOVER_HAS_X86_SIMD
+    __attribute__((target("avx2")))
+    static size_t countNewlinesAvx2(const char* p, size_t n, size_t& i) {
+        const __m256i newline = _mm256_set1_epi8('\n');
+        size_t count = 0;
+        for (; i + 32 <= n; i += 32) {
+            __m256i chunk = _mm256_loadu_si256((const __m256i*) (p + i));
+            count += __builtin_popcount((uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline)));
+        }
+        return count;
+    }
+
+    static size_t countNewlinesSse2(const char* p, size_t n, size_t& i) {
+        const __m128i newline = _mm_set1_epi8('\n');
+        size_t count = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m128i chunk = _mm_loadu_si128((const __m128i*) (p + i));
+            count += __builtin_popcount((uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline)));
+        }
+        return count;
+    }
+#endif
+
+public:
+    static bool writeAll(int fd, const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t n = write(fd, data, size);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            data += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    // Copies up to @limit bytes from @in to @out, starting at their current offsets. Sets @copied to the
+    // number of bytes moved. Returns false with errno set if reading or writing failed.
+    static bool copy(int in, int out, uint64_t limit, uint64_t& copied) {
+        copied = 0;
+        Method method = bestMethod(in, out);
+        vector<char> buffer;
+        while (copied < limit) {
+            if (method == Method::ReadWrite && buffer.empty()) buffer.resize(BLOCK_SIZE);
+            ssize_t n = step(method, in, out, min<uint64_t>(limit - copied, 1u << 30), buffer.data());
+            if (n > 0) {
+                copied += n;
+                continue;
+            }
+            if (n == 0) return true;
+            if (errno == EINTR) continue;
+            if (method != Method::ReadWrite && isUnsupported(errno)) {
+                // copy_file_range falls back to sendfile, everything else to plain reads and writes
+                method = method == Method::CopyFileRange ? Method::SendFile : Method::ReadWrite;
+                continue;
+            }
+            return false;
+        }
+        return true;
+    }
+
+    static bool copy(int in, int out) {
+        uint64_t copied;
+        return copy(in, out, UINT64_MAX, copied);
+    }
+
+    // Copies @in to every descriptor in @outs. When the input is a pipe and every output a pipe or a
+    // regular file, the data is duplicated with tee() and moved with splice(), never entering the shell.
+    // Returns false with errno set on failure.
+    static bool tee(int in, const vector<int>& outs) {
+        if (!outs.empty() && canTeeWithoutCopying(in, outs)) {
+            // every output but the last gets a copy through a relay pipe of its own, the last one the original bytes
+            vector<array<int, 2>> relays(outs.size() - 1);
+            bool ok = true;
+            for (auto& relay : relays) ok &= pipe2(relay.data(), O_CLOEXEC) == 0;
+            ok = ok && teeThroughPipes(in, outs, relays);
+            int savedErrno = errno;
+            for (auto& relay : relays) {
+                ::close(relay[0]);
+                ::close(relay[1]);
+            }
+            errno = savedErrno;
+            return ok;
+        }
+
+        vector<char> buffer(BLOCK_SIZE);
+        while (true) {
+            ssize_t n = read(in, buffer.data(), buffer.size());
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return false;
+            if (n == 0) return true;
+            for (int out : outs) {
+                if (!writeAll(out, buffer.data(), n)) return false;
+            }
+        }
+    }
+
+private:
+    static bool canTeeWithoutCopying(int in, const vector<int>& outs) {
+        struct stat sb;
+        if (fstat(in, &sb) != 0 || !S_ISFIFO(sb.st_mode)) return false;
+        for (int out : outs) {
+            if (fstat(out, &sb) != 0) return false;
+            if (!S_ISFIFO(sb.st_mode) && !S_ISREG(sb.st_mode)) return false;
+            if ((fcntl(out, F_GETFL) & O_APPEND) != 0) return false;
+        }
+        return true;
+    }
+
+    // moves all of @n bytes from the pipe @from to @to
+    static bool spliceExactly(int from, int to, ssize_t n) {
+        while (n > 0) {
+            ssize_t m = splice(from, nullptr, to, nullptr, n, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (m < 0 && errno == EINTR) continue;
+            if (m <= 0) return false;
+            n -= m;
+        }
+        return true;
+    }
+
+    static bool teeThroughPipes(int in, const vector<int>& outs, vector<array<int, 2>>& relays) {
+        while (true) {
+            // duplicate what is in the input pipe into every relay without consuming it. the relays are
+            // empty and equally large at this point, so each of them takes the same number of bytes.
+            ssize_t n = SPLICE_CHUNK;
+            for (size_t k = 0; k < relays.size(); k++) {
+                ssize_t t;
+                while ((t = ::tee(in, relays[k][1], n, 0)) < 0 && errno == EINTR) {}
+                if (t < 0) return false;
+                if (t == 0) return true;
+                n = t;
+            }
+            if (relays.empty()) {
+                // a single output: just move the bytes
+                ssize_t m;
+                while ((m = splice(in, nullptr, outs[0], nullptr, n, SPLICE_F_MOVE | SPLICE_F_MORE)) < 0 && errno == EINTR) {}
+                if (m < 0) return false;
+                if (m == 0) return true;
+                continue;
+            }
+
+            if (!spliceExactly(in, outs.back(), n)) return false;
+            for (size_t k = 0; k < relays.size(); k++) {
+                if (!spliceExactly(relays[k][0], outs[k], n)) return false;
+            }
+        }
+    }
+
+public:
+    // Counts '\n' bytes in memory, 32 or 16 at a time.
+    static size_t countNewlines(const char* p, size_t n) {
+        size_t count = 0;
+        size_t i = 0;
+#ifdef DATA_MOVER_HAS_X86_SIMD
+        static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+        if (hasAvx2) count += countNewlinesAvx2(p, n, i);
+        count += countNewlinesSse2(p, n, i);
+#endif
+        for (; i < n; i++) count += p[i] == '\n';
+        return count;
+    }
+
+    // Counts the lines and bytes from the current offset of @fd to its end. Regular files are mapped
+    // instead of read. Returns false with errno set on failure.
+    static bool count(int fd, bool countLines, uint64_t& lines, uint64_t& bytes) {
+        lines = 0;
+        bytes = 0;
+        struct stat sb;
+        if (fstat(fd, &sb) != 0) return false;
+
+        if (S_ISREG(sb.st_mode)) {
+            off_t start = lseek(fd, 0, SEEK_CUR);
+            if (start < 0) start = 0;
+            if (start >= sb.st_size) return true;
+            void* mapped = countLines ? mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+            // files in /proc and the like claim a size but can't be mapped; they are read like a stream
+            if (mapped != MAP_FAILED) {
+                bytes = sb.st_size - start;
+                if (countLines) {
+                    madvise(mapped, sb.st_size, MADV_SEQUENTIAL);
+                    lines = countNewlines((const char*) mapped + start, bytes);
+                    munmap(mapped, sb.st_size);
+                }
+                lseek(fd, sb.st_size, SEEK_SET);
+                return true;
+            }
+        }
+
+        vector<char> buffer(BLOCK_SIZE);
+        while (true) {
+            ssize_t n = read(fd, buffer.data(), buffer.size());
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return false;
+            if (n == 0) return true;
+            bytes += n;
+            if (countLines) lines += countNewlines(buffer.data(), n);
+        }
+    }
+
+    // Copies the first @lines lines of @in to @out (the whole input if it has fewer).
+    // Returns false with errno set on failure.
+    static bool copyLines(int in, int out, uint64_t lines) {
+        if (lines == 0) return true;
+        struct stat sb;
+        if (fstat(in, &sb) != 0) return false;
+
+        if (S_ISREG(sb.st_mode) && sb.st_size > 0) {
+            off_t start = lseek(in, 0, SEEK_CUR);
+            void* mapped = start >= 0 ? mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, in, 0) : MAP_FAILED;
+            if (mapped != MAP_FAILED) {
+                // find the end of the last wanted line, then let copy() move the bytes
+                const char* data = (const char*) mapped;
+                size_t end = start;
+                for (uint64_t seen = 0; seen < lines && end < (size_t) sb.st_size; seen++) {
+                    const char* newline = (const char*) memchr(data + end, '\n', sb.st_size - end);
+                    end = newline != nullptr ? newline - data + 1 : sb.st_size;
+                }
+                munmap(mapped, sb.st_size);
+                uint64_t copied;
+                return copy(in, out, end - start, copied);
+            }
+        }
+
+        // streams: whatever follows the last line in the block read is dropped, as with any head
+        vector<char> buffer(BLOCK_SIZE);
+        uint64_t seen = 0;
+        while (true) {
+            ssize_t n = read(in, buffer.data(), buffer.size());
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return false;
+            if (n == 0) return true;
+            size_t end = 0;
+            while (seen < lines && end < (size_t) n) {
+                const char* newline = (const char*) memchr(buffer.data() + end, '\n', n - end);
+                if (newline == nullptr) {
+                    end = n;
+                    break;
+                }
+                end = newline - buffer.data() + 1;
+                seen++;
+            }
+            if (!writeAll(out, buffer.data(), end)) return false;
+            if (seen == lines) return true;
+        }
+    }
+};
+
+#endif // DATA_MOVER_CPP
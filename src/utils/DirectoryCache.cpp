@@ -0,0 +1,159 @@
+#ifndef DIRECTORY_CACHE_CPP
+#define DIRECTORY_CACHE_CPP
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+using namespace std;
+
+// Directory listings for filename completion, read with getdents64 in large blocks and kept sorted, so that
+// every further lookup in the same directory is a binary search however many files it holds.
+// A listing is used again as long as the directory's mtime, inode and device are unchanged; one whose mtime
+// falls in the second it was read in could miss a file created right after, so it is read again next time.
+// The least recently used listings are dropped once they hold more than the byte budget.
+class DirectoryCache {
+public:
+    typedef struct {
+        string_view name;
+        unsigned char type;   // d_type: DT_DIR, DT_REG, DT_LNK, or DT_UNKNOWN where the file system doesn't say
+    } Entry;
+
+    class Listing {
+        friend class DirectoryCache;
+        string names;               // every name, one after the other
+        vector<Entry> entries;      // sorted by name, viewing into names
+        struct stat directory;      // what it was read from
+        time_t listedAt = 0;
+    public:
+        const vector<Entry>& all() const { return entries; }
+
+        // the entries whose names start with @prefix, as a range of all()
+        pair<size_t, size_t> withPrefix(string_view prefix) const {
+            auto first = lower_bound(entries.begin(), entries.end(), prefix,
+                                     [](const Entry& e, string_view p) { return e.name < p; });
+            auto last = first;
+            while (last != entries.end() && last->name.starts_with(prefix)) last++;
+            return {first - entries.begin(), last - entries.begin()};
+        }
+
+        size_t bytes() const { return names.capacity() + entries.capacity() * sizeof(Entry) + sizeof(*this); }
+    };
+
+private:
+    static constexpr size_t READ_SIZE = 1 << 20;
+
+    struct dirent64Record {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+    };
+
+    size_t budget;
+    size_t used = 0;
+    list<string> recency;   // most recently used first
+    unordered_map<string, pair<shared_ptr<const Listing>, list<string>::iterator>> listings;
+    vector<char> buffer;
+    uint64_t hits = 0, reads = 0;
+
+    static bool unchanged(const struct stat& a, const struct stat& b) {
+        return a.st_ino == b.st_ino && a.st_dev == b.st_dev && a.st_mtim.tv_sec == b.st_mtim.tv_sec &&
+               a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+    }
+
+    shared_ptr<const Listing> read(const string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) return nullptr;
+        auto listing = make_shared<Listing>();
+        listing->listedAt = time(nullptr);
+        if (fstat(fd, &listing->directory) < 0) {
+            ::close(fd);
+            return nullptr;
+        }
+        buffer.resize(READ_SIZE);
+        vector<pair<size_t, unsigned char>> found;   // offsets: names moves while it grows
+        while (true) {
+            long n = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+            if (n <= 0) break;
+            for (long at = 0; at < n;) {
+                auto* record = reinterpret_cast<dirent64Record*>(buffer.data() + at);
+                at += record->d_reclen;
+                const char* name = record->d_name;
+                if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+                found.push_back({listing->names.size(), record->d_type});
+                listing->names.append(name, strlen(name) + 1);
+            }
+        }
+        ::close(fd);
+
+        listing->entries.reserve(found.size());
+        for (auto& [offset, type] : found) listing->entries.push_back({string_view(listing->names.data() + offset), type});
+        sort(listing->entries.begin(), listing->entries.end(), [](const Entry& a, const Entry& b) { return a.name < b.name; });
+        return listing;
+    }
+
+    void forget(const string& path) {
+        auto it = listings.find(path);
+        if (it == listings.end()) return;
+        used -= it->second.first->bytes();
+        recency.erase(it->second.second);
+        listings.erase(it);
+    }
+
+public:
+    explicit DirectoryCache(size_t budget = 64 << 20) : budget(budget) {}
+
+    // The listing of the directory at @path (absolute), or nullptr if it can't be read. The listing stays
+    // valid while it is held, even after the cache dropped it.
+    shared_ptr<const Listing> listing(const string& path) {
+        struct stat now;
+        if (stat(path.c_str(), &now) < 0 || !S_ISDIR(now.st_mode)) {
+            forget(path);
+            return nullptr;
+        }
+        auto it = listings.find(path);
+        if (it != listings.end()) {
+            const Listing& cached = *it->second.first;
+            if (unchanged(cached.directory, now) && cached.directory.st_mtim.tv_sec < cached.listedAt) {
+                recency.splice(recency.begin(), recency, it->second.second);
+                hits++;
+                return it->second.first;
+            }
+            forget(path);
+        }
+
+        shared_ptr<const Listing> fresh = read(path);
+        reads++;
+        if (fresh == nullptr) return nullptr;
+        recency.push_front(path);
+        listings[path] = {fresh, recency.begin()};
+        used += fresh->bytes();
+        // the newest listing stays even if it alone is over the budget
+        while (used > budget && recency.size() > 1) forget(string(recency.back()));
+        return fresh;
+    }
+
+    // lookups answered from a cached listing, and directories read
+    uint64_t cacheHits() const { return hits; }
+    uint64_t directoryReads() const { return reads; }
+
+    void clear() {
+        listings.clear();
+        recency.clear();
+        used = 0;
+    }
+};
+
+#endif // DIRECTORY_CACHE_CPP
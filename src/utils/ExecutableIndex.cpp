@@ -0,0 +1,151 @@
+#ifndef EXECUTABLE_INDEX_CPP
+#define EXECUTABLE_INDEX_CPP
+#include <vector>
+#include <string>
+#include <sstream>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "Trie.cpp"
+using namespace std;
+
+// Long-lived index of the executables reachable through PATH, used for Tab completion.
+// Each PATH directory is listed once and re-listed only when its mtime changes; directories that
+// need a listing are scanned in parallel.
+class ExecutableIndex {
+    struct Directory {
+        string path;
+        bool scanned = false;
+        bool present = false;
+        struct timespec mtime = {0, 0};
+        vector<string> executables;
+    };
+
+    string cachedPath;
+    vector<Directory> dirs;
+    Trie trie;
+    bool trieIsStale = true;
+
+    static bool sameTime(const struct timespec& a, const struct timespec& b) {
+        return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+    }
+
+    void syncPath(const string& path) {
+        if (path == cachedPath && !dirs.empty()) return;
+
+        cachedPath = path;
+        dirs.clear();
+        string dir;
+        istringstream stream(path);
+        while (getline(stream, dir, ':')) {
+            Directory d;
+            d.path = dir;
+            dirs.push_back(d);
+        }
+        trieIsStale = true;
+    }
+
+    // Lists the regular, readable, executable files of a single directory.
+    static void scan(Directory& d) {
+        d.executables.clear();
+        if (!d.present) return;
+
+        DIR* dp = opendir(d.path.c_str());
+        if (dp == nullptr) return;
+        int dfd = dirfd(dp);
+
+        while (struct dirent* entry = readdir(dp)) {
+            if (entry->d_name[0] == '.' && (entry->d_name[1] == '\0' || (entry->d_name[1] == '.' && entry->d_name[2] == '\0'))) {
+                continue;
+            }
+            if (entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) {
+                continue;
+            }
+            struct stat sb;
+            if (fstatat(dfd, entry->d_name, &sb, 0) != 0) continue;
+            if (!S_ISREG(sb.st_mode) || !(sb.st_mode & S_IXUSR)) continue;
+            if (faccessat(dfd, entry->d_name, R_OK, 0) != 0) continue;
+
+            d.executables.push_back(entry->d_name);
+        }
+        closedir(dp);
+    }
+
+    // Scans the given directories, spreading them over up to one thread per core.
+    void scanAll(const vector<size_t>& stale) {
+        size_t workers = min<size_t>(stale.size(), max(1u, thread::hardware_concurrency()));
+        if (workers <= 1) {
+            for (size_t i : stale) scan(dirs[i]);
+            return;
+        }
+
+        atomic<size_t> next = 0;
+        vector<thread> threads;
+        for (size_t w = 0; w < workers; w++) {
+            threads.emplace_back([&]() {
+                for (size_t k = next++; k < stale.size(); k = next++) {
+                    scan(dirs[stale[k]]);
+                }
+            });
+        }
+        for (auto& t : threads) t.join();
+    }
+
+    // Re-lists the directories that changed since they were last listed and rebuilds the trie if needed.
+    void refresh() {
+        vector<size_t> stale;
+        for (size_t i = 0; i < dirs.size(); i++) {
+            Directory& d = dirs[i];
+            struct stat sb;
+            bool present = stat(d.path.c_str(), &sb) == 0 && S_ISDIR(sb.st_mode);
+            struct timespec mtime = present ? sb.st_mtim : timespec{0, 0};
+
+            if (!d.scanned || present != d.present || !sameTime(mtime, d.mtime)) {
+                d.scanned = true;
+                d.present = present;
+                d.mtime = mtime;
+                stale.push_back(i);
+            }
+        }
+
+        if (!stale.empty()) {
+            scanAll(stale);
+            trieIsStale = true;
+        }
+
+        if (trieIsStale) {
+            trie.clear();
+            for (auto& d : dirs) trie.add(d.executables);
+            trieIsStale = false;
+        }
+    }
+
+public:
+    // Returns all executables in the given PATH that start with the given prefix.
+    vector<string> complete(const string& path, const string& prefix) {
+        syncPath(path);
+        refresh();
+        return trie.getAllByPrefix(prefix);
+    }
+
+    // Lists whatever changed in the given PATH since the last call, without looking anything up.
+    void warm(const string& path) {
+        syncPath(path);
+        refresh();
+    }
+
+    // Drops every listing, so that the next completion rescans all of PATH.
+    void clear() {
+        dirs.clear();
+        cachedPath.clear();
+        trie.clear();
+        trieIsStale = true;
+    }
+};
+
+#endif // EXECUTABLE_INDEX_CPP
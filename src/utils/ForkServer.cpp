@@ -0,0 +1,393 @@
+#ifndef FORK_SERVER_CPP
+#define FORK_SERVER_CPP
+#include <vector>
+#include <string>
+#include <deque>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "ProcessLauncher.cpp"
+#include "JobTable.cpp"
+using namespace std;
+
+// A helper process forked when the shell starts, before it loads history or builds its indexes, that starts
+// programs on the shell's behalf (SHELL_LAUNCHER=server). Spawning from it costs the same however large the
+// interactive shell grows.
+//
+// A launch is one request over a socketpair: program, argv, environment, working directory, the launcher's
+// file actions and process group, and the shell's descriptors the child needs (stdin, stdout, stderr, dup
+// sources, the terminal) passed with SCM_RIGHTS. The server gives each descriptor back its number in the shell
+// before applying the file actions, so they mean the same as in a local launch, and answers with the pid.
+// The children are the server's: it reaps them and writes their statuses to a pipe the job table reads, then
+// sends the shell SIGCHLD. The shell is made a subreaper, so if the server dies its children come to the shell.
+class ForkServer {
+    static constexpr size_t MAX_FDS = 64;
+
+    typedef struct {
+        uint32_t size;      // bytes of the request that follow
+        uint32_t fdCount;   // descriptors attached to the header
+    } RequestHeader;
+
+    typedef struct {
+        int32_t pid;
+        int32_t err;
+        int32_t refused;    // the server could not set the launch up; the shell starts the program itself
+    } Reply;
+
+    typedef JobTable::ChildStatus ChildStatus;
+
+    pid_t serverPid = -1;
+    pid_t owner = 0;          // forked children of the shell must not talk over its socket
+    int requestSocket = -1;
+
+    // the environment of the last request, which environ points into while the server spawns
+    vector<string> environment;
+    vector<char*> environmentPointers;
+
+    static void put(string& buffer, int64_t value) {
+        buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    static void put(string& buffer, const string& value) {
+        put(buffer, (int64_t) value.size());
+        buffer += value;
+    }
+
+    class Reader {
+        const string& buffer;
+        size_t offset = 0;
+    public:
+        bool failed = false;
+
+        explicit Reader(const string& buffer) : buffer(buffer) {}
+
+        int64_t number() {
+            int64_t value = 0;
+            if (offset + sizeof(value) > buffer.size()) {
+                failed = true;
+                return 0;
+            }
+            memcpy(&value, buffer.data() + offset, sizeof(value));
+            offset += sizeof(value);
+            return value;
+        }
+
+        string text() {
+            int64_t size = number();
+            if (failed || size < 0 || offset + size > buffer.size()) {
+                failed = true;
+                return "";
+            }
+            string value = buffer.substr(offset, size);
+            offset += size;
+            return value;
+        }
+    };
+
+    static bool sendAll(int fd, const void* data, size_t size) {
+        const char* p = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t sent = send(fd, p, size, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent <= 0) return false;
+            p += sent;
+            size -= sent;
+        }
+        return true;
+    }
+
+    static bool receiveAll(int fd, void* data, size_t size) {
+        char* p = static_cast<char*>(data);
+        while (size > 0) {
+            ssize_t received = read(fd, p, size);
+            if (received < 0 && errno == EINTR) continue;
+            if (received <= 0) return false;
+            p += received;
+            size -= received;
+        }
+        return true;
+    }
+
+    // Reads one request, with its descriptors. false once the shell is gone.
+    static bool receiveRequest(int socket, string& body, vector<int>& fds) {
+        RequestHeader header;
+        iovec part = {&header, sizeof(header)};
+        char control[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+        msghdr message = {};
+        message.msg_iov = &part;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        ssize_t received;
+        while ((received = recvmsg(socket, &message, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {}
+        if (received <= 0) return false;
+
+        fds.clear();
+        for (cmsghdr* c = CMSG_FIRSTHDR(&message); c != nullptr; c = CMSG_NXTHDR(&message, c)) {
+            if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+            size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            fds.resize(fds.size() + count);
+            memcpy(fds.data() + fds.size() - count, CMSG_DATA(c), count * sizeof(int));
+        }
+        if ((size_t) received < sizeof(header) &&
+            !receiveAll(socket, reinterpret_cast<char*>(&header) + received, sizeof(header) - received)) {
+            return false;
+        }
+        body.resize(header.size);
+        return receiveAll(socket, body.data(), body.size());
+    }
+
+    // Starts the program a request describes, in the server.
+    Reply launchRequest(const string& body, const vector<int>& received) {
+        Reader in(body);
+        string path = in.text();
+        string cwd = in.text();
+        vector<string> args(max<int64_t>(in.number(), 0));
+        for (string& arg : args) arg = in.text();
+        environment.assign(max<int64_t>(in.number(), 0), "");
+        for (string& variable : environment) variable = in.text();
+        vector<int> originals(max<int64_t>(in.number(), 0));
+        for (int& fd : originals) fd = in.number();
+
+        ProcessLauncher launcher;
+        launcher.mode = LaunchMode::Spawn;
+        vector<ProcessLauncher::FdAction> actions(max<int64_t>(in.number(), 0));
+        for (auto& action : actions) {
+            action.kind = (decltype(action.kind)) in.number();
+            action.fd = in.number();
+            action.sourceFd = in.number();
+            action.path = in.text();
+            action.flags = in.number();
+            action.mode = in.number();
+        }
+        launcher.processGroup = in.number();
+        int terminalFd = in.number();
+        if (in.failed || originals.size() != received.size()) return {-1, EINVAL, 1};
+        if (chdir(cwd.c_str()) < 0) return {-1, errno, 1};
+
+        // above every number the child uses, so that giving the descriptors their numbers can't overwrite one
+        int high = 3;
+        for (int fd : originals) high = max(high, fd + 1);
+        for (int fd : received) high = max(high, fd + 1);
+        vector<int> moved;
+        for (size_t i = 0; i < received.size(); i++) {
+            int copy = fcntl(received[i], F_DUPFD_CLOEXEC, high);
+            if (copy < 0) {
+                int err = errno;
+                for (int fd : moved) ::close(fd);
+                return {-1, err, 1};
+            }
+            moved.push_back(copy);
+            launcher.dup(copy, originals[i]);
+            if (originals[i] == terminalFd) launcher.terminalFd = copy;
+        }
+        // closed in the shell, so closed in the child rather than the server's /dev/null
+        for (int fd = 0; fd <= 2; fd++) {
+            if (find(originals.begin(), originals.end(), fd) == originals.end()) launcher.close(fd);
+        }
+        launcher.actions.insert(launcher.actions.end(), actions.begin(), actions.end());
+
+        environmentPointers.clear();
+        for (string& variable : environment) environmentPointers.push_back(variable.data());
+        environmentPointers.push_back(nullptr);
+        environ = environmentPointers.data();
+
+        int err = 0;
+        pid_t pid = launcher.launch(path, args, err);
+        for (int fd : moved) ::close(fd);
+        return {pid, pid < 0 ? err : 0, 0};
+    }
+
+    // Collects the statuses of finished, stopped and continued children.
+    static void reapChildren(deque<ChildStatus>& outbox) {
+        ChildStatus child;
+        while ((child.pid = wait4(-1, &child.status, WNOHANG | WUNTRACED | WCONTINUED, &child.usage)) > 0) {
+            timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            child.time = now.tv_sec + now.tv_nsec / 1e9;
+            outbox.push_back(child);
+        }
+    }
+
+    // Writes out what the pipe takes and tells the shell; the rest waits until the shell has read.
+    static void sendStatuses(deque<ChildStatus>& outbox, int statusFd, pid_t shell) {
+        bool sent = false;
+        while (!outbox.empty() && write(statusFd, &outbox.front(), sizeof(ChildStatus)) == sizeof(ChildStatus)) {
+            outbox.pop_front();
+            sent = true;
+        }
+        if (sent || !outbox.empty()) kill(shell, SIGCHLD);
+    }
+
+    [[noreturn]] void serve(int socket, int statusFd, pid_t shell) {
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if (getppid() != shell) _exit(0);
+        // the server never touches the terminal; children get the shell's descriptors with each request
+        int null = ::open("/dev/null", O_RDWR);
+        for (int fd = 0; fd <= 2; fd++) dup2(null, fd);
+        if (null > 2) ::close(null);
+        // it stays in the shell's process group, so keystrokes at the prompt signal it as well
+        for (int sig : {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGPIPE}) signal(sig, SIG_IGN);
+        signal(SIGCHLD, SIG_DFL);
+        sigset_t childSignal;
+        sigemptyset(&childSignal);
+        sigaddset(&childSignal, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &childSignal, nullptr);
+        int signals = signalfd(-1, &childSignal, SFD_CLOEXEC | SFD_NONBLOCK);
+
+        deque<ChildStatus> outbox;
+        string body;
+        vector<int> fds;
+        while (true) {
+            pollfd watched[3] = {{socket, POLLIN, 0}, {signals, POLLIN, 0},
+                                 {statusFd, (short) (outbox.empty() ? 0 : POLLOUT), 0}};
+            if (poll(watched, 3, -1) < 0 && errno != EINTR) _exit(1);
+            if (watched[1].revents & POLLIN) {
+                signalfd_siginfo info;
+                while (read(signals, &info, sizeof(info)) == sizeof(info)) {}
+                reapChildren(outbox);
+            }
+            if (!outbox.empty()) sendStatuses(outbox, statusFd, shell);
+            if (watched[0].revents & (POLLIN | POLLHUP)) {
+                if (!receiveRequest(socket, body, fds)) _exit(0);
+                Reply reply = fds.size() > MAX_FDS ? Reply{-1, EMFILE, 1} : launchRequest(body, fds);
+                for (int fd : fds) ::close(fd);
+                if (!sendAll(socket, &reply, sizeof(reply))) _exit(0);
+            }
+        }
+    }
+
+public:
+    // Forks the server and has @jobs reap its children. Call it early: the server keeps what the shell
+    // had mapped at that point. false with errno set if it could not be started.
+    bool start(JobTable& jobs) {
+        if (running()) return true;
+        int sockets[2], statusPipe[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) < 0) return false;
+        if (pipe2(statusPipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+            int err = errno;
+            ::close(sockets[0]);
+            ::close(sockets[1]);
+            errno = err;
+            return false;
+        }
+        pid_t shell = getpid();
+        pid_t pid = fork();
+        if (pid == 0) {
+            ::close(sockets[0]);
+            ::close(statusPipe[0]);
+            serve(sockets[1], statusPipe[1], shell);
+        }
+        int err = errno;
+        ::close(sockets[1]);
+        ::close(statusPipe[1]);
+        if (pid < 0) {
+            ::close(sockets[0]);
+            ::close(statusPipe[0]);
+            errno = err;
+            return false;
+        }
+        prctl(PR_SET_CHILD_SUBREAPER, 1);
+        serverPid = pid;
+        owner = shell;
+        requestSocket = sockets[0];
+        // stays open for good: the job table reads it from its signal handler
+        jobs.reapFrom(statusPipe[0]);
+        return true;
+    }
+
+    bool running() const {
+        return serverPid > 0 && getpid() == owner;
+    }
+
+    pid_t pid() const { return serverPid; }
+
+    // Has the server start @path with @args (argv[0] included) as @launcher describes. Returns false if the
+    // server could not take the request, and the caller should launch locally; otherwise @pid is the child,
+    // or -1 with @err set when the program could not be started.
+    bool launch(const ProcessLauncher& launcher, const string& path, const vector<string>& args, pid_t& pid, int& err) {
+        if (!running()) return false;
+        vector<int> fds;
+        auto pass = [&](int fd) {
+            // a descriptor the shell doesn't have open is left closed in the child
+            if (fd < 0 || find(fds.begin(), fds.end(), fd) != fds.end() || fcntl(fd, F_GETFD) < 0) return;
+            fds.push_back(fd);
+        };
+        for (int fd = 0; fd <= 2; fd++) pass(fd);
+        for (const auto& action : launcher.actions) {
+            if (action.kind == ProcessLauncher::FdAction::Dup) pass(action.sourceFd);
+        }
+        pass(launcher.terminalFd);
+        if (fds.size() > MAX_FDS) return false;
+        char cwd[PATH_MAX];
+        if (getcwd(cwd, sizeof(cwd)) == nullptr) return false;
+
+        string body;
+        put(body, path);
+        put(body, string(cwd));
+        put(body, (int64_t) args.size());
+        for (const string& arg : args) put(body, arg);
+        int64_t variables = 0;
+        for (char** variable = environ; *variable != nullptr; variable++) variables++;
+        put(body, variables);
+        for (char** variable = environ; *variable != nullptr; variable++) put(body, string(*variable));
+        put(body, (int64_t) fds.size());
+        for (int fd : fds) put(body, (int64_t) fd);
+        put(body, (int64_t) launcher.actions.size());
+        for (const auto& action : launcher.actions) {
+            put(body, (int64_t) action.kind);
+            put(body, (int64_t) action.fd);
+            put(body, (int64_t) action.sourceFd);
+            put(body, action.path);
+            put(body, (int64_t) action.flags);
+            put(body, (int64_t) action.mode);
+        }
+        put(body, (int64_t) launcher.processGroup);
+        put(body, (int64_t) launcher.terminalFd);
+
+        RequestHeader header = {(uint32_t) body.size(), (uint32_t) fds.size()};
+        iovec part = {&header, sizeof(header)};
+        char control[CMSG_SPACE(sizeof(int) * MAX_FDS)] = {};
+        msghdr message = {};
+        message.msg_iov = &part;
+        message.msg_iovlen = 1;
+        if (!fds.empty()) {
+            message.msg_control = control;
+            message.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+            cmsghdr* c = CMSG_FIRSTHDR(&message);
+            c->cmsg_level = SOL_SOCKET;
+            c->cmsg_type = SCM_RIGHTS;
+            c->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+            memcpy(CMSG_DATA(c), fds.data(), sizeof(int) * fds.size());
+        }
+        ssize_t sent;
+        while ((sent = sendmsg(requestSocket, &message, MSG_NOSIGNAL)) < 0 && errno == EINTR) {}
+        Reply reply;
+        if (sent != sizeof(header) || !sendAll(requestSocket, body.data(), body.size()) ||
+            !receiveAll(requestSocket, &reply, sizeof(reply))) {
+            // the server is gone; everything from now on is launched locally
+            ::close(requestSocket);
+            requestSocket = -1;
+            serverPid = -1;
+            return false;
+        }
+        if (reply.refused) return false;
+        pid = reply.pid;
+        err = reply.err;
+        return true;
+    }
+};
+
+#endif // FORK_SERVER_CPP
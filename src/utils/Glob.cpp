@@ -0,0 +1,433 @@
+#ifndef GLOB_CPP
+#define GLOB_CPP
+#include <vector>
+#include <string>
+#include <string_view>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+using namespace std;
+
+// One path component of a glob pattern (*, ?, [...] with ranges and ! or ^ negation, \ escapes), compiled
+// into a bit-parallel NFA: bit i of the state is set while element i is the next to match, and a character
+// moves every active element at once through a 256-entry table of masks. Matching is linear in the name with
+// no backtracking, so a*a*a*a*b against a long run of a's costs the same as any other name.
+// Consecutive stars are merged; a pattern without metacharacters is kept as plain text.
+class GlobMatcher {
+    size_t elements = 0;
+    size_t words = 1;              // 64-bit words per state
+    vector<uint64_t> accepts;      // [byte * words + w]: the elements that accept the byte
+    vector<uint64_t> stars;        // elements that are *
+    bool literal = true;
+    string text;                   // the component with escapes removed, if literal
+    bool leadingDot = false;       // starts with a literal '.', so it may match hidden names
+    size_t minimumLength = 0;      // elements other than stars
+    string suffix;                 // the literal characters after the last star
+
+    static bool test(const uint64_t* bits, size_t i) { return bits[i / 64] >> (i % 64) & 1; }
+    static void set(uint64_t* bits, size_t i) { bits[i / 64] |= uint64_t(1) << (i % 64); }
+
+    // states |= (states & stars) << 1: a star may also match nothing
+    void closure(uint64_t* state) const {
+        uint64_t carry = 0;
+        for (size_t w = 0; w < words; w++) {
+            uint64_t skipped = state[w] & stars[w];
+            uint64_t shifted = (skipped << 1) | carry;
+            carry = skipped >> 63;
+            state[w] |= shifted;
+        }
+    }
+
+public:
+    GlobMatcher() = default;
+
+    explicit GlobMatcher(string_view pattern) {
+        // first pass: the elements, each as the set of bytes it accepts, or a star
+        vector<pair<bool, vector<bool>>> parsed;   // (star, accepted bytes)
+        for (size_t i = 0; i < pattern.size(); i++) {
+            char c = pattern[i];
+            if (c == '*') {
+                literal = false;
+                if (parsed.empty() || !parsed.back().first) parsed.push_back({true, {}});
+                continue;
+            }
+            vector<bool> accepted(256, false);
+            if (c == '?') {
+                literal = false;
+                accepted.assign(256, true);
+            }
+            else if (c == '[') {
+                // a class; without its closing ] the [ is an ordinary character
+                size_t j = i + 1;
+                bool negated = j < pattern.size() && (pattern[j] == '!' || pattern[j] == '^');
+                if (negated) j++;
+                vector<bool> members(256, false);
+                bool closed = false;
+                for (bool first = true; j < pattern.size(); first = false) {
+                    unsigned char from = pattern[j];
+                    if (from == ']' && !first) {
+                        closed = true;
+                        break;
+                    }
+                    if (from == '\\' && j + 1 < pattern.size()) from = pattern[++j];
+                    unsigned char to = from;
+                    if (j + 2 < pattern.size() && pattern[j + 1] == '-' && pattern[j + 2] != ']') {
+                        j += 2;
+                        to = pattern[j];
+                        if (to == '\\' && j + 1 < pattern.size()) to = pattern[++j];
+                    }
+                    for (unsigned b = from; b <= to; b++) members[b] = true;
+                    j++;
+                }
+                if (closed) {
+                    literal = false;
+                    for (int b = 0; b < 256; b++) accepted[b] = members[b] != negated;
+                    i = j;
+                }
+                else {
+                    accepted['['] = true;
+                    text += '[';
+                }
+            }
+            else {
+                if (c == '\\' && i + 1 < pattern.size()) c = pattern[++i];
+                if (parsed.empty() && c == '.') leadingDot = true;
+                accepted[(unsigned char) c] = true;
+                text += c;
+            }
+            parsed.push_back({false, move(accepted)});
+        }
+        if (literal) return;
+
+        elements = parsed.size();
+        for (size_t e = elements; e-- > 0 && !parsed[e].first;) {
+            if (count(parsed[e].second.begin(), parsed[e].second.end(), true) != 1) break;
+            suffix.insert(suffix.begin(), char(find(parsed[e].second.begin(), parsed[e].second.end(), true) -
+                                               parsed[e].second.begin()));
+        }
+        for (auto& element : parsed) minimumLength += !element.first;
+        words = elements / 64 + 1;   // bit `elements` is the accepting state
+        accepts.assign(256 * words, 0);
+        stars.assign(words, 0);
+        for (size_t e = 0; e < elements; e++) {
+            if (parsed[e].first) {
+                set(stars.data(), e);
+                for (int b = 0; b < 256; b++) set(&accepts[b * words], e);
+            }
+            else {
+                for (int b = 0; b < 256; b++) {
+                    if (parsed[e].second[b]) set(&accepts[b * words], e);
+                }
+            }
+        }
+    }
+
+    bool isLiteral() const { return literal; }
+
+    // the text a literal component matches
+    const string& literalText() const { return text; }
+
+    bool matches(string_view name) const {
+        if (literal) return name == text;
+        // hidden names only match a pattern that starts with a literal dot
+        if (!name.empty() && name[0] == '.' && !leadingDot) return false;
+
+        // cheap rejections first: too short, or not ending in the literal text after the last star
+        if (name.size() < minimumLength || !name.ends_with(suffix)) return false;
+
+        if (words == 1) {
+            // the whole state in one register
+            uint64_t star = stars[0];
+            uint64_t state = 1 | ((1 & star) << 1);
+            for (unsigned char c : name) {
+                uint64_t moved = state & accepts[c];
+                state = ((moved & ~star) << 1) | (moved & star);
+                if (state == 0) return false;
+                state |= (state & star) << 1;
+            }
+            return state >> elements & 1;
+        }
+
+        uint64_t small[2] = {1, 0}, next[2];
+        vector<uint64_t> large, largeNext;
+        uint64_t* state = small;
+        uint64_t* following = next;
+        if (words > 2) {
+            large.assign(words, 0);
+            largeNext.assign(words, 0);
+            large[0] = 1;
+            state = large.data();
+            following = largeNext.data();
+        }
+        closure(state);
+        for (unsigned char c : name) {
+            const uint64_t* accepted = &accepts[c * words];
+            // a matching element hands over to the next one; a star also keeps itself
+            uint64_t carry = 0, any = 0;
+            for (size_t w = 0; w < words; w++) {
+                uint64_t moved = state[w] & accepted[w];
+                uint64_t advanced = moved & ~stars[w];
+                following[w] = (advanced << 1) | carry | (moved & stars[w]);
+                carry = advanced >> 63;
+                any |= following[w];
+            }
+            if (any == 0) return false;
+            swap(state, following);
+            closure(state);
+        }
+        return test(state, elements);
+    }
+
+};
+
+// Expands a path pattern: a GlobMatcher per component, and ** for any number of directories (without
+// following symbolic links or entering hidden directories). Directories are read with getdents64 and each
+// is read once even where ** and the following component both look at it. A pattern ending in / matches
+// directories only. Results come out unsorted, as the walk finds them.
+//
+// Patterns with ** are walked by a pool of threads sharing a stack of directories still to read; each thread
+// hands its matches over in batches, so the callback runs on one thread at a time.
+class Glob {
+    enum class Kind { Literal, Pattern, Recursive };
+
+    typedef struct {
+        Kind kind;
+        GlobMatcher matcher;
+    } Component;
+
+    typedef struct {
+        string directory;   // "" for the working directory, otherwise ending in '/'
+        size_t component;   // the first component still to match inside it
+    } Item;
+
+    static constexpr size_t READ_SIZE = 64 << 10;
+    static constexpr size_t BATCH = 256;
+
+    struct dirent64Record {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+    };
+
+    string root;
+    vector<Component> components;
+    bool directoriesOnly = false;
+
+    // walk state
+    mutex queueLock;
+    condition_variable queueChanged;
+    vector<Item> pending;
+    size_t busy = 0;
+    mutex outputLock;
+    atomic<bool> stopped = false;
+    const function<bool(const string&)>* consumer = nullptr;
+
+    struct Worker {
+        vector<char> buffer = vector<char>(READ_SIZE);
+        vector<string> matches;
+        vector<Item> found;     // directories to walk, handed to the shared stack after each one is read
+    };
+
+    static bool isDirectory(const string& path, unsigned char type, bool followLinks) {
+        if (type == DT_DIR) return true;
+        if (type != DT_UNKNOWN && !(type == DT_LNK && followLinks)) return false;
+        struct stat st;
+        int result = followLinks ? stat(path.c_str(), &st) : lstat(path.c_str(), &st);
+        return result == 0 && S_ISDIR(st.st_mode);
+    }
+
+    void flush(Worker& worker) {
+        if (worker.matches.empty()) return;
+        lock_guard<mutex> guard(outputLock);
+        for (const string& match : worker.matches) {
+            if (stopped) break;
+            if (!(*consumer)(match)) stopped = true;
+        }
+        worker.matches.clear();
+    }
+
+    void emit(Worker& worker, string path) {
+        worker.matches.push_back(move(path));
+        if (worker.matches.size() >= BATCH) flush(worker);
+    }
+
+    // an entry of @directory against component @c (which may be past the last one, after a final **)
+    void matchEntry(Worker& worker, const string& directory, string_view name, unsigned char type, size_t c) {
+        if (c == components.size()) {
+            // what a final ** matches: everything that isn't hidden
+            if (name[0] == '.') return;
+            string path = directory + string(name);
+            if (directoriesOnly && !isDirectory(path, type, false)) return;
+            emit(worker, directoriesOnly ? path + "/" : path);
+            return;
+        }
+        const Component& component = components[c];
+        if (!component.matcher.matches(name)) return;
+        string path = directory + string(name);
+        if (c + 1 == components.size()) {
+            if (directoriesOnly && !isDirectory(path, type, true)) return;
+            emit(worker, directoriesOnly ? path + "/" : path);
+        }
+        else if (isDirectory(path, type, true)) {
+            worker.found.push_back({path + "/", c + 1});
+        }
+    }
+
+    void process(Worker& worker, const Item& item) {
+        const Component& component = components[item.component];
+        bool last = item.component + 1 == components.size();
+        if (component.kind == Kind::Literal) {
+            // nothing to list: the name is known
+            string path = item.directory + component.matcher.literalText();
+            struct stat st;
+            if (last) {
+                bool exists = directoriesOnly ? stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode) : lstat(path.c_str(), &st) == 0;
+                if (exists) emit(worker, directoriesOnly ? path + "/" : path);
+            }
+            else if (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+                worker.found.push_back({path + "/", item.component + 1});
+            }
+            return;
+        }
+
+        int fd = ::open(item.directory.empty() ? "." : item.directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) return;
+        bool recursive = component.kind == Kind::Recursive;
+        long n;
+        while (!stopped && (n = syscall(SYS_getdents64, fd, worker.buffer.data(), worker.buffer.size())) > 0) {
+            for (long at = 0; at < n;) {
+                auto* record = reinterpret_cast<dirent64Record*>(worker.buffer.data() + at);
+                at += record->d_reclen;
+                string_view name = record->d_name;
+                if (name == "." || name == "..") continue;
+                if (recursive) {
+                    if (name[0] != '.' && isDirectory(item.directory + string(name), record->d_type, false)) {
+                        worker.found.push_back({item.directory + string(name) + "/", item.component});
+                    }
+                    // ** also matches no directory at all: the rest of the pattern applies right here
+                    matchEntry(worker, item.directory, name, record->d_type, item.component + 1);
+                }
+                else {
+                    matchEntry(worker, item.directory, name, record->d_type, item.component);
+                }
+            }
+        }
+        ::close(fd);
+    }
+
+    // with queueLock held by @guard: hands over the directories found, takes the next one
+    bool nextItem(Worker& worker, unique_lock<mutex>& guard, Item& item) {
+        for (Item& found : worker.found) pending.push_back(move(found));
+        worker.found.clear();
+        queueChanged.notify_all();
+        while (pending.empty() && busy > 0 && !stopped) queueChanged.wait(guard);
+        if (pending.empty() || stopped) return false;
+        item = move(pending.back());
+        pending.pop_back();
+        busy++;
+        return true;
+    }
+
+    void work() {
+        Worker worker;
+        unique_lock<mutex> guard(queueLock);
+        Item item;
+        while (nextItem(worker, guard, item)) {
+            guard.unlock();
+            process(worker, item);
+            guard.lock();
+            busy--;
+        }
+        queueChanged.notify_all();
+        guard.unlock();
+        flush(worker);
+    }
+
+public:
+    // @pattern as the lexer gives it: quoted glob characters escaped with '\'
+    explicit Glob(string_view pattern) {
+        if (pattern.starts_with('/')) root = "/";
+        directoriesOnly = pattern.size() > 1 && pattern.ends_with('/');
+        size_t start = 0;
+        while (start < pattern.size()) {
+            size_t slash = pattern.find('/', start);
+            if (slash == string_view::npos) slash = pattern.size();
+            string_view part = pattern.substr(start, slash - start);
+            start = slash + 1;
+            if (part.empty()) continue;
+            if (part == "**") {
+                // **/** is the same as **
+                if (components.empty() || components.back().kind != Kind::Recursive) {
+                    components.push_back({Kind::Recursive, GlobMatcher()});
+                }
+                continue;
+            }
+            GlobMatcher matcher(part);
+            components.push_back({matcher.isLiteral() ? Kind::Literal : Kind::Pattern, move(matcher)});
+        }
+    }
+
+    // a pattern matching exactly @text
+    static string escape(string_view text) {
+        string escaped;
+        for (char c : text) {
+            if (c == '*' || c == '?' || c == '[' || c == ']' || c == '\\') escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    bool recursive() const {
+        for (const Component& component : components) {
+            if (component.kind == Kind::Recursive) return true;
+        }
+        return false;
+    }
+
+    // Calls @onMatch with every path the pattern matches, in no particular order, until it returns false.
+    // A recursive pattern is walked by up to @threads threads (0: one per core). Returns false if stopped.
+    bool expand(const function<bool(const string&)>& onMatch, unsigned threads = 0) {
+        if (components.empty()) return true;
+        consumer = &onMatch;
+        stopped = false;
+        pending.assign(1, {root, 0});
+        busy = 0;
+        if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+        if (!recursive()) threads = 1;
+
+        vector<thread> helpers;
+        for (unsigned t = 1; t < threads; t++) helpers.emplace_back([this]() { work(); });
+        work();
+        for (thread& helper : helpers) helper.join();
+        return !stopped;
+    }
+
+    // Expands @pattern and sorts the matches, the way they become arguments. Stops and returns false once the
+    // matches would take more than @budget bytes of argv.
+    static bool expandSorted(string_view pattern, vector<string>& matches, size_t budget) {
+        size_t used = 0;
+        bool complete = Glob(pattern).expand([&](const string& match) {
+            used += match.size() + 1 + sizeof(char*);
+            if (used > budget) return false;
+            matches.push_back(match);
+            return true;
+        });
+        sort(matches.begin(), matches.end());
+        return complete;
+    }
+};
+
+#endif // GLOB_CPP
@@ -0,0 +1,267 @@
+#ifndef HISTORY_STORE_CPP
+#define HISTORY_STORE_CPP
+#include <vector>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+using namespace std;
+
+// Command history kept in a fixed-size ring, optionally backed by an append-only history file.
+// Every entry has a sequence number that keeps growing as old entries fall out of the ring; `history`
+// shows these numbers. Substring search goes through a trigram index: the rarest trigram of the pattern
+// narrows the candidates down before they are checked with a plain substring search.
+// On open(), only the tail of the file that fits in the ring is read (from a memory mapping, scanning
+// backwards), so startup does not depend on how long the file has grown.
+class HistoryStore {
+public:
+    enum class Dedup {
+        None,         // keep every command
+        IgnoreDups,   // don't store a command equal to the previous one
+        EraseDups,    // drop older copies of a command when it is stored again
+    };
+
+private:
+    static constexpr uint64_t ERASED = UINT64_MAX;
+
+    size_t capacity;
+    Dedup dedup;
+    vector<string> ring;         // slot = sequence % capacity
+    vector<uint64_t> sequences;  // sequence stored in each slot, ERASED if the slot was erased as a dup
+    uint64_t firstSequence = 1;  // oldest sequence that may still be in the ring
+    uint64_t nextSequence = 1;
+    size_t held = 0;
+
+    unordered_map<uint32_t, vector<uint64_t>> postings; // trigram -> sequences, oldest first
+    size_t stalePostings = 0;
+    size_t livePostings = 0;
+
+    int fileFd = -1;
+
+    static uint32_t trigram(const char* p) {
+        return (uint32_t) (unsigned char) p[0] << 16 | (uint32_t) (unsigned char) p[1] << 8 | (unsigned char) p[2];
+    }
+
+    size_t slot(uint64_t sequence) const { return sequence % capacity; }
+
+    void index(const string& command, uint64_t sequence) {
+        for (size_t i = 0; i + 3 <= command.size(); i++) {
+            vector<uint64_t>& list = postings[trigram(command.data() + i)];
+            if (list.empty() || list.back() != sequence) {
+                list.push_back(sequence);
+                livePostings++;
+            }
+        }
+    }
+
+    void forgetPostings(const string& command) {
+        // postings are pruned lazily; only count them so that compactIfNeeded() knows when it pays off
+        size_t distinct = command.size() >= 3 ? command.size() - 2 : 0;
+        stalePostings += distinct;
+    }
+
+    // Drops postings of entries that left the ring once they make up half of the index.
+    void compactIfNeeded() {
+        if (stalePostings < 4096 || stalePostings < livePostings / 2) return;
+        livePostings = 0;
+        for (auto it = postings.begin(); it != postings.end();) {
+            vector<uint64_t>& list = it->second;
+            size_t kept = 0;
+            for (uint64_t sequence : list) {
+                if (contains(sequence)) list[kept++] = sequence;
+            }
+            list.resize(kept);
+            livePostings += kept;
+            if (list.empty()) it = postings.erase(it);
+            else ++it;
+        }
+        stalePostings = 0;
+    }
+
+    // Returns false if the command was dropped as a repeat of the previous one.
+    bool store(const string& command) {
+        if (dedup == Dedup::IgnoreDups && held > 0) {
+            uint64_t last = nextSequence - 1;
+            if (contains(last) && ring[slot(last)] == command) return false;
+        }
+        if (dedup == Dedup::EraseDups) {
+            for (uint64_t sequence = firstSequence; sequence < nextSequence; sequence++) {
+                if (contains(sequence) && ring[slot(sequence)] == command) {
+                    forgetPostings(ring[slot(sequence)]);
+                    sequences[slot(sequence)] = ERASED;
+                    ring[slot(sequence)].clear();
+                    held--;
+                }
+            }
+        }
+
+        uint64_t sequence = nextSequence++;
+        if (nextSequence - firstSequence > capacity) {
+            if (contains(firstSequence)) {
+                forgetPostings(ring[slot(firstSequence)]);
+                held--;
+            }
+            firstSequence++;
+        }
+        ring[slot(sequence)] = command;
+        held++;
+        sequences[slot(sequence)] = sequence;
+        index(command, sequence);
+        compactIfNeeded();
+        return true;
+    }
+
+    bool matches(uint64_t sequence, string_view pattern) const {
+        return contains(sequence) && string_view(ring[slot(sequence)]).find(pattern) != string_view::npos;
+    }
+
+    // Returns the posting list of the rarest trigram in the pattern, or nullptr if some trigram never occurs.
+    const vector<uint64_t>* rarestPostings(string_view pattern, bool& none) const {
+        const vector<uint64_t>* best = nullptr;
+        none = false;
+        for (size_t i = 0; i + 3 <= pattern.size(); i++) {
+            auto it = postings.find(trigram(pattern.data() + i));
+            if (it == postings.end()) {
+                none = true;
+                return nullptr;
+            }
+            if (best == nullptr || it->second.size() < best->size()) best = &it->second;
+        }
+        return best;
+    }
+
+public:
+    explicit HistoryStore(size_t capacity = 100000, Dedup dedup = Dedup::None) : capacity(capacity ? capacity : 1), dedup(dedup) {
+        ring.resize(this->capacity);
+        sequences.assign(this->capacity, ERASED);
+    }
+
+    ~HistoryStore() {
+        if (fileFd >= 0) close(fileFd);
+    }
+
+    // Changes the ring size and dedup mode; entries that no longer fit are dropped. Must precede open().
+    void configure(size_t newCapacity, Dedup newDedup) {
+        vector<string> kept;
+        for (uint64_t sequence = firstSequence; sequence < nextSequence; sequence++) {
+            if (contains(sequence)) kept.push_back(ring[slot(sequence)]);
+        }
+        capacity = newCapacity ? newCapacity : 1;
+        dedup = newDedup;
+        ring.assign(capacity, "");
+        sequences.assign(capacity, ERASED);
+        postings.clear();
+        stalePostings = livePostings = 0;
+        firstSequence = nextSequence = 1;
+        held = 0;
+        size_t start = kept.size() > capacity ? kept.size() - capacity : 0;
+        for (size_t i = start; i < kept.size(); i++) store(kept[i]);
+    }
+
+    // Loads the newest entries of the history file and appends every later command to it.
+    // Returns false if the file can't be opened for appending.
+    bool open(const string& path) {
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+        if (fd < 0) return false;
+
+        struct stat sb;
+        if (fstat(fd, &sb) == 0 && sb.st_size > 0) {
+            void* mapped = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                const char* data = (const char*) mapped;
+                size_t end = sb.st_size;
+                if (data[end - 1] == '\n') end--;
+
+                // walk backwards until the ring is full, then store the lines oldest first
+                vector<string_view> tail;
+                while (tail.size() < capacity) {
+                    const char* newline = (const char*) memrchr(data, '\n', end);
+                    size_t start = newline != nullptr ? newline - data + 1 : 0;
+                    tail.emplace_back(data + start, end - start);
+                    if (newline == nullptr) break;
+                    end = start - 1;
+                }
+                for (auto it = tail.rbegin(); it != tail.rend(); ++it) {
+                    if (!it->empty()) store(string(*it));
+                }
+                munmap(mapped, sb.st_size);
+            }
+        }
+
+        if (fileFd >= 0) close(fileFd);
+        fileFd = fd;
+        return true;
+    }
+
+    // Records a command, appending it to the history file if there is one.
+    void add(const string& command) {
+        if (store(command) && fileFd >= 0) {
+            string line = command + "\n";
+            if (write(fileFd, line.data(), line.size()) < 0) {
+                // a full disk must not break the shell; the entry is still in memory
+            }
+        }
+    }
+
+    // Number of entries currently held.
+    size_t size() const { return held; }
+
+    uint64_t oldest() const { return firstSequence; }
+    uint64_t newest() const { return nextSequence - 1; }
+
+    // True if the entry with this sequence number is still held.
+    bool contains(uint64_t sequence) const {
+        return sequence >= firstSequence && sequence < nextSequence && sequences[slot(sequence)] == sequence;
+    }
+
+    const string& at(uint64_t sequence) const { return ring[slot(sequence)]; }
+
+    // Returns the newest entry older than @before that contains @pattern, or 0 if there is none.
+    uint64_t searchBackward(string_view pattern, uint64_t before) const {
+        if (before > nextSequence) before = nextSequence;
+        if (pattern.size() < 3) {
+            for (uint64_t sequence = before; sequence-- > firstSequence;) {
+                if (matches(sequence, pattern)) return sequence;
+            }
+            return 0;
+        }
+
+        bool none;
+        const vector<uint64_t>* candidates = rarestPostings(pattern, none);
+        if (none) return 0;
+        auto it = lower_bound(candidates->begin(), candidates->end(), before);
+        while (it != candidates->begin()) {
+            uint64_t sequence = *--it;
+            if (sequence < firstSequence) break;
+            if (matches(sequence, pattern)) return sequence;
+        }
+        return 0;
+    }
+
+    // Returns every held entry that contains @pattern, oldest first.
+    vector<uint64_t> searchAll(string_view pattern) const {
+        vector<uint64_t> result;
+        if (pattern.size() < 3) {
+            for (uint64_t sequence = firstSequence; sequence < nextSequence; sequence++) {
+                if (matches(sequence, pattern)) result.push_back(sequence);
+            }
+            return result;
+        }
+
+        bool none;
+        const vector<uint64_t>* candidates = rarestPostings(pattern, none);
+        if (none) return result;
+        for (uint64_t sequence : *candidates) {
+            if (matches(sequence, pattern)) result.push_back(sequence);
+        }
+        return result;
+    }
+};
+
+#endif // HISTORY_STORE_CPP
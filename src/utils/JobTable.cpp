@@ -0,0 +1,308 @@
+#ifndef JOB_TABLE_CPP
+#define JOB_TABLE_CPP
+#include <map>
+#include <set>
+#include <vector>
+#include <string>
+#include <csignal>
+#include <cerrno>
+#include <ctime>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <unistd.h>
+using namespace std;
+
+enum class JobState {
+    Running,
+    Stopped,   // at least one process was stopped, e.g. by Ctrl-Z
+    Done,      // every process exited or was killed
+};
+
+typedef struct {
+    int id;
+    pid_t processGroup;    // 0 if the processes stayed in the shell's process group
+    vector<pid_t> pids;
+    vector<int> statuses;  // last wait status of each process
+    vector<bool> exited;
+    vector<struct rusage> usages;  // resources used by each process that exited
+    vector<double> exitTimes;      // CLOCK_MONOTONIC seconds at which each process was reaped
+    string command;
+    JobState state;
+    bool background;
+    bool changed;          // state changed since it was last reported
+} Job;
+
+// Pipelines started by the shell, foreground and background. Children are reaped asynchronously: the
+// SIGCHLD handler collects their wait statuses and resource usage (wait4) into a fixed array, and the shell
+// folds them into the table whenever it looks at it, with SIGCHLD blocked. Waiting for a job is a sigsuspend()
+// loop, so the shell never blocks in waitpid() on one process while others change state.
+// Children started by the fork server are its own; it reaps them and sends their statuses down a pipe,
+// which the handler reads along with wait4().
+class JobTable {
+public:
+    typedef struct {
+        pid_t pid;
+        int status;
+        struct rusage usage;
+        double time;      // CLOCK_MONOTONIC seconds
+    } ChildStatus;
+
+private:
+
+    static constexpr int MAX_PENDING = 256;
+    static inline ChildStatus pending[MAX_PENDING];
+    static inline volatile sig_atomic_t pendingCount = 0;
+    static inline int statusFd = -1;      // read end of the fork server's status pipe, non-blocking
+    static inline pid_t statusOwner = 0;  // the shell itself; its forked children leave the pipe alone
+
+    map<int, Job> jobList;
+    map<pid_t, ChildStatus> unclaimed; // processes that exited but belong to no job (yet)
+    set<pid_t> abandoned;              // processes in no job that nobody waits for; dropped once they exit
+
+    // only async-signal-safe calls in here; leaves the remaining children for later once the array is full
+    static void reap() {
+        int savedErrno = errno;
+        pid_t pid;
+        int status;
+        struct rusage usage;
+        while (pendingCount < MAX_PENDING && (pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+            timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            pending[pendingCount].pid = pid;
+            pending[pendingCount].status = status;
+            pending[pendingCount].usage = usage;
+            pending[pendingCount].time = now.tv_sec + now.tv_nsec / 1e9;
+            pendingCount = pendingCount + 1;
+        }
+        // records are written whole (less than PIPE_BUF each), so a read gets one or nothing
+        if (statusFd >= 0 && getpid() == statusOwner) {
+            while (pendingCount < MAX_PENDING &&
+                   read(statusFd, &pending[pendingCount], sizeof(ChildStatus)) == sizeof(ChildStatus)) {
+                pendingCount = pendingCount + 1;
+            }
+        }
+        errno = savedErrno;
+    }
+
+    static void onChildSignal(int) {
+        reap();
+    }
+
+    // checked every time rather than remembered, since forked children reset their signal handlers
+    static bool installed() {
+        struct sigaction current;
+        sigaction(SIGCHLD, nullptr, &current);
+        return current.sa_handler == onChildSignal;
+    }
+
+    // Blocks SIGCHLD for the lifetime of the scope.
+    class ChildSignalBlock {
+        sigset_t previous;
+    public:
+        ChildSignalBlock() {
+            sigset_t block;
+            sigemptyset(&block);
+            sigaddset(&block, SIGCHLD);
+            sigprocmask(SIG_BLOCK, &block, &previous);
+        }
+        ~ChildSignalBlock() { sigprocmask(SIG_SETMASK, &previous, nullptr); }
+        const sigset_t& previousMask() const { return previous; }
+    };
+
+    static bool hasExited(int status) {
+        return WIFEXITED(status) || WIFSIGNALED(status);
+    }
+
+    static void refreshState(Job& job) {
+        bool allExited = true;
+        bool anyStopped = false;
+        for (size_t i = 0; i < job.pids.size(); i++) {
+            if (job.exited[i]) continue;
+            allExited = false;
+            if (WIFSTOPPED(job.statuses[i])) anyStopped = true;
+        }
+        JobState state = allExited ? JobState::Done : anyStopped ? JobState::Stopped : JobState::Running;
+        if (state != job.state) {
+            job.state = state;
+            job.changed = true;
+        }
+    }
+
+    static void record(Job& job, size_t i, const ChildStatus& child) {
+        job.statuses[i] = child.status;
+        job.exited[i] = hasExited(child.status);
+        if (job.exited[i]) {
+            job.usages[i] = child.usage;
+            job.exitTimes[i] = child.time;
+        }
+    }
+
+    void apply(const ChildStatus& child) {
+        for (auto& [id, job] : jobList) {
+            for (size_t i = 0; i < job.pids.size(); i++) {
+                if (job.pids[i] != child.pid) continue;
+                record(job, i, child);
+                refreshState(job);
+                return;
+            }
+        }
+        if (!hasExited(child.status) || abandoned.erase(child.pid) > 0) return;
+        unclaimed[child.pid] = child;
+    }
+
+    // must be called with SIGCHLD blocked
+    void drain() {
+        while (true) {
+            reap();
+            if (pendingCount == 0) return;
+            for (int i = 0; i < pendingCount; i++) apply(pending[i]);
+            pendingCount = 0;
+        }
+    }
+
+public:
+    // Installs the SIGCHLD handler. From then on every child of the shell is reaped through the table.
+    void install() {
+        if (installed()) return;
+        struct sigaction action = {};
+        action.sa_handler = onChildSignal;
+        action.sa_flags = SA_RESTART; // a finished background job must not interrupt the line editor
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGCHLD, &action, nullptr);
+    }
+
+    // Also reaps the ChildStatus records that arrive on @fd (non-blocking), from a process that starts children
+    // for the shell and sends it SIGCHLD after writing.
+    void reapFrom(int fd) {
+        ChildSignalBlock block;
+        statusFd = fd;
+        statusOwner = getpid();
+        install();
+    }
+
+    // Registers the processes of a pipeline that was just started and returns the new job.
+    Job& add(pid_t processGroup, const vector<pid_t>& pids, const string& command, bool background) {
+        install();
+        ChildSignalBlock block;
+        int id = jobList.empty() ? 1 : jobList.rbegin()->first + 1;
+        Job& job = jobList[id];
+        job = Job{id, processGroup, pids, vector<int>(pids.size(), 0), vector<bool>(pids.size(), false),
+                  vector<struct rusage>(pids.size()), vector<double>(pids.size(), 0), command, JobState::Running,
+                  background, false};
+        // processes that finished before they were registered
+        for (size_t i = 0; i < pids.size(); i++) {
+            auto it = unclaimed.find(pids[i]);
+            if (it == unclaimed.end()) continue;
+            record(job, i, it->second);
+            unclaimed.erase(it);
+        }
+        refreshState(job);
+        job.changed = false;
+        drain();
+        return job;
+    }
+
+    // Folds in everything that happened to children since the last call.
+    void update() {
+        if (!installed()) return;
+        ChildSignalBlock block;
+        drain();
+    }
+
+    // Folds in child statuses until @done returns true, sleeping in between. Any signal wakes the loop up,
+    // so @done can also watch flags set by signal handlers.
+    template <typename Predicate>
+    void waitUntil(Predicate done) {
+        install();
+        ChildSignalBlock block;
+        while (true) {
+            drain();
+            if (done()) return;
+            sigsuspend(&block.previousMask());
+        }
+    }
+
+    // Takes the exit status of a child that is not part of any job, if it has exited. Meant for waitUntil().
+    bool takeExitStatus(pid_t pid, int& status) {
+        auto it = unclaimed.find(pid);
+        if (it == unclaimed.end()) return false;
+        status = it->second.status;
+        unclaimed.erase(it);
+        return true;
+    }
+
+    // Gives up on a child that is not part of any job: its exit status is dropped, now or once it exits, so that
+    // a later child with the same pid isn't taken to have exited already.
+    void abandon(pid_t pid) {
+        if (!installed()) return;
+        ChildSignalBlock block;
+        drain();
+        if (unclaimed.erase(pid) == 0) abandoned.insert(pid);
+    }
+
+    // Waits until the job stops running: every process exited, or one of them was stopped.
+    void waitWhileRunning(Job& job) {
+        waitUntil([&]() { return job.state != JobState::Running; });
+    }
+
+    // Waits until every process of the job exited.
+    void waitUntilDone(Job& job) {
+        waitUntil([&]() { return job.state == JobState::Done; });
+    }
+
+    // Waits for a child that is not part of any job and returns its wait status.
+    int waitForPid(pid_t pid) {
+        int status = 0;
+        if (!installed()) {
+            while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+            return status;
+        }
+        waitUntil([&]() { return takeExitStatus(pid, status); });
+        return status;
+    }
+
+    // Marks the stopped processes of the job as running again, after it was sent SIGCONT.
+    void markContinued(Job& job) {
+        ChildSignalBlock block;
+        for (size_t i = 0; i < job.pids.size(); i++) {
+            if (!job.exited[i]) job.statuses[i] = 0;
+        }
+        refreshState(job);
+        job.changed = false;
+    }
+
+    // A wait status as the shell reports it: the exit code, 128+n if the process was killed or stopped by signal n.
+    static int exitStatus(int status) {
+        if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+        if (WIFSTOPPED(status)) return 128 + WSTOPSIG(status);
+        return WEXITSTATUS(status);
+    }
+
+    // Exit status of the job in the shell's sense: that of its last process.
+    static int exitStatus(const Job& job) {
+        if (job.pids.empty()) return 0;
+        return exitStatus(job.statuses.back());
+    }
+
+    Job* find(int id) {
+        auto it = jobList.find(id);
+        return it == jobList.end() ? nullptr : &it->second;
+    }
+
+    // The job `fg` and `bg` act on by default (%+): the newest one.
+    Job* current() {
+        return jobList.empty() ? nullptr : &jobList.rbegin()->second;
+    }
+
+    // The job before the current one (%-).
+    Job* previous() {
+        if (jobList.size() < 2) return nullptr;
+        return &next(jobList.rbegin())->second;
+    }
+
+    void remove(int id) { jobList.erase(id); }
+
+    map<int, Job>& all() { return jobList; }
+};
+
+#endif // JOB_TABLE_CPP
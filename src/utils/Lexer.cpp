@@ -0,0 +1,508 @@
+#ifndef LEXER_CPP
+#define LEXER_CPP
+#include <vector>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LEXER_HAS_X86_SIMD 1
+#endif
+using namespace std;
+
+enum class TokenKind {
+    Word,
+    Pipe,              // |
+    RedirectStdout,    // > or 1>
+    AppendStdout,      // >> or 1>>
+    RedirectStderr,    // 2>
+    AppendStderr,      // 2>>
+    Background,        // &
+    RedirectStdin,     // <
+    HereDocument,      // << or <<-
+    HereString,        // <<<
+    Separator,         // ; or a newline
+    And,               // &&
+    Or,                // ||
+    OpenParen,         // (
+    CloseParen,        // )
+    ProcessOutput,     // <(command): a path to read what the command writes
+    ProcessInput,      // >(command): a path to write to what the command reads
+};
+
+enum class WordPartKind {
+    Literal,
+    Variable,          // $name, ${name} or one of $? $# $@ $* $0-$9
+};
+
+// a piece of a word that has expansions, in order
+typedef struct {
+    WordPartKind kind;
+    string_view text;     // the literal text after quote removal, or the variable's name
+    bool quoted;          // a variable inside double quotes, whose value isn't split into fields
+    string_view pattern;  // literal parts of a glob word: the text with the quoted glob characters escaped
+} WordPart;
+
+typedef struct {
+    TokenKind kind;
+    string_view text;  // the word after quote removal (without its expansions), the operator as written, or the
+                       // command of a process substitution
+    bool glob;         // the word has an unquoted *, ? or [ and is a pattern for path expansion
+    string_view pattern; // if glob: the word after quote removal, with the quoted glob characters escaped by '\\'
+    uint32_t firstPart;  // the word has expansions: its parts are parts()[firstPart, firstPart + partCount)
+    uint32_t partCount;
+    string_view hereDocument = {};  // <<, <<-: the lines after the command's line up to the delimiter, as written
+    bool hereDocumentExpands = false;  // <<, <<-: the delimiter wasn't quoted, so $ in those lines expands
+} Token;
+
+// Single-pass command line lexer. Words that contain no quotes or backslashes are returned as views
+// into the input line; only words that need unescaping are copied, into a scratch buffer that is
+// reused between lines. Runs of ordinary characters are skipped with SSE2/AVX2 where available.
+// Words with unquoted glob characters are flagged, and for those that also have quoting a glob pattern is kept
+// next to the unescaped text, so that "*.log" or \* stay literal when the word is expanded.
+// Words with $ expansions outside single quotes are also split into parts, literal text and variables, which
+// the shell puts together when the word is used; a newline separates commands like ;. The lines that follow
+// a line with here-documents (<<word) are their contents and are handed out with the << tokens.
+// <(command) and >(command) are one token each, holding the command as written; the shell lexes it when it runs it.
+// Token views stay valid until the next call to tokenize() and as long as the input line lives.
+class Lexer {
+    vector<Token> tokenList;
+    vector<WordPart> partList;
+    vector<size_t> openHereDocuments;   // << tokens whose lines haven't been read yet
+    bool unterminated = false;
+    size_t unterminatedAt = 0;          // the << token whose delimiter never came
+    string scratch;
+    string patternScratch;
+    string errorMessage;
+
+    // Returns the length of the prefix of [p, p+n) that contains none of the @count bytes in @set.
+    static size_t spanNone(const char* p, size_t n, const char* set, int count) {
+        size_t i = 0;
+#ifdef LEXER_HAS_X86_SIMD
+        static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+        if (hasAvx2) {
+            i = spanNoneAvx2(p, n, set, count);
+            if (i < n && isInSet(p[i], set, count)) return i;
+        }
+        i = spanNoneSse2(p, n, set, count, i);
+        if (i < n && isInSet(p[i], set, count)) return i;
+#endif
+        while (i < n && !isInSet(p[i], set, count)) i++;
+        return i;
+    }
+
+    static bool isInSet(char c, const char* set, int count) {
+        for (int k = 0; k < count; k++) {
+            if (c == set[k]) return true;
+        }
+        return false;
+    }
+
+#ifdef LEXER_HAS_X86_SIMD
+    // Both SIMD helpers stop at the first matching byte or at the last full vector, whichever is first;
+    // the caller finishes the tail with the scalar loop.
+    __attribute__((target("avx2")))
+    static size_t spanNoneAvx2(const char* p, size_t n, const char* set, int count) {
+        size_t i = 0;
+        for (; i + 32 <= n; i += 32) {
+            __m256i chunk = _mm256_loadu_si256((const __m256i*) (p + i));
+            __m256i hits = _mm256_setzero_si256();
+            for (int k = 0; k < count; k++) {
+                hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(set[k])));
+            }
+            uint32_t mask = _mm256_movemask_epi8(hits);
+            if (mask != 0) return i + __builtin_ctz(mask);
+        }
+        return i;
+    }
+
+    static size_t spanNoneSse2(const char* p, size_t n, const char* set, int count, size_t i) {
+        for (; i + 16 <= n; i += 16) {
+            __m128i chunk = _mm_loadu_si128((const __m128i*) (p + i));
+            __m128i hits = _mm_setzero_si128();
+            for (int k = 0; k < count; k++) {
+                hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(set[k])));
+            }
+            uint32_t mask = _mm_movemask_epi8(hits);
+            if (mask != 0) return i + __builtin_ctz(mask);
+        }
+        return i;
+    }
+#endif
+
+    static bool isBlank(char c) {
+        return c == ' ' || c == '\t';
+    }
+
+    static bool isOperatorStart(char c) {
+        return c == '|' || c == '>' || c == '<' || c == '&' || c == ';' || c == '\n' || c == '(' || c == ')';
+    }
+
+    static bool isNameStart(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+    }
+
+    static bool isNameChar(char c) {
+        return isNameStart(c) || (c >= '0' && c <= '9');
+    }
+
+    static bool isSpecialParameter(char c) {
+        return c == '?' || c == '#' || c == '@' || c == '*' || (c >= '0' && c <= '9');
+    }
+
+    static constexpr char GLOB[] = {'*', '?', '['};
+
+    // the unquoted glob characters of a word, and those that must be escaped in a pattern to be taken literally
+    static bool hasGlob(string_view s) {
+        return spanNone(s.data(), s.size(), GLOB, sizeof(GLOB)) < s.size();
+    }
+
+    // appends quoted text to the pattern, escaping what the matcher would otherwise read as pattern syntax
+    void appendQuoted(string_view text) {
+        for (char c : text) {
+            if (c == '*' || c == '?' || c == '[' || c == ']' || c == '\\') patternScratch.push_back('\\');
+            patternScratch.push_back(c);
+        }
+    }
+
+    // characters that end a run of ordinary unquoted characters
+    static constexpr char SPECIAL[] = {' ', '\t', '\\', '\'', '"', '|', '>', '<', '&', ';', '\n', '(', ')', '$'};
+
+    bool fail(const string& message) {
+        errorMessage = "syntax error: " + message;
+        return false;
+    }
+
+    // Lexes the operator starting at @i (the caller checked it is one) and returns the index after it.
+    size_t lexOperator(string_view s, size_t i) {
+        size_t start = i;
+        TokenKind kind;
+        if (s[i] == '|' || s[i] == '&') {
+            // doubled, they are && and ||
+            bool doubled = i + 1 < s.size() && s[i + 1] == s[i];
+            if (s[i] == '|') kind = doubled ? TokenKind::Or : TokenKind::Pipe;
+            else kind = doubled ? TokenKind::And : TokenKind::Background;
+            i += doubled ? 2 : 1;
+        } else if (s[i] == ';' || s[i] == '\n') {
+            kind = TokenKind::Separator;
+            i++;
+        } else if (s[i] == '(' || s[i] == ')') {
+            kind = s[i] == '(' ? TokenKind::OpenParen : TokenKind::CloseParen;
+            i++;
+        } else if (s[i] == '<') {
+            size_t count = 1;
+            while (count < 3 && i + count < s.size() && s[i + count] == '<') count++;
+            kind = count == 1 ? TokenKind::RedirectStdin : count == 2 ? TokenKind::HereDocument : TokenKind::HereString;
+            i += count;
+            if (kind == TokenKind::HereDocument) {
+                if (i < s.size() && s[i] == '-') i++;   // <<- strips leading tabs from the lines
+                openHereDocuments.push_back(tokenList.size());
+            }
+        } else {
+            bool stderrRedirect = s[i] == '2';
+            if (s[i] != '>') i++; // skip the fd digit
+            i++;
+            bool append = i < s.size() && s[i] == '>';
+            if (append) i++;
+            if (stderrRedirect) kind = append ? TokenKind::AppendStderr : TokenKind::RedirectStderr;
+            else kind = append ? TokenKind::AppendStdout : TokenKind::RedirectStdout;
+        }
+        tokenList.push_back({kind, s.substr(start, i - start), false, string_view(), 0, 0});
+        return i;
+    }
+
+    // Lexes the word starting at @i and returns the index after it.
+    bool lexWord(string_view s, size_t& i) {
+        size_t start = i;
+        i += spanNone(s.data() + i, s.size() - i, SPECIAL, sizeof(SPECIAL));
+        if (i == s.size() || isBlank(s[i]) || isOperatorStart(s[i])) {
+            // fast path: nothing to unescape, hand out a view into the line
+            string_view word = s.substr(start, i - start);
+            bool glob = hasGlob(word);
+            tokenList.push_back({TokenKind::Word, word, glob, glob ? word : string_view(), 0, 0});
+            return true;
+        }
+
+        // slow path: unescape into the scratch buffer, which was reserved for the whole line
+        size_t outStart = scratch.size();
+        size_t patternStart = patternScratch.size();
+        uint32_t firstPart = partList.size();
+        size_t partText = outStart, partPattern = patternStart;   // where the current literal part began
+        bool hasParts = false;
+        // ends the literal part so far; a variable part follows, or the word ends
+        auto endLiteral = [&]() {
+            if (scratch.size() > partText) {
+                partList.push_back({WordPartKind::Literal, string_view(scratch).substr(partText), false,
+                                    string_view(patternScratch).substr(partPattern)});
+            }
+            partText = scratch.size();
+            partPattern = patternScratch.size();
+        };
+        // lexes the '$' at @at: adds a variable part, or takes the '$' literally. Returns the index after it.
+        auto lexDollar = [&](size_t at, bool quoted, size_t& after) {
+            string_view name;
+            size_t length = expansionLength(s, at, name);
+            if (length == string_view::npos) return fail("bad substitution");
+            if (length == 0) {
+                scratch.push_back('$');
+                patternScratch.push_back('$');
+                after = at + 1;
+                return true;
+            }
+            endLiteral();
+            partList.push_back({WordPartKind::Variable, name, quoted, string_view()});
+            hasParts = true;
+            after = at + length;
+            return true;
+        };
+        scratch.append(s.substr(start, i - start));
+        patternScratch.append(s.substr(start, i - start));
+        bool glob = hasGlob(s.substr(start, i - start));
+
+        while (i < s.size()) {
+            char c = s[i];
+            if (isBlank(c) || isOperatorStart(c)) {
+                break;
+            }
+            else if (c == '\\') {
+                if (i + 1 == s.size()) return fail("unexpected end of input after '\\'");
+                scratch.push_back(s[i + 1]);
+                appendQuoted(s.substr(i + 1, 1));
+                i += 2;
+            }
+            else if (c == '\'') {
+                size_t close = i + 1 + spanNone(s.data() + i + 1, s.size() - i - 1, "'", 1);
+                if (close == s.size()) return fail("unterminated single quote");
+                scratch.append(s.substr(i + 1, close - i - 1));
+                appendQuoted(s.substr(i + 1, close - i - 1));
+                i = close + 1;
+            }
+            else if (c == '$') {
+                if (!lexDollar(i, false, i)) return false;
+            }
+            else if (c == '"') {
+                i++;
+                while (true) {
+                    size_t next = i + spanNone(s.data() + i, s.size() - i, "\"\\$", 3);
+                    scratch.append(s.substr(i, next - i));
+                    appendQuoted(s.substr(i, next - i));
+                    if (next == s.size()) return fail("unterminated double quote");
+                    if (s[next] == '"') {
+                        i = next + 1;
+                        break;
+                    }
+                    if (s[next] == '$') {
+                        if (!lexDollar(next, true, i)) return false;
+                        continue;
+                    }
+                    // inside double quotes a backslash only escapes \, " and $
+                    if (next + 1 == s.size()) return fail("unterminated double quote");
+                    char escaped = s[next + 1];
+                    if (escaped != '\\' && escaped != '"' && escaped != '$') {
+                        scratch.push_back('\\');
+                        appendQuoted("\\");
+                    }
+                    scratch.push_back(escaped);
+                    appendQuoted(s.substr(next + 1, 1));
+                    i = next + 2;
+                }
+            }
+            else {
+                size_t run = spanNone(s.data() + i, s.size() - i, SPECIAL, sizeof(SPECIAL));
+                scratch.append(s.substr(i, run));
+                patternScratch.append(s.substr(i, run));
+                glob = glob || hasGlob(s.substr(i, run));
+                i += run;
+            }
+        }
+
+        string_view word = string_view(scratch).substr(outStart, scratch.size() - outStart);
+        string_view pattern = string_view(patternScratch).substr(patternStart, patternScratch.size() - patternStart);
+        uint32_t partCount = 0;
+        if (hasParts) {
+            endLiteral();
+            partCount = partList.size() - firstPart;
+        }
+        tokenList.push_back({TokenKind::Word, word, glob, glob ? pattern : string_view(), firstPart, partCount});
+        return true;
+    }
+
+    // Lexes the process substitution starting at @i, a < or > before a '(', up to its matching ')'. Parentheses
+    // inside quotes or escaped don't count.
+    bool lexProcessSubstitution(string_view s, size_t& i) {
+        TokenKind kind = s[i] == '<' ? TokenKind::ProcessOutput : TokenKind::ProcessInput;
+        size_t start = i + 2;
+        int depth = 1;
+        for (i = start; i < s.size(); i++) {
+            char c = s[i];
+            if (c == '\\') {
+                i++;
+            }
+            else if (c == '\'') {
+                i = s.find('\'', i + 1);
+                if (i == string_view::npos) break;
+            }
+            else if (c == '"') {
+                for (i++; i < s.size() && s[i] != '"'; i++) {
+                    if (s[i] == '\\') i++;
+                }
+            }
+            else if (c == '(') {
+                depth++;
+            }
+            else if (c == ')' && --depth == 0) {
+                tokenList.push_back({kind, s.substr(start, i - start), false, string_view(), 0, 0});
+                i++;
+                return true;
+            }
+        }
+        return fail("unterminated process substitution");
+    }
+
+    // The start of the first line from @i on, which starts a line itself, that is exactly @delimiter; npos if none.
+    static size_t findDelimiterLine(string_view s, size_t i, string_view delimiter) {
+        for (size_t at = i; (at = s.find(delimiter, at)) != string_view::npos; at++) {
+            size_t end = at + delimiter.size();
+            if ((at == i || s[at - 1] == '\n') && (end == s.size() || s[end] == '\n')) return at;
+        }
+        return string_view::npos;
+    }
+
+    // Reads the lines from @i on as the contents of the here-documents opened on the line before, each up to
+    // the line that is its delimiter, and returns the index after them.
+    size_t readHereDocuments(string_view s, size_t i) {
+        for (size_t index : openHereDocuments) {
+            Token& redirect = tokenList[index];
+            // without a word to end it there is nothing to read; the shell reports the missing word
+            if (index + 1 == tokenList.size() || tokenList[index + 1].kind != TokenKind::Word) continue;
+            string_view delimiter = tokenList[index + 1].text;
+            bool stripTabs = redirect.text == "<<-";
+            // an unquoted delimiter is a view into the line itself, see lexWord
+            redirect.hereDocumentExpands = delimiter.data() >= s.data() && delimiter.data() < s.data() + s.size();
+            size_t start = i;
+            // without tabs to strip, the delimiter itself is searched for, rather than each line looked at
+            if (!stripTabs && !delimiter.empty()) {
+                size_t at = findDelimiterLine(s, i, delimiter);
+                if (at == string_view::npos) {
+                    if (!unterminated) unterminatedAt = index;
+                    unterminated = true;
+                    redirect.hereDocument = s.substr(start);
+                    i = s.size();
+                    continue;
+                }
+                redirect.hereDocument = s.substr(start, at - start);
+                i = min(at + delimiter.size() + 1, s.size());
+                continue;
+            }
+            while (true) {
+                if (i == s.size()) {
+                    if (!unterminated) unterminatedAt = index;
+                    unterminated = true;
+                    redirect.hereDocument = s.substr(start);
+                    break;
+                }
+                size_t end = s.find('\n', i);
+                if (end == string_view::npos) end = s.size();
+                string_view line = s.substr(i, end - i);
+                if (stripTabs) line.remove_prefix(min(line.find_first_not_of('\t'), line.size()));
+                if (line == delimiter) {
+                    redirect.hereDocument = s.substr(start, i - start);
+                    i = min(end + 1, s.size());
+                    break;
+                }
+                i = min(end + 1, s.size());
+            }
+        }
+        openHereDocuments.clear();
+        return i;
+    }
+
+public:
+    // The length of the expansion at @i, which is a '$': $name, ${name} or $? and the like; sets @name.
+    // 0 if the '$' is an ordinary character, npos for a ${ without its }. The shell uses it for here-documents.
+    static size_t expansionLength(string_view s, size_t i, string_view& name) {
+        if (i + 1 == s.size()) return 0;
+        char c = s[i + 1];
+        if (isSpecialParameter(c)) {
+            name = s.substr(i + 1, 1);
+            return 2;
+        }
+        if (isNameStart(c)) {
+            size_t end = i + 2;
+            while (end < s.size() && isNameChar(s[end])) end++;
+            name = s.substr(i + 1, end - i - 1);
+            return end - i;
+        }
+        if (c != '{') return 0;
+        size_t close = s.find('}', i + 2);
+        if (close == string_view::npos) return string_view::npos;
+        name = s.substr(i + 2, close - i - 2);
+        bool valid = name.size() == 1 && isSpecialParameter(name[0]);
+        if (!valid && !name.empty() && isNameStart(name[0])) {
+            valid = all_of(name.begin(), name.end(), [](char n) { return isNameChar(n); });
+        }
+        return valid ? close + 1 - i : string_view::npos;
+    }
+
+    // Splits the line into tokens. Returns false and sets error() if the line is malformed.
+    bool tokenize(string_view s) {
+        tokenList.clear();
+        partList.clear();
+        openHereDocuments.clear();
+        unterminated = false;
+        scratch.clear();
+        patternScratch.clear();
+        errorMessage.clear();
+        // unescaped words are never longer than the line, so views into scratch stay valid; patterns escape
+        // at most every character
+        if (scratch.capacity() < s.size()) scratch.reserve(s.size());
+        if (patternScratch.capacity() < 2 * s.size()) patternScratch.reserve(2 * s.size());
+
+        size_t i = 0;
+        while (true) {
+            while (i < s.size() && isBlank(s[i])) i++;
+            if (i == s.size()) break;
+
+            char c = s[i];
+            if (c == '#') {
+                // a comment runs to the end of the line
+                i = s.find('\n', i);
+                if (i == string_view::npos) break;
+                continue;
+            }
+
+            bool fdRedirect = (c == '1' || c == '2') && i + 1 < s.size() && s[i + 1] == '>';
+            if ((c == '<' || c == '>') && i + 1 < s.size() && s[i + 1] == '(') {
+                if (!lexProcessSubstitution(s, i)) {
+                    tokenList.clear();
+                    return false;
+                }
+            }
+            else if (isOperatorStart(c) || fdRedirect) {
+                i = lexOperator(s, i);
+                if (c == '\n' && !openHereDocuments.empty()) i = readHereDocuments(s, i);
+            }
+            else if (!lexWord(s, i)) {
+                tokenList.clear();
+                return false;
+            }
+        }
+        // here-documents opened on the last line have yet to come
+        if (!openHereDocuments.empty()) readHereDocuments(s, s.size());
+        return true;
+    }
+
+    const vector<Token>& tokens() const { return tokenList; }
+
+    // the parts of the words with expansions, see Token
+    const vector<WordPart>& parts() const { return partList; }
+
+    const string& error() const { return errorMessage; }
+
+    // The << token of the here-document the line ended in before its delimiter came, or nullptr; the lines
+    // that follow belong to it. The token after it is the delimiter.
+    const Token* openHereDocument() const { return unterminated ? &tokenList[unterminatedAt] : nullptr; }
+};
+
+#endif // LEXER_CPP
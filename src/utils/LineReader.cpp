@@ -0,0 +1,133 @@
+#ifndef LINE_READER_CPP
+#define LINE_READER_CPP
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+using namespace std;
+
+// Splits non-interactive input into lines without per-byte system calls. Regular files are memory-mapped
+// whole; pipes, terminals and other streams are read in large blocks into a buffer that is reused.
+// Lines are returned as views that stay valid until the next call to nextLine().
+class LineReader {
+    static constexpr size_t BLOCK_SIZE = 1 << 16;
+
+    int fd = -1;
+    bool ownsFd = false;
+
+    // mapped file or -c string
+    const char* data = nullptr;
+    size_t size = 0;
+    size_t position = 0;
+    void* mapping = nullptr;
+    string text;
+
+    // block reads
+    bool streaming = false;
+    bool reachedEof = false;
+    string buffer;
+    size_t begin = 0;
+    size_t end = 0;
+
+    bool nextStreamedLine(string_view& line) {
+        size_t scanFrom = begin;
+        while (true) {
+            const char* newline = (const char*) memchr(buffer.data() + scanFrom, '\n', end - scanFrom);
+            if (newline != nullptr) {
+                size_t at = newline - buffer.data();
+                line = string_view(buffer.data() + begin, at - begin);
+                begin = at + 1;
+                return true;
+            }
+            if (reachedEof) {
+                if (begin == end) return false;
+                line = string_view(buffer.data() + begin, end - begin);
+                begin = end;
+                return true;
+            }
+
+            // keep the partial line, move it to the front and make room for at least one more block
+            size_t pending = end - begin;
+            memmove(buffer.data(), buffer.data() + begin, pending);
+            begin = 0;
+            end = pending;
+            scanFrom = pending;
+            if (buffer.size() - end < BLOCK_SIZE) buffer.resize(max(buffer.size() * 2, end + BLOCK_SIZE));
+
+            ssize_t n = read(fd, buffer.data() + end, buffer.size() - end);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) reachedEof = true;
+            else end += n;
+        }
+    }
+
+public:
+    LineReader() = default;
+    LineReader(const LineReader&) = delete;
+    LineReader& operator=(const LineReader&) = delete;
+
+    ~LineReader() {
+        if (mapping != nullptr) munmap(mapping, size);
+        if (ownsFd) close(fd);
+    }
+
+    // Reads lines from an already open descriptor, e.g. stdin.
+    void readFrom(int descriptor) {
+        fd = descriptor;
+        streaming = true;
+        buffer.resize(BLOCK_SIZE);
+    }
+
+    // Reads lines from the given text, e.g. the argument of -c.
+    void readFrom(const string& s) {
+        text = s;
+        data = text.data();
+        size = text.size();
+    }
+
+    // Opens the file, memory-mapping it if it is a regular file. Returns false with errno set on failure.
+    bool open(const string& path) {
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        ownsFd = true;
+
+        struct stat sb;
+        if (fstat(fd, &sb) != 0) return false;
+        if (S_ISDIR(sb.st_mode)) {
+            errno = EISDIR;
+            return false;
+        }
+
+        if (S_ISREG(sb.st_mode)) {
+            if (sb.st_size == 0) return true;
+            void* mapped = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                madvise(mapped, sb.st_size, MADV_SEQUENTIAL);
+                mapping = mapped;
+                data = (const char*) mapped;
+                size = sb.st_size;
+                return true;
+            }
+        }
+        readFrom(fd);
+        return true;
+    }
+
+    // Sets @line to the next line without its newline. Returns false once the input is exhausted.
+    bool nextLine(string_view& line) {
+        if (streaming) return nextStreamedLine(line);
+
+        if (position >= size) return false;
+        const char* newline = (const char*) memchr(data + position, '\n', size - position);
+        size_t at = newline != nullptr ? newline - data : size;
+        line = string_view(data + position, at - position);
+        position = at + 1;
+        return true;
+    }
+};
+
+#endif // LINE_READER_CPP
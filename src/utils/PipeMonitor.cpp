@@ -0,0 +1,316 @@
+#ifndef PIPE_MONITOR_CPP
+#define PIPE_MONITOR_CPP
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+using namespace std;
+
+enum class PipeTransport {
+    Pipe,
+    SocketPair,   // AF_UNIX stream sockets, made one-way with shutdown()
+};
+
+typedef struct {
+    int capacity;             // bytes per channel, 0 keeps the kernel default
+    bool autoGrow;            // double a pipe's capacity while it stays full
+    PipeTransport transport;
+    bool stats;               // meter every channel and report per-stage counts
+} PipeSettings;
+
+typedef struct {
+    uint64_t bytes;           // moved from the writing to the reading stage
+    uint64_t fullStalls;      // times the writer had to wait for the reader
+    uint64_t emptyStalls;     // times the reader had to wait for the writer
+    int capacity;             // of the reader's side when the channel closed, 0 for sockets
+} ChannelStats;
+
+// The channels between the stages of one pipeline, and the shell thread that watches them.
+// Without stats the stages talk over their channel directly, and in auto mode the thread samples how full
+// every pipe is each millisecond, doubling its capacity when it was full twice in a row. With stats every
+// channel is split in two and the thread relays between the halves (splice() for pipes), so it sees every
+// byte and every time one side had to wait for the other.
+class PipeMonitor : public enable_shared_from_this<PipeMonitor> {
+    typedef struct {
+        int source;            // relay: read end of the writer's half. sampling: a dup of the reader's end
+        int sink;              // relay: write end of the reader's half. -1 when sampling
+        pid_t reader;          // sampling: the stage reading the channel
+        bool open;
+        bool fullBefore;       // the last wait (or sample) found the channel full
+        short waitingFor;      // relay: poll event the channel waits for, 0 if it can move data now
+        vector<char> buffer;   // relaying sockets, which splice() can't connect
+        size_t buffered;
+        size_t written;
+        ChannelStats stats;
+    } Channel;
+
+    static constexpr int SAMPLE_INTERVAL_MS = 1;
+    static constexpr size_t RELAY_CHUNK = 1 << 20;
+    static constexpr size_t SOCKET_BUFFER = 1 << 16;
+
+    PipeSettings settings;
+    vector<Channel> channels;
+    vector<int> relayEnds;
+    int wakeFd = -1;
+    thread worker;
+
+    static bool readable(int fd) {
+        pollfd p = {fd, POLLIN, 0};
+        return poll(&p, 1, 0) > 0;
+    }
+
+    // doubles the capacity of a pipe up to the system limit; sockets are left alone
+    static void grow(int fd) {
+        int current = fcntl(fd, F_GETPIPE_SZ);
+        if (current <= 0 || current >= maximumCapacity()) return;
+        fcntl(fd, F_SETPIPE_SZ, min(current * 2, maximumCapacity()));
+    }
+
+    static void closeEnd(int& fd) {
+        if (fd >= 0) close(fd);
+        fd = -1;
+    }
+
+    void closeChannel(Channel& channel) {
+        int capacity = fcntl(channel.sink >= 0 ? channel.sink : channel.source, F_GETPIPE_SZ);
+        channel.stats.capacity = max(capacity, 0);
+        closeEnd(channel.source);
+        closeEnd(channel.sink);
+        channel.open = false;
+    }
+
+    // moves what is available from source to sink. returns the bytes written to the sink, 0 at the end of
+    // the input, or -1 with errno set; on EAGAIN @sinkFull tells which side has to be waited for.
+    ssize_t transfer(Channel& channel, bool& sinkFull) {
+        if (channel.buffer.empty()) {
+            ssize_t moved = splice(channel.source, nullptr, channel.sink, nullptr, RELAY_CHUNK,
+                                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (moved < 0 && errno == EAGAIN) sinkFull = readable(channel.source);
+            return moved;
+        }
+        if (channel.written == channel.buffered) {
+            ssize_t got = read(channel.source, channel.buffer.data(), channel.buffer.size());
+            if (got <= 0) {
+                sinkFull = false;
+                return got;
+            }
+            channel.buffered = got;
+            channel.written = 0;
+        }
+        ssize_t sent = write(channel.sink, channel.buffer.data() + channel.written, channel.buffered - channel.written);
+        if (sent > 0) channel.written += sent;
+        else if (errno == EAGAIN) sinkFull = true;
+        return sent;
+    }
+
+    // relays until the channel has to wait; returns the poll event to wait for, 0 once it is closed
+    short pump(Channel& channel) {
+        while (true) {
+            bool sinkFull = false;
+            ssize_t moved = transfer(channel, sinkFull);
+            if (moved > 0) {
+                channel.stats.bytes += moved;
+                continue;
+            }
+            if (moved < 0 && errno == EINTR) continue;
+            if (moved < 0 && errno == EAGAIN) {
+                if (!sinkFull) {
+                    channel.stats.emptyStalls++;
+                    channel.fullBefore = false;
+                    return POLLIN;
+                }
+                channel.stats.fullStalls++;
+                if (settings.autoGrow && channel.fullBefore) {
+                    grow(channel.sink);
+                    grow(channel.source);
+                }
+                channel.fullBefore = true;
+                return POLLOUT;
+            }
+            // the writer finished, so the reader sees EOF, or the reader went away (EPIPE) and closing the
+            // writer's half makes its next write fail the same way
+            closeChannel(channel);
+            return 0;
+        }
+    }
+
+    void relay() {
+        vector<pollfd> waiting;
+        vector<Channel*> owners;
+        while (true) {
+            waiting.clear();
+            owners.clear();
+            for (Channel& channel : channels) {
+                if (channel.open && channel.waitingFor == 0) channel.waitingFor = pump(channel);
+                if (!channel.open) continue;
+                waiting.push_back({channel.waitingFor == POLLIN ? channel.source : channel.sink, channel.waitingFor, 0});
+                owners.push_back(&channel);
+            }
+            if (waiting.empty()) return;
+            if (poll(waiting.data(), waiting.size(), -1) <= 0) continue;
+            for (size_t i = 0; i < waiting.size(); i++) {
+                if (waiting[i].revents != 0) owners[i]->waitingFor = 0;
+            }
+        }
+    }
+
+    void sample() {
+        while (true) {
+            pollfd wake = {wakeFd, POLLIN, 0};
+            if (poll(&wake, 1, SAMPLE_INTERVAL_MS) > 0) return;
+            for (Channel& channel : channels) {
+                if (!channel.open) continue;
+                // holding a read end past its reader's exit would keep the writer from getting EPIPE
+                if (kill(channel.reader, 0) < 0 && errno == ESRCH) {
+                    closeChannel(channel);
+                    continue;
+                }
+                int queued = 0;
+                ioctl(channel.source, FIONREAD, &queued);
+                int capacity = fcntl(channel.source, F_GETPIPE_SZ);
+                bool full = capacity > 0 && queued >= capacity;
+                if (full && channel.fullBefore) grow(channel.source);
+                channel.fullBefore = full;
+            }
+        }
+    }
+
+    bool relaying() const { return settings.stats; }
+
+public:
+    explicit PipeMonitor(const PipeSettings& settings) : settings(settings) {}
+
+    ~PipeMonitor() {
+        if (worker.joinable()) {
+            if (worker.get_id() == this_thread::get_id()) worker.detach();
+            else worker.join();
+        }
+        for (Channel& channel : channels) {
+            closeEnd(channel.source);
+            closeEnd(channel.sink);
+        }
+        closeEnd(wakeFd);
+    }
+
+    // /proc/sys/fs/pipe-max-size, the largest capacity an unprivileged process may ask for
+    static int maximumCapacity() {
+        static int maximum = []() {
+            int fd = ::open("/proc/sys/fs/pipe-max-size", O_RDONLY | O_CLOEXEC);
+            char text[32] = {};
+            ssize_t got = fd >= 0 ? read(fd, text, sizeof(text) - 1) : -1;
+            if (fd >= 0) close(fd);
+            int value = got > 0 ? atoi(text) : 0;
+            return value > 0 ? value : 1 << 20;
+        }();
+        return maximum;
+    }
+
+    // creates a close-on-exec channel with the given transport and capacity: @ends[0] reads, @ends[1] writes
+    static bool openChannel(int ends[2], const PipeSettings& settings) {
+        if (settings.transport == PipeTransport::SocketPair) {
+            if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, ends) < 0) return false;
+            shutdown(ends[0], SHUT_WR);
+            shutdown(ends[1], SHUT_RD);
+            if (settings.capacity > 0) {
+                setsockopt(ends[1], SOL_SOCKET, SO_SNDBUF, &settings.capacity, sizeof(settings.capacity));
+                setsockopt(ends[0], SOL_SOCKET, SO_RCVBUF, &settings.capacity, sizeof(settings.capacity));
+            }
+            return true;
+        }
+        if (pipe2(ends, O_CLOEXEC) < 0) return false;
+        if (settings.capacity > 0) fcntl(ends[1], F_SETPIPE_SZ, min(settings.capacity, maximumCapacity()));
+        return true;
+    }
+
+    // Opens the channel between two stages. With stats these are the outer ends of two channels the
+    // monitor relays between; their inner ends are listed by relayedEnds().
+    bool open(int ends[2]) {
+        if (!relaying()) return openChannel(ends, settings);
+
+        int writerHalf[2], readerHalf[2];
+        if (!openChannel(writerHalf, settings)) return false;
+        if (!openChannel(readerHalf, settings)) {
+            close(writerHalf[0]);
+            close(writerHalf[1]);
+            return false;
+        }
+        ends[0] = readerHalf[0];
+        ends[1] = writerHalf[1];
+        fcntl(writerHalf[0], F_SETFL, O_NONBLOCK);
+        fcntl(readerHalf[1], F_SETFL, O_NONBLOCK);
+        relayEnds.push_back(writerHalf[0]);
+        relayEnds.push_back(readerHalf[1]);
+
+        Channel channel = {writerHalf[0], readerHalf[1], -1, true, false, 0, {}, 0, 0, {0, 0, 0, 0}};
+        if (settings.transport == PipeTransport::SocketPair) channel.buffer.resize(SOCKET_BUFFER);
+        channels.push_back(move(channel));
+        return true;
+    }
+
+    // the monitor's own ends of the channels; forked stages must close them
+    const vector<int>& relayedEnds() const { return relayEnds; }
+
+    // Samples the pipe read through @readEnd by @reader, to grow it while it stays full. Call it once the
+    // stages are started, so that none of them inherits the monitor's copy of the read end.
+    void watch(int readEnd, pid_t reader) {
+        if (relaying() || !settings.autoGrow || settings.transport != PipeTransport::Pipe || reader <= 0) return;
+        int source = fcntl(readEnd, F_DUPFD_CLOEXEC, 0);
+        if (source < 0) return;
+        channels.push_back({source, -1, reader, true, false, 0, {}, 0, 0, {0, 0, 0, 0}});
+    }
+
+    // Starts the thread if there is anything to watch. It runs with every signal blocked, so SIGCHLD and
+    // SIGINT keep reaching the shell's main thread, and writes to closed channels fail with EPIPE.
+    void start() {
+        if (channels.empty()) return;
+        if (!relaying()) {
+            wakeFd = eventfd(0, EFD_CLOEXEC);
+            if (wakeFd < 0) return;
+        }
+        sigset_t all, previous;
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, &previous);
+        shared_ptr<PipeMonitor> self = shared_from_this();
+        worker = thread([self]() {
+            if (self->relaying()) self->relay();
+            else self->sample();
+        });
+        pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    }
+
+    // Waits for the thread: a relay ends once every stage closed its ends, sampling is stopped.
+    void finish() {
+        if (!worker.joinable()) return;
+        if (!relaying()) {
+            uint64_t one = 1;
+            write(wakeFd, &one, sizeof(one));
+        }
+        worker.join();
+    }
+
+    // The pipeline was stopped and may be continued later: sampling ends, relays keep running on their own.
+    void abandon() {
+        if (!worker.joinable()) return;
+        if (!relaying()) finish();
+        else worker.detach();
+    }
+
+    // per relayed channel, in pipeline order; complete after finish()
+    vector<ChannelStats> stats() const {
+        vector<ChannelStats> result;
+        for (const Channel& channel : channels) result.push_back(channel.stats);
+        return result;
+    }
+};
+
+#endif // PIPE_MONITOR_CPP
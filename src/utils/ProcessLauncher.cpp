@@ -0,0 +1,226 @@
+#ifndef PROCESS_LAUNCHER_CPP
+#define PROCESS_LAUNCHER_CPP
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <spawn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+using namespace std;
+
+extern char** environ;
+
+enum class LaunchMode {
+    Spawn,  // posix_spawn, which glibc implements with clone(CLONE_VM|CLONE_VFORK)
+    Fork,   // fork + execv, copies the page tables of the whole shell
+    Server, // handed to the fork server, which spawns from its own small process (Spawn where it isn't running)
+};
+
+class ForkServer;
+
+// Starts an external program with its file descriptors rearranged in the child, without copying the
+// shell's address space. File descriptor operations are recorded first and applied in order between
+// the spawn and the exec, as posix_spawn file actions (or by hand in the fork fallback).
+// The child can be put into a process group and given the terminal, for job control; signals that an
+// interactive shell ignores are reset to their defaults either way.
+class ProcessLauncher {
+    friend class ForkServer;
+
+    struct FdAction {
+        enum { Dup, Open, Close } kind;
+        int fd;
+        int sourceFd = -1;
+        string path = "";
+        int flags = 0;
+        mode_t mode = 0;
+    };
+
+    vector<FdAction> actions;
+
+    static sigset_t defaultSignals() {
+        sigset_t signals;
+        sigemptyset(&signals);
+        for (int sig : {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGPIPE, SIGCHLD}) sigaddset(&signals, sig);
+        return signals;
+    }
+
+    // posix_spawn reports these for a failing exec; anything else means spawning itself did not work
+    static bool isExecError(int err) {
+        return err == ENOENT || err == EACCES || err == ENOEXEC || err == ENOTDIR || err == ELOOP ||
+               err == ENAMETOOLONG || err == ETXTBSY || err == EISDIR || err == EPERM;
+    }
+
+    pid_t spawn(const string& path, char* const* argv, int& err) const {
+        posix_spawn_file_actions_t fileActions;
+        posix_spawn_file_actions_init(&fileActions);
+        for (const FdAction& action : actions) {
+            if (action.kind == FdAction::Dup) {
+                posix_spawn_file_actions_adddup2(&fileActions, action.sourceFd, action.fd);
+            } else if (action.kind == FdAction::Open) {
+                posix_spawn_file_actions_addopen(&fileActions, action.fd, action.path.c_str(), action.flags, action.mode);
+            } else {
+                posix_spawn_file_actions_addclose(&fileActions, action.fd);
+            }
+        }
+
+        posix_spawnattr_t attributes;
+        posix_spawnattr_init(&attributes);
+        short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+        sigset_t signals = defaultSignals(), noSignals;
+        sigemptyset(&noSignals);
+        posix_spawnattr_setsigdefault(&attributes, &signals);
+        posix_spawnattr_setsigmask(&attributes, &noSignals);
+        if (processGroup >= 0) {
+            flags |= POSIX_SPAWN_SETPGROUP;
+            posix_spawnattr_setpgroup(&attributes, processGroup);
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 35)
+            // the child takes the terminal itself before exec, so it can't read from it while still in the background
+            if (terminalFd >= 0) posix_spawn_file_actions_addtcsetpgrp_np(&fileActions, terminalFd);
+#endif
+        }
+        posix_spawnattr_setflags(&attributes, flags);
+
+        pid_t pid = -1;
+        err = posix_spawn(&pid, path.c_str(), &fileActions, &attributes, argv, environ);
+        posix_spawn_file_actions_destroy(&fileActions);
+        posix_spawnattr_destroy(&attributes);
+        return err == 0 ? pid : -1;
+    }
+
+    pid_t forkAndExec(const string& path, char* const* argv, int& err) const {
+        pid_t pid = fork();
+        if (pid < 0) {
+            err = errno;
+            return -1;
+        }
+        if (pid == 0) {
+            enterProcessGroup();
+            for (const FdAction& action : actions) {
+                int result = 0;
+                if (action.kind == FdAction::Dup) {
+                    // dup2 onto itself would leave close-on-exec set; posix_spawn clears it
+                    result = action.sourceFd == action.fd ? fcntl(action.fd, F_SETFD, 0) : dup2(action.sourceFd, action.fd);
+                } else if (action.kind == FdAction::Open) {
+                    int fd = ::open(action.path.c_str(), action.flags, action.mode);
+                    result = fd;
+                    if (fd >= 0 && fd != action.fd) {
+                        result = dup2(fd, action.fd);
+                        ::close(fd);
+                    }
+                } else {
+                    ::close(action.fd);
+                }
+                if (result < 0) {
+                    perror(action.kind == FdAction::Open ? action.path.c_str() : "dup2 failed");
+                    _exit(1);
+                }
+            }
+            execv(path.c_str(), argv);
+            perror("execv failed");
+            _exit(127);
+        }
+        err = 0;
+        return pid;
+    }
+
+public:
+    // -1 keeps the child in the shell's process group, 0 makes it the leader of a new one, anything else joins that group
+    pid_t processGroup = -1;
+
+    // if set (and processGroup is not -1), the child's process group becomes the foreground group of this terminal
+    int terminalFd = -1;
+
+    // SHELL_LAUNCHER=fork selects the fork fallback for every launch, SHELL_LAUNCHER=server the fork server.
+    static LaunchMode defaultMode() {
+        const char* launcher = getenv("SHELL_LAUNCHER");
+        if (launcher && strcmp(launcher, "fork") == 0) return LaunchMode::Fork;
+        if (launcher && strcmp(launcher, "server") == 0) return LaunchMode::Server;
+        return LaunchMode::Spawn;
+    }
+
+    LaunchMode mode = defaultMode();
+
+    // Makes @fd in the child a copy of the shell's @sourceFd. The same number for both keeps a close-on-exec
+    // descriptor of the shell open in the child.
+    void dup(int sourceFd, int fd) {
+        FdAction action{FdAction::Dup, fd};
+        action.sourceFd = sourceFd;
+        actions.push_back(action);
+    }
+
+    // Opens @path in the child as @fd.
+    void open(int fd, const string& path, int flags, mode_t mode) {
+        FdAction action{FdAction::Open, fd};
+        action.path = path;
+        action.flags = flags;
+        action.mode = mode;
+        actions.push_back(action);
+    }
+
+    // Closes @fd in the child.
+    void close(int fd) {
+        actions.push_back(FdAction{FdAction::Close, fd});
+    }
+
+    // Applies processGroup, terminalFd and the default signal dispositions to the calling process.
+    // Used in the fork fallback and by the shell for children it forks itself.
+    void enterProcessGroup() const {
+        if (processGroup >= 0) {
+            setpgid(0, processGroup);
+            // SIGTTOU is still ignored here, so taking the terminal from the background works
+            if (terminalFd >= 0) tcsetpgrp(terminalFd, getpgrp());
+        }
+        sigset_t signals = defaultSignals();
+        for (int sig = 1; sig < NSIG; sig++) {
+            if (sigismember(&signals, sig) == 1) signal(sig, SIG_DFL);
+        }
+        sigset_t noSignals;
+        sigemptyset(&noSignals);
+        sigprocmask(SIG_SETMASK, &noSignals, nullptr);
+    }
+
+    // Starts @path with @args as argv (args[0] included). Returns the child's pid, or -1 with @err set.
+    // Falls back to fork when posix_spawn itself, rather than the program's exec, fails.
+    pid_t launch(const string& path, const vector<string>& args, int& err) const {
+        vector<char*> argv;
+        for (const string& arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+        argv.push_back(nullptr);
+        return launch(path, argv.data(), err);
+    }
+
+    // Same with a ready argv, terminated by nullptr.
+    pid_t launch(const string& path, char* const* argv, int& err) const {
+        pid_t pid = -1;
+        if (mode != LaunchMode::Fork) {
+            pid = spawn(path, argv, err);
+            if (pid < 0 && !isExecError(err)) pid = forkAndExec(path, argv, err);
+        } else {
+            pid = forkAndExec(path, argv, err);
+        }
+        // set the group from the parent as well, so it exists by the time the next stage of a pipeline joins it
+        if (pid > 0 && processGroup >= 0) setpgid(pid, processGroup == 0 ? pid : processGroup);
+        return pid;
+    }
+
+    // After a failed launch, the path of the first file to open that the shell can't open either, with @err
+    // set to why; "" when they all open, and the program itself could not run. The opens are the child's
+    // own again, so files it already created or truncated are only created or truncated once more.
+    string failedOpen(int& err) const {
+        for (const FdAction& action : actions) {
+            if (action.kind != FdAction::Open) continue;
+            int fd = ::open(action.path.c_str(), action.flags | O_CLOEXEC, action.mode);
+            if (fd < 0) {
+                err = errno;
+                return action.path;
+            }
+            ::close(fd);
+        }
+        return "";
+    }
+};
+
+#endif // PROCESS_LAUNCHER_CPP
@@ -0,0 +1,307 @@
+#ifndef RESULT_CACHE_CPP
+#define RESULT_CACHE_CPP
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <algorithm>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "DataMover.cpp"
+using namespace std;
+
+// Stored results of commands, for the `cache` builtin. Layout under the cache directory:
+//
+//   objects/ab/ab12...   stdout and stderr contents, named by their hash, so equal outputs are kept once
+//   entries/cd34...      one small text file per command key: when it ran, how long it took, its exit
+//                        status and the hashes of its outputs. Its mtime is the last use, for LRU eviction.
+//   stats                hits, misses, evictions and the run time hits saved, across sessions
+//   lock                 flock()ed while the store is changed; lookups go without it, since entries and
+//                        objects only ever appear through rename() and a vanished object is a miss
+//
+// Hashes are 128 bits from a fast non-cryptographic hash; fine for telling a shell's own results apart,
+// not meant to hold up against crafted collisions.
+class ResultCache {
+public:
+    typedef struct {
+        time_t created;
+        double seconds;         // how long the command ran
+        int status;             // exit status in the shell's sense
+        string stdoutHash;
+        string stderrHash;
+    } Entry;
+
+    typedef struct {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        double savedSeconds;    // run time of the commands that were replayed instead
+    } Stats;
+
+private:
+    string root;
+    uint64_t maxBytes = 256ull << 20;
+
+    static uint64_t rotate(uint64_t x, int bits) { return (x << bits) | (x >> (64 - bits)); }
+
+    static uint64_t finish(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        return h ^ (h >> 33);
+    }
+
+    string entryPath(const string& key) const { return root + "/entries/" + key; }
+    string objectPath(const string& hash) const { return root + "/objects/" + hash.substr(0, 2) + "/" + hash; }
+
+    // runs @f with the store locked against other shells
+    template <typename F>
+    bool locked(F&& f) {
+        int fd = ::open((root + "/lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        while (flock(fd, LOCK_EX) < 0 && errno == EINTR) {}
+        bool ok = f();
+        close(fd);
+        return ok;
+    }
+
+    // writes @content to @path through a temporary file, so readers see all of it or nothing
+    static bool writeAtomically(const string& path, const string& content) {
+        string temporary = path + ".tmp" + to_string(getpid());
+        int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        bool ok = DataMover::writeAll(fd, content.data(), content.size());
+        ok = close(fd) == 0 && ok;
+        if (ok && rename(temporary.c_str(), path.c_str()) == 0) return true;
+        unlink(temporary.c_str());
+        return false;
+    }
+
+    // copies the whole of @fd into the object store unless an equal object is there already
+    bool storeObject(int fd, string& hash) {
+        hash = hashFile(fd);
+        if (hash.empty()) return false;
+        string path = objectPath(hash);
+        if (access(path.c_str(), F_OK) == 0) return true;
+        filesystem::create_directories(filesystem::path(path).parent_path());
+
+        string temporary = path + ".tmp" + to_string(getpid());
+        int out = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out < 0) return false;
+        uint64_t copied = 0;
+        bool ok = lseek(fd, 0, SEEK_SET) == 0 && DataMover::copy(fd, out, UINT64_MAX, copied);
+        ok = close(out) == 0 && ok;
+        if (ok && rename(temporary.c_str(), path.c_str()) == 0) return true;
+        unlink(temporary.c_str());
+        return false;
+    }
+
+    static bool parseEntry(const string& path, Entry& entry) {
+        ifstream in(path);
+        string version;
+        long long created;
+        if (!(in >> version >> created >> entry.seconds >> entry.status >> entry.stdoutHash >> entry.stderrHash)) return false;
+        entry.created = created;
+        return version == "v1";
+    }
+
+    Stats readStats() const {
+        Stats stats = {0, 0, 0, 0};
+        ifstream in(root + "/stats");
+        in >> stats.hits >> stats.misses >> stats.evictions >> stats.savedSeconds;
+        return stats;
+    }
+
+    bool writeStats(const Stats& stats) const {
+        return writeAtomically(root + "/stats", to_string(stats.hits) + " " + to_string(stats.misses) + " " +
+                                                    to_string(stats.evictions) + " " + to_string(stats.savedSeconds) + "\n");
+    }
+
+    // drops the least recently used entries until the store fits, along with the objects only they used
+    void evict() {
+        typedef struct {
+            string path;
+            filesystem::file_time_type used;
+            uint64_t size;
+            Entry entry;
+        } StoredEntry;
+        error_code error;
+        uint64_t total = 0;
+        vector<StoredEntry> entries;
+        map<string, int> references;
+        for (auto& file : filesystem::directory_iterator(root + "/entries", error)) {
+            StoredEntry stored = {file.path().string(), file.last_write_time(error), file.file_size(error), {}};
+            if (!parseEntry(stored.path, stored.entry)) continue;
+            references[stored.entry.stdoutHash]++;
+            references[stored.entry.stderrHash]++;
+            total += stored.size;
+            entries.push_back(move(stored));
+        }
+        map<string, uint64_t> objects;
+        for (auto& file : filesystem::recursive_directory_iterator(root + "/objects", error)) {
+            if (!file.is_regular_file(error)) continue;
+            string hash = file.path().filename().string();
+            // left over from a store that failed half way
+            if (!references.count(hash)) {
+                unlink(file.path().c_str());
+                continue;
+            }
+            objects[hash] = file.file_size(error);
+            total += objects[hash];
+        }
+        if (total <= maxBytes) return;
+
+        sort(entries.begin(), entries.end(), [](auto& a, auto& b) { return a.used < b.used; });
+        uint64_t evicted = 0;
+        for (const StoredEntry& stored : entries) {
+            if (total <= maxBytes) break;
+            unlink(stored.path.c_str());
+            total -= stored.size;
+            evicted++;
+            for (const string& hash : {stored.entry.stdoutHash, stored.entry.stderrHash}) {
+                if (--references[hash] > 0) continue;
+                unlink(objectPath(hash).c_str());
+                total -= objects[hash];
+            }
+        }
+        Stats stats = readStats();
+        stats.evictions += evicted;
+        writeStats(stats);
+    }
+
+public:
+    // 128 bits as 32 hex digits. Four lanes over 8-byte words, mixed with the length at the end.
+    static string hash(const void* data, size_t size) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        uint64_t lanes[4] = {0x9e3779b97f4a7c15ull, 0xc2b2ae3d27d4eb4full, 0x165667b19e3779f9ull, 0x27d4eb2f165667c5ull};
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32) {
+            for (int lane = 0; lane < 4; lane++) {
+                uint64_t word;
+                memcpy(&word, p + i + lane * 8, 8);
+                lanes[lane] = rotate(lanes[lane] ^ (word * 0x87c37b91114253d5ull), 31) * 0x4cf5ad432745937full;
+            }
+        }
+        for (; i < size; i++) lanes[i & 3] = rotate(lanes[i & 3] ^ (p[i] * 0x87c37b91114253d5ull), 27) * 0x4cf5ad432745937full;
+
+        uint64_t high = finish(lanes[0] ^ rotate(lanes[1], 17) ^ size);
+        uint64_t low = finish(lanes[2] ^ rotate(lanes[3], 23) ^ high);
+        char text[33];
+        snprintf(text, sizeof(text), "%016llx%016llx", (unsigned long long) high, (unsigned long long) low);
+        return text;
+    }
+
+    static string hash(const string& s) { return hash(s.data(), s.size()); }
+
+    // hash of everything in a regular file (or memfd); "" on failure
+    static string hashFile(int fd) {
+        struct stat st;
+        if (fstat(fd, &st) < 0) return "";
+        if (st.st_size == 0) return hash("", 0);
+        void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) return "";
+        string result = hash(data, st.st_size);
+        munmap(data, st.st_size);
+        return result;
+    }
+
+    // Uses @directory for the store, creating it if needed, and keeps it below @limit bytes.
+    bool open(const string& directory, uint64_t limit) {
+        root = directory;
+        maxBytes = limit;
+        error_code error;
+        filesystem::create_directories(root + "/entries", error);
+        filesystem::create_directories(root + "/objects", error);
+        return !error;
+    }
+
+    const string& directory() const { return root; }
+    uint64_t limit() const { return maxBytes; }
+
+    // Finds the entry stored under @key if it is younger than @ttl seconds (0: any age) and its outputs
+    // are still there, and marks it as used.
+    bool lookup(const string& key, time_t ttl, Entry& entry) {
+        string path = entryPath(key);
+        if (!parseEntry(path, entry)) return false;
+        if (ttl > 0 && time(nullptr) - entry.created >= ttl) return false;
+        if (access(objectPath(entry.stdoutHash).c_str(), R_OK) != 0) return false;
+        if (access(objectPath(entry.stderrHash).c_str(), R_OK) != 0) return false;
+        utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+        return true;
+    }
+
+    // opens a stored output for reading, -1 if it is gone
+    int openOutput(const string& hash) const {
+        return ::open(objectPath(hash).c_str(), O_RDONLY | O_CLOEXEC);
+    }
+
+    // Stores the outputs in @stdoutFd and @stderrFd (read from the start) under @key, then evicts.
+    bool store(const string& key, Entry entry, int stdoutFd, int stderrFd) {
+        return locked([&]() {
+            if (!storeObject(stdoutFd, entry.stdoutHash) || !storeObject(stderrFd, entry.stderrHash)) return false;
+            char line[256];
+            snprintf(line, sizeof(line), "v1 %lld %.6f %d %s %s\n", (long long) entry.created, entry.seconds,
+                     entry.status, entry.stdoutHash.c_str(), entry.stderrHash.c_str());
+            if (!writeAtomically(entryPath(key), line)) return false;
+            evict();
+            return true;
+        });
+    }
+
+    void recordHit(double savedSeconds) {
+        locked([&]() {
+            Stats stats = readStats();
+            stats.hits++;
+            stats.savedSeconds += savedSeconds;
+            return writeStats(stats);
+        });
+    }
+
+    void recordMiss() {
+        locked([&]() {
+            Stats stats = readStats();
+            stats.misses++;
+            return writeStats(stats);
+        });
+    }
+
+    Stats stats() const { return readStats(); }
+
+    // number of entries and bytes used by entries and objects
+    void usage(uint64_t& entries, uint64_t& bytes) const {
+        entries = bytes = 0;
+        error_code error;
+        for (auto& file : filesystem::directory_iterator(root + "/entries", error)) {
+            entries++;
+            bytes += file.file_size(error);
+        }
+        for (auto& file : filesystem::recursive_directory_iterator(root + "/objects", error)) {
+            if (file.is_regular_file(error)) bytes += file.file_size(error);
+        }
+    }
+
+    // removes every entry and object and resets the statistics
+    bool clear() {
+        return locked([&]() {
+            error_code error;
+            filesystem::remove_all(root + "/entries", error);
+            filesystem::remove_all(root + "/objects", error);
+            filesystem::create_directories(root + "/entries", error);
+            filesystem::create_directories(root + "/objects", error);
+            return writeStats({0, 0, 0, 0}) && !error;
+        });
+    }
+};
+
+#endif // RESULT_CACHE_CPP
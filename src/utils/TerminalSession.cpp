@@ -0,0 +1,165 @@
+#ifndef TERMINAL_SESSION_CPP
+#define TERMINAL_SESSION_CPP
+#include <string>
+#include <string_view>
+#include <csignal>
+#include <cstdlib>
+#include <cerrno>
+#include <termios.h>
+#include <unistd.h>
+using namespace std;
+
+// Owns the terminal while a line is being edited: switches it to raw mode once per prompt (instead of
+// twice per keystroke), reads whatever input is available with a single read(), and collects screen
+// output so that each refresh is one write(). The original settings are restored when the prompt is
+// done, when the shell exits and when it is killed by SIGTERM or SIGHUP. Ctrl-C, Ctrl-\ and Ctrl-Z reach the
+// line editor as keys rather than as signals, so an interactive shell isn't stopped or killed at its prompt.
+// Bracketed paste is enabled while in raw mode, so pasted text arrives between ESC[200~ and ESC[201~.
+class TerminalSession {
+    static constexpr const char* PASTE_ON = "\x1b[?2004h";
+    static constexpr const char* PASTE_OFF = "\x1b[?2004l";
+
+    int inputFd;
+    int outputFd;
+    struct termios original;
+    bool raw = false;
+    bool bracketedPaste = false;
+    string input;
+    string output;
+
+    // the session whose settings have to be restored if the process dies in raw mode
+    static inline TerminalSession* active = nullptr;
+
+    static void writeAll(int fd, const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t n = ::write(fd, data, size);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            data += n;
+            size -= n;
+        }
+    }
+
+    // only async-signal-safe calls in here
+    void restoreTerminal() {
+        if (bracketedPaste) writeAll(outputFd, PASTE_OFF, 8);
+        tcsetattr(inputFd, TCSANOW, &original);
+    }
+
+    static void restoreAtExit() {
+        if (active != nullptr) active->restoreTerminal();
+    }
+
+    static void restoreOnSignal(int sig) {
+        if (active != nullptr) active->restoreTerminal();
+        signal(sig, SIG_DFL);
+        raise(sig);
+    }
+
+    static void installRestoreHandlers() {
+        static bool installed = false;
+        if (installed) return;
+        installed = true;
+
+        atexit(restoreAtExit);
+        for (int sig : {SIGTERM, SIGHUP}) {
+            struct sigaction action = {}, previous;
+            sigaction(sig, nullptr, &previous);
+            if (previous.sa_handler != SIG_DFL) continue; // leave handlers installed by someone else alone
+            action.sa_handler = restoreOnSignal;
+            sigemptyset(&action.sa_mask);
+            sigaction(sig, &action, nullptr);
+        }
+    }
+
+public:
+    TerminalSession(int inputFd = STDIN_FILENO, int outputFd = STDOUT_FILENO) : inputFd(inputFd), outputFd(outputFd) {}
+
+    // Disables line buffering and echo. Returns false if the input is not a terminal.
+    bool enterRawMode() {
+        if (raw) return true;
+        if (tcgetattr(inputFd, &original) != 0) return false;
+
+        struct termios rawSettings = original;
+        // ICANON disables canonical mode (line buffering, no Enter key needed)
+        // ECHO disables character echoing (the key pressed won't show on screen)
+        // ISIG makes Ctrl-C, Ctrl-\ and Ctrl-Z plain keys instead of SIGINT, SIGQUIT and SIGTSTP
+        rawSettings.c_lflag &= ~(ICANON | ECHO | ISIG);
+        rawSettings.c_cc[VMIN] = 1;
+        rawSettings.c_cc[VTIME] = 0;
+
+        // terminals that don't understand escape sequences would print the paste mode switch
+        const char* term = getenv("TERM");
+        bracketedPaste = term != nullptr && *term != '\0' && string_view(term) != "dumb";
+
+        installRestoreHandlers();
+        active = this;
+        tcsetattr(inputFd, TCSANOW, &rawSettings);
+        if (bracketedPaste) write(PASTE_ON);
+        flush();
+        raw = true;
+        return true;
+    }
+
+    void leaveRawMode() {
+        if (!raw) return;
+        flush();
+        restoreTerminal();
+        active = nullptr;
+        raw = false;
+    }
+
+    // Keeps the terminal in raw mode for the lifetime of the scope.
+    class RawModeScope {
+        TerminalSession& session;
+    public:
+        explicit RawModeScope(TerminalSession& session) : session(session) { session.enterRawMode(); }
+        ~RawModeScope() { session.leaveRawMode(); }
+    };
+
+    // Appends everything that can be read right now (at least one byte, blocking until then) to pendingInput().
+    // Returns false on end of input or error.
+    bool fill() {
+        char chunk[4096];
+        while (true) {
+            ssize_t n = read(inputFd, chunk, sizeof(chunk));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            input.append(chunk, n);
+            return true;
+        }
+    }
+
+    // Bytes read but not yet consumed; whatever follows a finished line stays here for the next prompt.
+    string& pendingInput() { return input; }
+
+    // Returns the length of the escape sequence starting at @i in pendingInput(), or 0 if it is incomplete.
+    size_t escapeSequenceLength(size_t i) const {
+        if (i + 1 >= input.size()) return 0;
+        char kind = input[i + 1];
+        if (kind == 'O') return i + 2 < input.size() ? 3 : 0;
+        if (kind != '[') return 2;
+
+        // CSI: parameter and intermediate bytes, then one final byte in 0x40-0x7e
+        for (size_t j = i + 2; j < input.size(); j++) {
+            unsigned char c = input[j];
+            if (c >= 0x40 && c <= 0x7e) return j - i + 1;
+            if (c < 0x20 || c > 0x3f) return j - i + 1; // malformed, drop what we have
+        }
+        return 0;
+    }
+
+    void write(string_view s) { output.append(s); }
+    void write(char c) { output.push_back(c); }
+
+    // Sends everything written since the last flush with a single write().
+    void flush() {
+        if (output.empty()) return;
+        writeAll(outputFd, output.data(), output.size());
+        output.clear();
+    }
+
+    ~TerminalSession() { leaveRawMode(); }
+};
+
+#endif // TERMINAL_SESSION_CPP
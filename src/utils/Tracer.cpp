@@ -0,0 +1,160 @@
+#ifndef TRACER_CPP
+#define TRACER_CPP
+#include <atomic>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <ctime>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+using namespace std;
+
+// Spans around the shell's hot paths, kept in a fixed ring of the most recent events and written out on
+// demand in the Chrome trace format (chrome://tracing, ui.perfetto.dev).
+//
+// The ring is shared memory mapped on the first start, so the shell's forked children (pipeline stages,
+// parallel jobs) record into it too. Writers claim a slot with one fetch_add and publish it with a sequence
+// number, without locks; a reader skips slots that are being rewritten. While tracing is off a span costs a
+// relaxed load, and building without SHELL_TRACING removes the spans altogether.
+class Tracer {
+    static constexpr size_t CAPACITY = 1 << 16;   // events, a power of two
+
+    typedef struct {
+        atomic<uint64_t> sequence;   // 2n+1 while event n is written, 2n+2 once it is complete
+        atomic<const char*> name;    // string literal, at the same address in forked children
+        atomic<uint64_t> start;      // CLOCK_MONOTONIC ns
+        atomic<uint64_t> duration;
+        atomic<int32_t> pid;
+        atomic<int32_t> tid;
+    } Slot;
+
+    typedef struct {
+        atomic<uint64_t> head;       // events claimed so far
+        Slot slots[CAPACITY];
+    } Ring;
+
+    static inline Ring* ring = nullptr;
+    static inline atomic<bool> active = false;
+
+    // getpid() and gettid() are system calls, several times the cost of the rest of a span
+    static inline pid_t processId = 0;
+    static inline thread_local pid_t threadId = 0;
+
+    static void forgetIds() {
+        processId = 0;
+        threadId = 0;
+    }
+
+public:
+    static uint64_t now() {
+        timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return t.tv_sec * 1000000000ull + t.tv_nsec;
+    }
+
+    static bool enabled() {
+        return active.load(memory_order_relaxed);
+    }
+
+    // Empties the ring and starts recording. false if it could not be mapped.
+    static bool start() {
+        if (ring == nullptr) {
+            void* memory = mmap(nullptr, sizeof(Ring), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED) return false;
+            ring = static_cast<Ring*>(memory); // zero-filled, which is a valid empty ring
+            pthread_atfork(nullptr, nullptr, forgetIds);
+        }
+        active.store(false);
+        ring->head.store(0);
+        for (Slot& slot : ring->slots) slot.sequence.store(0, memory_order_relaxed);
+        active.store(true);
+        return true;
+    }
+
+    static void stop() {
+        active.store(false);
+    }
+
+    static void record(const char* name, uint64_t start, uint64_t end) {
+        if (ring == nullptr) return;
+        if (processId == 0) processId = getpid();
+        if (threadId == 0) threadId = gettid();
+        uint64_t event = ring->head.fetch_add(1, memory_order_relaxed);
+        Slot& slot = ring->slots[event & (CAPACITY - 1)];
+        slot.sequence.store(2 * event + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        slot.name.store(name, memory_order_relaxed);
+        slot.start.store(start, memory_order_relaxed);
+        slot.duration.store(end - start, memory_order_relaxed);
+        slot.pid.store(processId, memory_order_relaxed);
+        slot.tid.store(threadId, memory_order_relaxed);
+        slot.sequence.store(2 * event + 2, memory_order_release);
+    }
+
+    // Writes the events still in the ring to @path as a Chrome trace. Returns the number of events written,
+    // or -1 with errno set.
+    static long dump(const string& path) {
+        FILE* out = fopen(path.c_str(), "we");
+        if (out == nullptr) return -1;
+        fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+        long written = 0;
+        uint64_t head = ring == nullptr ? 0 : ring->head.load(memory_order_acquire);
+        for (uint64_t event = head > CAPACITY ? head - CAPACITY : 0; event < head; event++) {
+            Slot& slot = ring->slots[event & (CAPACITY - 1)];
+            uint64_t before = slot.sequence.load(memory_order_acquire);
+            const char* name = slot.name.load(memory_order_relaxed);
+            uint64_t start = slot.start.load(memory_order_relaxed);
+            uint64_t duration = slot.duration.load(memory_order_relaxed);
+            int pid = slot.pid.load(memory_order_relaxed);
+            int tid = slot.tid.load(memory_order_relaxed);
+            atomic_thread_fence(memory_order_acquire);
+            // overwritten by a newer event, or still being written
+            if (before != 2 * event + 2 || slot.sequence.load(memory_order_relaxed) != before) continue;
+            fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+                    written == 0 ? "" : ",", name, start / 1000.0, duration / 1000.0, pid, tid);
+            written++;
+        }
+        fprintf(out, "\n]}\n");
+        if (fclose(out) != 0) return -1;
+        return written;
+    }
+
+    static size_t capacity() { return CAPACITY; }
+
+    // events recorded since the last start, including those the ring no longer holds
+    static uint64_t recorded() {
+        return ring == nullptr ? 0 : ring->head.load(memory_order_relaxed);
+    }
+};
+
+// Records the time from its construction to the end of the scope, if tracing was on at the start.
+class TraceSpan {
+    const char* name;
+    uint64_t start;
+public:
+    explicit TraceSpan(const char* name) : name(name), start(Tracer::enabled() ? Tracer::now() : 0) {}
+    ~TraceSpan() { end(); }
+    void end() {
+        if (start != 0) Tracer::record(name, start, Tracer::now());
+        start = 0;
+    }
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#ifdef SHELL_TRACING
+// TRACE_SPAN("name"); traces the rest of the enclosing scope. the name must be a string literal.
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(name)
+// TRACE_BEGIN(span, "name"); ... TRACE_END(span); traces part of a scope
+#define TRACE_BEGIN(span, name) TraceSpan span(name)
+#define TRACE_END(span) span.end()
+#else
+#define TRACE_SPAN(name) ((void) 0)
+#define TRACE_BEGIN(span, name) ((void) 0)
+#define TRACE_END(span) ((void) 0)
+#endif
+
+#endif // TRACER_CPP
@@ -1,81 +1,251 @@
+#ifndef TRIE_CPP
+#define TRIE_CPP
 #include <iostream>
-#include <functional>
 #include <vector>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <cstdint>
 using namespace std;
 
+// Compressed radix (Patricia) trie. All nodes live in one contiguous vector and refer to each other
+// by index; edge labels and whole keys are slices of a single character arena, so a lookup never
+// chases heap pointers and results can be handed out as string_views into the arena.
+// Children of a node form a sibling list sorted by their first byte, which keeps enumeration in
+// lexicographic order.
 class Trie {
+    static constexpr uint32_t NONE = UINT32_MAX;
+
     struct Node {
-        unordered_map<char, Node*> children;
-        bool isEnd = false;
+        uint32_t labelOffset = 0;   // edge label leading into this node, as a slice of `arena`
+        uint32_t labelLength = 0;
+        uint32_t keyOffset = NONE;  // set when a word ends at this node
+        uint32_t keyLength = 0;
+        uint32_t parent = NONE;
+        uint32_t firstChild = NONE;
+        uint32_t nextSibling = NONE;
     };
-    Node* root;
 
-    // Collects all words in the trie that start with the given prefix.
-    void collect(Node* node, string prefix, vector<string>& result) {
-        if (node->isEnd) result.push_back(prefix);
-        for (auto& [ch, child] : node->children) {
-            collect(child, prefix + ch, result);
+    vector<Node> nodes;
+    string arena;
+    size_t wordCount = 0;
+
+    unsigned char firstByte(uint32_t node) const {
+        return (unsigned char) arena[nodes[node].labelOffset];
+    }
+
+    string_view label(uint32_t node) const {
+        return string_view(arena).substr(nodes[node].labelOffset, nodes[node].labelLength);
+    }
+
+    // Returns the child of @node whose label starts with @ch, or NONE. @previous is set to the sibling
+    // after which a child starting with @ch would be linked (NONE if it would be the first child).
+    uint32_t findChild(uint32_t node, unsigned char ch, uint32_t& previous) const {
+        previous = NONE;
+        for (uint32_t child = nodes[node].firstChild; child != NONE; child = nodes[child].nextSibling) {
+            unsigned char b = firstByte(child);
+            if (b == ch) return child;
+            if (b > ch) break;
+            previous = child;
         }
+        return NONE;
+    }
+
+    void link(uint32_t parent, uint32_t previous, uint32_t child) {
+        nodes[child].parent = parent;
+        if (previous == NONE) {
+            nodes[child].nextSibling = nodes[parent].firstChild;
+            nodes[parent].firstChild = child;
+        } else {
+            nodes[child].nextSibling = nodes[previous].nextSibling;
+            nodes[previous].nextSibling = child;
+        }
+    }
+
+    // Copies the word into the arena and returns its offset.
+    uint32_t store(string_view word) {
+        uint32_t offset = arena.size();
+        arena.append(word);
+        return offset;
+    }
+
+    void insert(string_view word) {
+        uint32_t node = 0;
+        size_t i = 0;
+
+        while (true) {
+            if (i == word.size()) {
+                if (nodes[node].keyOffset == NONE) {
+                    nodes[node].keyOffset = store(word);
+                    nodes[node].keyLength = word.size();
+                    wordCount++;
+                }
+                return;
+            }
+
+            uint32_t previous;
+            uint32_t child = findChild(node, word[i], previous);
+
+            if (child == NONE) {
+                // new leaf; its label is the unmatched tail of the stored key
+                uint32_t offset = store(word);
+                Node leaf;
+                leaf.labelOffset = offset + i;
+                leaf.labelLength = word.size() - i;
+                leaf.keyOffset = offset;
+                leaf.keyLength = word.size();
+                nodes.push_back(leaf);
+                link(node, previous, nodes.size() - 1);
+                wordCount++;
+                return;
+            }
+
+            string_view edge = label(child);
+            size_t common = 0;
+            while (common < edge.size() && i + common < word.size() && edge[common] == word[i + common]) {
+                common++;
+            }
+
+            if (common == edge.size()) {
+                node = child;
+                i += common;
+                continue;
+            }
+
+            // the word diverges inside the edge: split it, the middle node takes the child's place
+            Node middle;
+            middle.labelOffset = nodes[child].labelOffset;
+            middle.labelLength = common;
+            middle.parent = node;
+            middle.nextSibling = nodes[child].nextSibling;
+            middle.firstChild = child;
+            nodes.push_back(middle);
+            uint32_t middleIndex = nodes.size() - 1;
+
+            if (previous == NONE) nodes[node].firstChild = middleIndex;
+            else nodes[previous].nextSibling = middleIndex;
+
+            nodes[child].labelOffset += common;
+            nodes[child].labelLength -= common;
+            nodes[child].parent = middleIndex;
+            nodes[child].nextSibling = NONE;
+
+            node = middleIndex;
+            i += common;
+        }
+    }
+
+    // Returns the node whose subtree holds exactly the words starting with @prefix, or NONE.
+    uint32_t locate(string_view prefix) const {
+        uint32_t node = 0;
+        size_t i = 0;
+        while (i < prefix.size()) {
+            uint32_t previous;
+            uint32_t child = findChild(node, prefix[i], previous);
+            if (child == NONE) return NONE;
+
+            string_view edge = label(child);
+            size_t n = min(edge.size(), prefix.size() - i);
+            if (edge.substr(0, n) != prefix.substr(i, n)) return NONE;
+
+            node = child;
+            i += n;
+        }
+        return node;
+    }
+
+    // Pre-order successor of @node that stays inside the subtree rooted at @root, or NONE.
+    uint32_t successor(uint32_t node, uint32_t root) const {
+        if (nodes[node].firstChild != NONE) return nodes[node].firstChild;
+        while (node != root) {
+            if (nodes[node].nextSibling != NONE) return nodes[node].nextSibling;
+            node = nodes[node].parent;
+        }
+        return NONE;
     }
 
 public:
+    // Walks the words of one subtree in lexicographic order without allocating. The views point into
+    // the trie's arena and stay valid until the trie is modified.
+    class PrefixIterator {
+        const Trie* trie = nullptr;
+        uint32_t root = NONE;
+        uint32_t node = NONE;
+
+        void skipToWord() {
+            while (node != NONE && trie->nodes[node].keyOffset == NONE) {
+                node = trie->successor(node, root);
+            }
+        }
+
+    public:
+        PrefixIterator() = default;
+        PrefixIterator(const Trie* trie, uint32_t root) : trie(trie), root(root), node(root) { skipToWord(); }
+
+        string_view operator*() const {
+            const Node& n = trie->nodes[node];
+            return string_view(trie->arena).substr(n.keyOffset, n.keyLength);
+        }
+
+        PrefixIterator& operator++() {
+            node = trie->successor(node, root);
+            skipToWord();
+            return *this;
+        }
+
+        bool operator==(const PrefixIterator& other) const { return node == other.node; }
+        bool operator!=(const PrefixIterator& other) const { return node != other.node; }
+    };
+
+    struct PrefixRange {
+        PrefixIterator first;
+        PrefixIterator last;
+        PrefixIterator begin() const { return first; }
+        PrefixIterator end() const { return last; }
+    };
+
     // Constructs an empty Trie.
-    Trie() : root(new Node()) {}
+    Trie() { clear(); }
 
     // Inserts all strings from the input vector into the trie.
     void add(const vector<string>& words) {
-        for (const string& word : words) {
-            Node* node = root;
-            for (char ch : word) {
-                if (!node->children.count(ch))
-                    node->children[ch] = new Node();
-                node = node->children[ch];
-            }
-            node->isEnd = true;
-        }
+        for (const string& word : words) insert(word);
     }
 
     // Returns true if the given word exists in the trie.
-    bool find(const string& word) {
-        Node* node = root;
-        for (char ch : word) {
-            if (!node->children.count(ch)) return false;
-            node = node->children[ch];
-        }
-        return node->isEnd;
+    bool find(const string& word) const {
+        uint32_t node = locate(word);
+        if (node == NONE || nodes[node].keyOffset == NONE) return false;
+        return nodes[node].keyLength == word.size();
     }
 
-    // Returns all words in the trie that start with the given prefix.
-    vector<string> getAllByPrefix(const string& prefix) {
-        Node* node = root;
-        for (char ch : prefix) {
-            if (!node->children.count(ch)) return {};
-            node = node->children[ch];
-        }
+    // Returns all words in the trie that start with the given prefix, in lexicographic order.
+    vector<string> getAllByPrefix(const string& prefix) const {
         vector<string> result;
-        collect(node, prefix, result);
+        for (string_view word : withPrefix(prefix)) result.emplace_back(word);
         return result;
     }
 
-    // Empties the entire trie by deleting all nodes and resetting the root.
-    void clear() {
-        function<void(Node*)> cleanup = [&](Node* node) {
-            for (auto& [_, child] : node->children) cleanup(child);
-            delete node;
-        };
-        cleanup(root);
-        root = new Node();
+    // Returns an allocation-free range over the words that start with the given prefix.
+    PrefixRange withPrefix(string_view prefix) const {
+        uint32_t node = locate(prefix);
+        if (node == NONE) return {};
+        return {PrefixIterator(this, node), PrefixIterator()};
     }
 
+    // Number of distinct words stored.
+    size_t size() const { return wordCount; }
 
-    // Destructor: Recursively deletes all nodes in the trie.
-    ~Trie() {
-        function<void(Node*)> cleanup = [&](Node* node) {
-            for (auto& [_, child] : node->children) cleanup(child);
-            delete node;
-        };
-        cleanup(root);
+    // Bytes held by the node array and the character arena.
+    size_t memoryUsage() const {
+        return nodes.capacity() * sizeof(Node) + arena.capacity();
+    }
+
+    // Empties the entire trie, keeping only the root.
+    void clear() {
+        nodes.assign(1, Node());
+        arena.clear();
+        wordCount = 0;
     }
 };
+
+#endif // TRIE_CPP